@@ -0,0 +1,770 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * pcap-replay - push a capture through the translation core in user space.
+ *
+ * Links the module's own xlate.c (built against user/shim.h) and drives it
+ * the way nat_handle_packet() does: look up both addresses, rewrite them,
+ * translate the header inside ICMPv6 errors.  The mapping table is a
+ * user-space copy of the hash engine -- the same keys, nat_hkey_hash() and
+ * longest-length-first probing -- so the number and spread of prefix
+ * lengths in the mappings file shape the cost as they would in the kernel.
+ *
+ *   make -C src replay
+ *   ./src/bench/pcap-replay [-t threads] [-r rounds] [-d in|out|auto] mappings capture.pcap
+ *
+ * The mappings file takes the lines of slick_nat_batch ("add eth0
+ * fd00::/64 2001:db8::/64 [nptv6]") or of slick_nat_mappings; anything
+ * else is ignored, and every mapping sits on one external interface.
+ * Direction "auto" treats a packet as inbound when its destination is one
+ * of the external prefixes.
+ *
+ * A first pass translates every packet once and verifies the transport
+ * checksum of each output whose input was valid; any mismatch fails the
+ * run.  Then every thread, pinned to its own CPU, replays the capture for
+ * the given rounds and reports packets per second.  Between rounds only
+ * the first RESTORE bytes of a packet are put back, which covers every
+ * byte the core writes unless extension headers push the transport header
+ * past them.
+ *
+ * Classic pcap only (not pcapng), with Ethernet, raw IP or Linux cooked
+ * link types.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../xlate.h"
+
+#define RESTORE 256
+#define BAD_SHOWN 10
+
+/* --- mapping table ------------------------------------------------------- */
+
+struct mapping {
+    struct in6_addr internal_prefix;
+    struct in6_addr external_prefix;
+    int prefix_len;
+    __be64 prefix_mask[2];
+    u16 csum_delta;
+    bool nptv6;
+    struct mapping *internal_next;
+    struct mapping *external_next;
+};
+
+struct table {
+    struct mapping **internal;
+    struct mapping **external;
+    u32 hash_mask;
+    u32 seed;
+    unsigned int count;
+    /* Lengths in use, longest first: the hash engine's probe order. */
+    int lens[129];
+    int nlens;
+};
+
+static struct mapping *table_find(const struct table *t, const struct in6_addr *addr,
+                                  bool external) {
+    struct in6_addr key;
+    struct mapping *m;
+    int i, len;
+
+    for (i = 0; i < t->nlens; i++) {
+        len = t->lens[i];
+        nat_addr_mask(&key, addr, len);
+        m = (external ? t->external : t->internal)[nat_hkey_hash(&key, len, t->seed) &
+                                                   t->hash_mask];
+        for (; m; m = external ? m->external_next : m->internal_next) {
+            if (m->prefix_len == len &&
+                !memcmp(external ? &m->external_prefix : &m->internal_prefix, &key,
+                        sizeof(key)))
+                return m;
+        }
+    }
+
+    return NULL;
+}
+
+/* nat_xlate_set(), minus the counters. */
+static void xlate_set(struct nat_xlate *x, const struct mapping *m, bool external_to_internal) {
+    memset(x, 0, sizeof(*x));
+    if (!m)
+        return;
+
+    x->prefix_len = m->prefix_len;
+    memcpy(x->prefix_mask, m->prefix_mask, sizeof(x->prefix_mask));
+    x->nptv6 = m->nptv6;
+    if (external_to_internal) {
+        x->from_prefix = m->external_prefix;
+        x->to_prefix = m->internal_prefix;
+        x->csum_delta = ~m->csum_delta;
+    } else {
+        x->from_prefix = m->internal_prefix;
+        x->to_prefix = m->external_prefix;
+        x->csum_delta = m->csum_delta;
+    }
+    x->valid = true;
+}
+
+static int parse_prefix(const char *str, struct in6_addr *addr, int *len) {
+    char buf[64], *slash, *end;
+    struct in6_addr full;
+    long l;
+
+    if (strlen(str) >= sizeof(buf))
+        return -1;
+    strcpy(buf, str);
+    slash = strchr(buf, '/');
+    if (!slash)
+        return -1;
+    *slash = '\0';
+    l = strtol(slash + 1, &end, 10);
+    if (*end || end == slash + 1 || l < 0 || l > 128)
+        return -1;
+    if (inet_pton(AF_INET6, buf, &full) != 1)
+        return -1;
+
+    *len = l;
+    ipv6_addr_prefix(addr, &full, l);
+    return 0;
+}
+
+static int table_load(struct table *t, const char *path) {
+    struct mapping *list = NULL, *m, *next;
+    unsigned int used[129] = { 0 }, size, lineno = 0;
+    char line[512], *tok[6];
+    struct in6_addr in, ex;
+    int n, in_len, ex_len, len;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        char *p = line, *s;
+
+        lineno++;
+        for (n = 0; n < 6 && (s = strtok(n ? NULL : p, " \t\r\n")); n++)
+            tok[n] = s;
+        if (n == 0 || tok[0][0] == '#')
+            continue;
+
+        /* "add <if> <int> <ext> [nptv6]" or "<if> <int> -> <ext> [nptv6]" */
+        if (!strcmp(tok[0], "add") && n >= 4) {
+            tok[0] = tok[1];
+            tok[1] = tok[2];
+            tok[2] = tok[3];
+            tok[3] = n > 4 ? tok[4] : NULL;
+        } else if (n >= 4 && !strcmp(tok[2], "->")) {
+            tok[2] = tok[3];
+            tok[3] = n > 4 ? tok[4] : NULL;
+        } else {
+            continue;
+        }
+
+        if (parse_prefix(tok[1], &in, &in_len) || parse_prefix(tok[2], &ex, &ex_len) ||
+            in_len != ex_len) {
+            fprintf(stderr, "%s:%u: bad mapping\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+
+        m = calloc(1, sizeof(*m));
+        if (!m) {
+            fclose(f);
+            return -1;
+        }
+        m->internal_prefix = in;
+        m->external_prefix = ex;
+        m->prefix_len = in_len;
+        nat_prefix_mask(m->prefix_mask, in_len);
+        m->csum_delta = nat_csum_delta(&in, &ex, in_len);
+        m->nptv6 = tok[3] && !strcmp(tok[3], "nptv6");
+        if (m->nptv6 && in_len > 64) {
+            fprintf(stderr, "%s:%u: nptv6 needs a prefix of at most /64\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+        m->internal_next = list;
+        list = m;
+        used[in_len]++;
+        t->count++;
+    }
+    fclose(f);
+
+    if (!t->count) {
+        fprintf(stderr, "%s: no mappings\n", path);
+        return -1;
+    }
+
+    for (size = 16; size < 2 * t->count; size <<= 1)
+        ;
+    t->hash_mask = size - 1;
+    t->seed = 0x5eed;
+    t->internal = calloc(size, sizeof(*t->internal));
+    t->external = calloc(size, sizeof(*t->external));
+    if (!t->internal || !t->external)
+        return -1;
+
+    /* The file was read into a stack, so pushing onto the chains restores
+     * its order: the first mapping of a duplicated prefix wins. */
+    for (m = list; m; m = next) {
+        u32 h;
+
+        next = m->internal_next;
+        h = nat_hkey_hash(&m->internal_prefix, m->prefix_len, t->seed) & t->hash_mask;
+        m->internal_next = t->internal[h];
+        t->internal[h] = m;
+        h = nat_hkey_hash(&m->external_prefix, m->prefix_len, t->seed) & t->hash_mask;
+        m->external_next = t->external[h];
+        t->external[h] = m;
+    }
+
+    for (len = 128; len >= 0; len--) {
+        if (used[len])
+            t->lens[t->nlens++] = len;
+    }
+
+    return 0;
+}
+
+static void table_free(struct table *t) {
+    struct mapping *m, *next;
+    u32 i;
+
+    for (i = 0; t->internal && i <= t->hash_mask; i++) {
+        for (m = t->internal[i]; m; m = next) {
+            next = m->internal_next;
+            free(m);
+        }
+    }
+    free(t->internal);
+    free(t->external);
+}
+
+/* --- capture ------------------------------------------------------------- */
+
+struct packet {
+    unsigned int offset;    /* into the capture's IPv6 byte arena */
+    unsigned int len;
+    bool truncated;
+};
+
+struct capture {
+    unsigned char *bytes;
+    struct packet *pkts;
+    unsigned int count;
+    unsigned int total;     /* records in the file, IPv6 or not */
+    unsigned int max_len;
+    size_t arena_len;
+};
+
+#define PCAP_MAGIC_US 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_RAW_OLD 12
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+
+static u32 pcap32(u32 v, bool swap) {
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+/* Offset of the IPv6 header in a frame, or -1 if it carries none. */
+static int l3_offset(const unsigned char *p, unsigned int len, u32 linktype) {
+    unsigned int off;
+    u16 proto;
+
+    switch (linktype) {
+    case LINKTYPE_ETHERNET:
+        if (len < 14)
+            return -1;
+        off = 12;
+        proto = p[off] << 8 | p[off + 1];
+        /* 802.1Q and 802.1ad tags. */
+        while ((proto == 0x8100 || proto == 0x88a8) && len >= off + 6) {
+            off += 4;
+            proto = p[off] << 8 | p[off + 1];
+        }
+        off += 2;
+        break;
+    case LINKTYPE_LINUX_SLL:
+        if (len < 16)
+            return -1;
+        proto = p[14] << 8 | p[15];
+        off = 16;
+        break;
+    case LINKTYPE_LINUX_SLL2:
+        if (len < 20)
+            return -1;
+        proto = p[0] << 8 | p[1];
+        off = 20;
+        break;
+    case LINKTYPE_RAW:
+    case LINKTYPE_RAW_OLD:
+    case LINKTYPE_IPV6:
+        proto = 0x86dd;
+        off = 0;
+        break;
+    default:
+        return -1;
+    }
+
+    if (proto != 0x86dd || len < off + sizeof(struct ipv6hdr) || (p[off] >> 4) != 6)
+        return -1;
+
+    return off;
+}
+
+static int capture_load(struct capture *c, const char *path) {
+    unsigned char hdr[24], rec[16];
+    unsigned char *frame = NULL;
+    size_t cap = 0;
+    u32 magic, linktype, incl, orig;
+    bool swap;
+    FILE *f;
+    int off;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr))
+        goto bad;
+
+    memcpy(&magic, hdr, 4);
+    if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS)
+        swap = false;
+    else if (__builtin_bswap32(magic) == PCAP_MAGIC_US ||
+             __builtin_bswap32(magic) == PCAP_MAGIC_NS)
+        swap = true;
+    else
+        goto bad;
+    memcpy(&linktype, hdr + 20, 4);
+    linktype = pcap32(linktype, swap) & 0xffff;
+
+    while (fread(rec, 1, sizeof(rec), f) == sizeof(rec)) {
+        struct packet *pkts;
+
+        memcpy(&incl, rec + 8, 4);
+        memcpy(&orig, rec + 12, 4);
+        incl = pcap32(incl, swap);
+        orig = pcap32(orig, swap);
+        if (incl > 262144)
+            goto bad;
+
+        frame = realloc(frame, incl ? incl : 1);
+        if (!frame || fread(frame, 1, incl, f) != incl)
+            goto bad;
+        c->total++;
+
+        off = l3_offset(frame, incl, linktype);
+        if (off < 0)
+            continue;
+
+        if (c->arena_len + incl > cap) {
+            cap = (cap + incl) * 2;
+            c->bytes = realloc(c->bytes, cap);
+            if (!c->bytes)
+                goto bad;
+        }
+        pkts = realloc(c->pkts, (c->count + 1) * sizeof(*pkts));
+        if (!pkts)
+            goto bad;
+        c->pkts = pkts;
+
+        memcpy(c->bytes + c->arena_len, frame + off, incl - off);
+        c->pkts[c->count].offset = c->arena_len;
+        c->pkts[c->count].len = incl - off;
+        c->pkts[c->count].truncated = incl < orig;
+        c->arena_len += incl - off;
+        if (incl - off > c->max_len)
+            c->max_len = incl - off;
+        c->count++;
+    }
+
+    free(frame);
+    fclose(f);
+    if (!c->count) {
+        fprintf(stderr, "%s: no IPv6 packets\n", path);
+        return -1;
+    }
+    return 0;
+
+bad:
+    fprintf(stderr, "%s: not a readable classic pcap file\n", path);
+    free(frame);
+    fclose(f);
+    return -1;
+}
+
+static void capture_free(struct capture *c) {
+    free(c->bytes);
+    free(c->pkts);
+}
+
+/* --- translation --------------------------------------------------------- */
+
+enum direction { DIR_AUTO, DIR_IN, DIR_OUT };
+
+enum verdict { V_PASS, V_XLATE, V_DROP, V_SKIP };
+
+static enum direction direction = DIR_AUTO;
+
+static void lookup_pair(const struct table *t, const struct in6_addr *saddr,
+                        const struct in6_addr *daddr, bool external,
+                        struct nat_xlate *xs, struct nat_xlate *xd) {
+    xlate_set(xs, table_find(t, saddr, external), external);
+    xlate_set(xd, table_find(t, daddr, external), external);
+}
+
+static bool is_link_local(const struct in6_addr *a) {
+    return (a->s6_addr[0] == 0xfe) && ((a->s6_addr[1] & 0xc0) == 0x80);
+}
+
+/* nat_handle_packet() without the parts that need a real stack: hop
+ * limit expiry, neighbour discovery and making the buffer writable. */
+static enum verdict translate(const struct table *t, struct sk_buff *skb, int *thoffp,
+                              u8 *protop, bool *first_fragp) {
+    struct ipv6hdr *iph = ipv6_hdr(skb);
+    struct nat_xlate xs, xd, es, ed;
+    bool is_icmp_error = false, inner = false, external;
+    bool first_frag;
+    u8 proto;
+    int thoff;
+
+    thoff = nat_transport_offset(skb, &proto, &first_frag);
+    if (thoff < 0)
+        return V_SKIP;
+    *thoffp = thoff;
+    *protop = proto;
+    *first_fragp = first_frag;
+
+    if (proto == IPPROTO_ICMPV6 && first_frag) {
+        struct icmp6hdr *icmp6h;
+
+        if (skb->len < thoff + sizeof(*icmp6h))
+            return V_PASS;
+        icmp6h = (struct icmp6hdr *)(skb->data + thoff);
+        switch (icmp6h->icmp6_type) {
+        case ICMPV6_DEST_UNREACH:
+        case ICMPV6_PKT_TOOBIG:
+        case ICMPV6_TIME_EXCEED:
+        case ICMPV6_PARAMPROB:
+            is_icmp_error = true;
+            break;
+        case ICMPV6_ECHO_REQUEST:
+        case ICMPV6_ECHO_REPLY:
+            break;
+        default:
+            return V_PASS;
+        }
+    }
+
+    if (is_link_local(&iph->saddr) && is_link_local(&iph->daddr))
+        return V_PASS;
+
+    if (direction == DIR_AUTO)
+        external = table_find(t, &iph->daddr, true) != NULL;
+    else
+        external = direction == DIR_IN;
+
+    lookup_pair(t, &iph->saddr, &iph->daddr, external, &xs, &xd);
+    if (external ? !xd.valid : !xs.valid)
+        return V_PASS;
+
+    if (is_icmp_error &&
+        skb->len >= thoff + sizeof(struct icmp6hdr) + sizeof(struct ipv6hdr)) {
+        struct ipv6hdr *emb = (struct ipv6hdr *)(skb->data + thoff + sizeof(struct icmp6hdr));
+
+        lookup_pair(t, &emb->saddr, &emb->daddr, external, &es, &ed);
+        inner = nat_xlate_embedded(skb, thoff, &es, &ed);
+    }
+
+    if (external) {
+        if (!nat_rewrite_addr(skb, thoff, proto, first_frag, &iph->daddr, &xd))
+            return V_DROP;
+        if (xs.valid && !nat_rewrite_addr(skb, thoff, proto, first_frag, &iph->saddr, &xs))
+            return V_DROP;
+    } else {
+        if (!nat_rewrite_addr(skb, thoff, proto, first_frag, &iph->saddr, &xs))
+            return V_DROP;
+        if (xd.valid && !nat_rewrite_addr(skb, thoff, proto, first_frag, &iph->daddr, &xd))
+            return V_DROP;
+    }
+
+    if (inner)
+        nat_icmp6_csum_recalc(skb, thoff);
+
+    return V_XLATE;
+}
+
+/* Whether the transport checksum of an unfragmented, untruncated packet
+ * holds: 1 yes, 0 no, -1 cannot tell. */
+static int csum_ok(const struct sk_buff *skb, int thoff, u8 proto) {
+    const struct ipv6hdr *iph = ipv6_hdr(skb);
+    unsigned int len;
+
+    if (skb->len != sizeof(*iph) + ntohs(iph->payload_len) || thoff > (int)skb->len)
+        return -1;
+    len = skb->len - thoff;
+
+    switch (proto) {
+    case IPPROTO_TCP:
+        if (len < sizeof(struct tcphdr))
+            return -1;
+        break;
+    case IPPROTO_UDP:
+        if (len < sizeof(struct udphdr) ||
+            !((const struct udphdr *)(skb->data + thoff))->check)
+            return -1;
+        break;
+    case IPPROTO_ICMPV6:
+        if (len < sizeof(struct icmp6hdr))
+            return -1;
+        break;
+    default:
+        return -1;
+    }
+
+    return !csum_ipv6_magic(&iph->saddr, &iph->daddr, len, proto,
+                            csum_partial(skb->data + thoff, len, 0));
+}
+
+struct verify_stats {
+    unsigned int verdicts[4];
+    unsigned int ok, unchecked, bad_in, bad_out;
+};
+
+static void verify(const struct table *t, const struct capture *c, struct verify_stats *vs) {
+    unsigned char *buf = malloc(c->max_len);
+    char sa[INET6_ADDRSTRLEN], da[INET6_ADDRSTRLEN];
+    unsigned int i;
+
+    if (!buf) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for (i = 0; i < c->count; i++) {
+        const struct packet *p = &c->pkts[i];
+        struct sk_buff skb = { .data = buf, .len = p->len, .ip_summed = CHECKSUM_NONE };
+        bool first_frag = false;
+        int thoff = -1, before = -1, after;
+        enum verdict v;
+        u8 proto = 0;
+
+        memcpy(buf, c->bytes + p->offset, p->len);
+        v = translate(t, &skb, &thoff, &proto, &first_frag);
+        vs->verdicts[v]++;
+        if (v != V_XLATE)
+            continue;
+
+        if (!p->truncated && first_frag) {
+            struct sk_buff orig = { .data = c->bytes + p->offset, .len = p->len };
+
+            before = csum_ok(&orig, thoff, proto);
+        }
+        if (before < 0) {
+            vs->unchecked++;
+            continue;
+        }
+        if (!before) {
+            vs->bad_in++;
+            continue;
+        }
+
+        after = csum_ok(&skb, thoff, proto);
+        if (after == 1) {
+            vs->ok++;
+            continue;
+        }
+
+        if (vs->bad_out++ < BAD_SHOWN) {
+            inet_ntop(AF_INET6, &ipv6_hdr(&skb)->saddr, sa, sizeof(sa));
+            inet_ntop(AF_INET6, &ipv6_hdr(&skb)->daddr, da, sizeof(da));
+            fprintf(stderr, "packet %u: bad checksum after translation (proto %u, %s -> %s)\n",
+                    i + 1, proto, sa, da);
+        }
+    }
+
+    free(buf);
+}
+
+/* --- replay -------------------------------------------------------------- */
+
+struct worker {
+    pthread_t thread;
+    const struct table *t;
+    const struct capture *c;
+    unsigned int rounds;
+    int cpu;
+    unsigned char *arena;
+    u64 packets;
+    u64 ns;
+    unsigned int sink;
+};
+
+static u64 now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *worker_run(void *arg) {
+    struct worker *w = arg;
+    const struct capture *c = w->c;
+    unsigned int r, i, sink = 0;
+    cpu_set_t set;
+    u64 start;
+
+    if (w->cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    /* A private copy, so threads never share a written cache line. */
+    w->arena = malloc(c->arena_len);
+    if (!w->arena) {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(w->arena, c->bytes, c->arena_len);
+
+    start = now_ns();
+    for (r = 0; r < w->rounds; r++) {
+        for (i = 0; i < c->count; i++) {
+            const struct packet *p = &c->pkts[i];
+            struct sk_buff skb = {
+                .data = w->arena + p->offset,
+                .len = p->len,
+                .ip_summed = CHECKSUM_NONE,
+            };
+            bool first_frag;
+            int thoff;
+            u8 proto;
+
+            memcpy(skb.data, c->bytes + p->offset, p->len < RESTORE ? p->len : RESTORE);
+            sink += translate(w->t, &skb, &thoff, &proto, &first_frag);
+        }
+    }
+    w->ns = now_ns() - start;
+    w->packets = (u64)w->rounds * c->count;
+    w->sink = sink;
+
+    free(w->arena);
+    return NULL;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-t threads] [-r rounds] [-d in|out|auto] mappings capture.pcap\n",
+            prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    static const char * const verdict_names[] = { "passed", "translated", "dropped", "unparsed" };
+    struct table t = { 0 };
+    struct capture c = { 0 };
+    struct verify_stats vs = { 0 };
+    struct worker *w;
+    unsigned int threads = 1, rounds = 100, i;
+    double total = 0;
+    cpu_set_t allowed;
+    int cpu = -1, opt;
+
+    while ((opt = getopt(argc, argv, "t:r:d:")) != -1) {
+        switch (opt) {
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        case 'd':
+            if (!strcmp(optarg, "in"))
+                direction = DIR_IN;
+            else if (!strcmp(optarg, "out"))
+                direction = DIR_OUT;
+            else if (!strcmp(optarg, "auto"))
+                direction = DIR_AUTO;
+            else
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2 || !threads || !rounds)
+        usage(argv[0]);
+
+    nat_xlate_init();
+    if (table_load(&t, argv[optind]) || capture_load(&c, argv[optind + 1]))
+        return 1;
+
+    printf("%u mapping(s), %d prefix length(s); %u packet(s), %u IPv6\n",
+           t.count, t.nlens, c.total, c.count);
+
+    verify(&t, &c, &vs);
+    for (i = 0; i < 4; i++)
+        printf("%s%u %s", i ? ", " : "", vs.verdicts[i], verdict_names[i]);
+    printf("\nchecksums: %u ok, %u not checked, %u bad on input, %u BAD after translation\n",
+           vs.ok, vs.unchecked, vs.bad_in, vs.bad_out);
+    if (vs.bad_out) {
+        capture_free(&c);
+        table_free(&t);
+        return 1;
+    }
+
+    w = calloc(threads, sizeof(*w));
+    if (!w)
+        return 1;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed))
+        CPU_ZERO(&allowed);
+
+    for (i = 0; i < threads; i++) {
+        /* Round-robin over the CPUs we may run on. */
+        do {
+            cpu = (cpu + 1) % CPU_SETSIZE;
+        } while (CPU_COUNT(&allowed) && !CPU_ISSET(cpu, &allowed));
+
+        w[i].t = &t;
+        w[i].c = &c;
+        w[i].rounds = rounds;
+        w[i].cpu = CPU_COUNT(&allowed) ? cpu : -1;
+        if (pthread_create(&w[i].thread, NULL, worker_run, &w[i])) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    for (i = 0; i < threads; i++) {
+        double pps;
+
+        pthread_join(w[i].thread, NULL);
+        pps = w[i].packets * 1e9 / (w[i].ns ? w[i].ns : 1);
+        total += pps;
+        printf("cpu %3d: %8.3f Mpps  %7.1f ns/packet\n", w[i].cpu, pps / 1e6,
+               (double)w[i].ns / w[i].packets);
+    }
+    printf("total:   %8.3f Mpps on %u thread(s), %u round(s)\n", total / 1e6, threads, rounds);
+
+    free(w);
+    capture_free(&c);
+    table_free(&t);
+    return 0;
+}
@@ -0,0 +1,401 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * pktblast - IPv6 traffic generator for scripts/netns-bench.sh.
+ *
+ * Sends prebuilt Ethernet frames on a packet socket (qdisc bypassed, 64 per
+ * sendmmsg()) from one pinned thread per CPU.  Unlike pktgen it can vary
+ * IPv6 source addresses and build TCP, ICMPv6 errors and neighbour
+ * solicitations, which is what exercising the NAT lookups needs.
+ *
+ *   pktblast -i dev -M dst-mac -m udp|tcp|icmperr|ns -s src -d dst
+ *            [-S] [-D] [-n count] [-t threads] [-T seconds] [-l payload]
+ *
+ * -S / -D spread the source / destination over the first count mapping
+ * prefixes the benchmark loads: bits 32-63 of the address become a random
+ * index below count and the low 64 bits a random host.  An ICMPv6 error
+ * carries a UDP packet that went the other way (source and destination
+ * swapped); a neighbour solicitation goes to the target's solicited-node
+ * group and asks for the destination address.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <netinet/ether.h>
+#include <netpacket/packet.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#define RING 1024
+#define BATCH 64
+#define FRAME_MAX 256
+
+enum mix { MIX_UDP, MIX_TCP, MIX_ICMPERR, MIX_NS };
+
+static const char * const mix_names[] = { "udp", "tcp", "icmperr", "ns" };
+
+static struct {
+    int ifindex;
+    unsigned char src_mac[6];
+    unsigned char dst_mac[6];
+    enum mix mix;
+    struct in6_addr src, dst;
+    bool spread_src, spread_dst;
+    uint32_t count;
+    unsigned int payload;
+    unsigned int seconds;
+} cfg = { .count = 1, .payload = 18, .seconds = 10 };
+
+struct frame {
+    unsigned char data[FRAME_MAX];
+    unsigned int len;
+};
+
+struct worker {
+    pthread_t thread;
+    int cpu;
+    unsigned int seed;
+    struct frame *ring;
+    uint64_t sent;
+    uint64_t ns;
+};
+
+static uint32_t sum16(const void *buf, size_t len, uint32_t sum) {
+    const uint8_t *p = buf;
+
+    for (; len > 1; len -= 2, p += 2)
+        sum += p[0] << 8 | p[1];
+    if (len)
+        sum += p[0] << 8;
+    return sum;
+}
+
+static uint16_t l4_csum(const struct in6_addr *s, const struct in6_addr *d, uint8_t proto,
+                        const void *l4, size_t len) {
+    uint32_t sum = 0;
+
+    sum = sum16(s, 16, sum);
+    sum = sum16(d, 16, sum);
+    sum += len >> 16;
+    sum += len & 0xffff;
+    sum += proto;
+    sum = sum16(l4, len, sum);
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return htons(~sum & 0xffff);
+}
+
+static void spread(struct in6_addr *a, const struct in6_addr *base, unsigned int *seed) {
+    uint32_t idx = rand_r(seed) % cfg.count;
+
+    *a = *base;
+    a->s6_addr32[1] = htonl(idx);
+    a->s6_addr32[2] = rand_r(seed);
+    a->s6_addr32[3] = rand_r(seed) | htonl(1);
+}
+
+/* A UDP datagram at l4, returning its length. */
+static size_t put_udp(unsigned char *l4, const struct in6_addr *s, const struct in6_addr *d,
+                      unsigned int payload, unsigned int *seed) {
+    struct udphdr *uh = (struct udphdr *)l4;
+    size_t len = sizeof(*uh) + payload;
+
+    memset(l4, 0, len);
+    uh->uh_sport = htons(1024 + rand_r(seed) % 60000);
+    uh->uh_dport = htons(9);
+    uh->uh_ulen = htons(len);
+    uh->uh_sum = l4_csum(s, d, IPPROTO_UDP, l4, len);
+    if (!uh->uh_sum)
+        uh->uh_sum = 0xffff;
+    return len;
+}
+
+static void build(struct frame *f, unsigned int *seed) {
+    struct ether_header *eth = (struct ether_header *)f->data;
+    struct ip6_hdr *ip6 = (struct ip6_hdr *)(eth + 1);
+    unsigned char *l4 = (unsigned char *)(ip6 + 1);
+    struct in6_addr s = cfg.src, d = cfg.dst;
+    size_t len = 0;
+    uint8_t proto = IPPROTO_UDP, hlim = 64;
+
+    if (cfg.spread_src)
+        spread(&s, &cfg.src, seed);
+    if (cfg.spread_dst)
+        spread(&d, &cfg.dst, seed);
+
+    memset(f->data, 0, sizeof(f->data));
+    memcpy(eth->ether_dhost, cfg.dst_mac, 6);
+    memcpy(eth->ether_shost, cfg.src_mac, 6);
+    eth->ether_type = htons(ETHERTYPE_IPV6);
+
+    switch (cfg.mix) {
+    case MIX_UDP:
+        len = put_udp(l4, &s, &d, cfg.payload, seed);
+        break;
+    case MIX_TCP: {
+        struct tcphdr *th = (struct tcphdr *)l4;
+
+        proto = IPPROTO_TCP;
+        len = sizeof(*th);
+        th->th_sport = htons(1024 + rand_r(seed) % 60000);
+        th->th_dport = htons(80);
+        th->th_seq = rand_r(seed);
+        th->th_off = 5;
+        th->th_flags = TH_SYN;
+        th->th_win = htons(65535);
+        th->th_sum = l4_csum(&s, &d, IPPROTO_TCP, l4, len);
+        break;
+    }
+    case MIX_ICMPERR: {
+        struct icmp6_hdr *ih = (struct icmp6_hdr *)l4;
+        struct ip6_hdr *emb = (struct ip6_hdr *)(ih + 1);
+        size_t ulen;
+
+        /* The packet that went the other way and bounced. */
+        ulen = put_udp((unsigned char *)(emb + 1), &d, &s, cfg.payload, seed);
+        emb->ip6_flow = htonl(6 << 28);
+        emb->ip6_plen = htons(ulen);
+        emb->ip6_nxt = IPPROTO_UDP;
+        emb->ip6_hlim = 63;
+        emb->ip6_src = d;
+        emb->ip6_dst = s;
+
+        proto = IPPROTO_ICMPV6;
+        len = sizeof(*ih) + sizeof(*emb) + ulen;
+        ih->icmp6_type = ICMP6_DST_UNREACH;
+        ih->icmp6_code = ICMP6_DST_UNREACH_NOPORT;
+        ih->icmp6_cksum = l4_csum(&s, &d, IPPROTO_ICMPV6, l4, len);
+        break;
+    }
+    case MIX_NS: {
+        struct nd_neighbor_solicit *ns = (struct nd_neighbor_solicit *)l4;
+        unsigned char *opt = (unsigned char *)(ns + 1);
+        struct in6_addr target = d;
+
+        /* ff02::1:ffXX:XXXX and its 33:33:ff:XX:XX:XX */
+        inet_pton(AF_INET6, "ff02::1:ff00:0", &d);
+        memcpy(&d.s6_addr[13], &target.s6_addr[13], 3);
+        eth->ether_dhost[0] = 0x33;
+        eth->ether_dhost[1] = 0x33;
+        memcpy(&eth->ether_dhost[2], &d.s6_addr[12], 4);
+
+        proto = IPPROTO_ICMPV6;
+        hlim = 255;
+        len = sizeof(*ns) + 8;
+        ns->nd_ns_type = ND_NEIGHBOR_SOLICIT;
+        ns->nd_ns_target = target;
+        opt[0] = ND_OPT_SOURCE_LINKADDR;
+        opt[1] = 1;
+        memcpy(opt + 2, cfg.src_mac, 6);
+        ns->nd_ns_cksum = l4_csum(&s, &d, IPPROTO_ICMPV6, l4, len);
+        break;
+    }
+    }
+
+    ip6->ip6_flow = htonl(6 << 28);
+    ip6->ip6_plen = htons(len);
+    ip6->ip6_nxt = proto;
+    ip6->ip6_hlim = hlim;
+    ip6->ip6_src = s;
+    ip6->ip6_dst = d;
+    f->len = sizeof(*eth) + sizeof(*ip6) + len;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *worker_run(void *arg) {
+    struct worker *w = arg;
+    struct mmsghdr msgs[BATCH];
+    struct iovec iov[BATCH];
+    struct sockaddr_ll sll = {
+        .sll_family = AF_PACKET,
+        .sll_protocol = htons(ETH_P_IPV6),
+        .sll_ifindex = cfg.ifindex,
+    };
+    uint64_t start, end;
+    unsigned int next = 0, i;
+    cpu_set_t set;
+    int fd, one = 1, ret;
+
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&sll, sizeof(sll)) ||
+        setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one))) {
+        perror("packet socket");
+        exit(1);
+    }
+
+    memset(msgs, 0, sizeof(msgs));
+    start = now_ns();
+    end = start + cfg.seconds * 1000000000ULL;
+    while (now_ns() < end) {
+        for (i = 0; i < BATCH; i++) {
+            struct frame *f = &w->ring[next++ % RING];
+
+            iov[i].iov_base = f->data;
+            iov[i].iov_len = f->len;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        ret = sendmmsg(fd, msgs, BATCH, 0);
+        if (ret > 0)
+            w->sent += ret;
+        else if (ret < 0 && errno != ENOBUFS && errno != EAGAIN && errno != EINTR) {
+            perror("sendmmsg");
+            exit(1);
+        }
+    }
+    w->ns = now_ns() - start;
+
+    close(fd);
+    return NULL;
+}
+
+static int get_mac(const char *ifname, unsigned char *mac) {
+    struct ifreq ifr = { 0 };
+    int fd, ret;
+
+    fd = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (fd < 0)
+        return -1;
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+    ret = ioctl(fd, SIOCGIFHWADDR, &ifr);
+    close(fd);
+    if (ret)
+        return -1;
+    memcpy(mac, ifr.ifr_hwaddr.sa_data, 6);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s -i dev -M dst-mac -m udp|tcp|icmperr|ns -s src -d dst\n"
+            "       [-S] [-D] [-n count] [-t threads] [-T seconds] [-l payload]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *ifname = NULL;
+    struct ether_addr *mac;
+    struct worker *w;
+    unsigned int threads = 1, i, j;
+    uint64_t sent = 0, ns = 0;
+    bool have_mac = false, have_mix = false;
+    int opt, ncpu;
+
+    while ((opt = getopt(argc, argv, "i:M:m:s:d:SDn:t:T:l:")) != -1) {
+        switch (opt) {
+        case 'i':
+            ifname = optarg;
+            break;
+        case 'M':
+            mac = ether_aton(optarg);
+            if (!mac)
+                usage(argv[0]);
+            memcpy(cfg.dst_mac, mac, 6);
+            have_mac = true;
+            break;
+        case 'm':
+            for (i = 0; i < 4 && strcmp(optarg, mix_names[i]); i++)
+                ;
+            if (i == 4)
+                usage(argv[0]);
+            cfg.mix = i;
+            have_mix = true;
+            break;
+        case 's':
+        case 'd':
+            if (inet_pton(AF_INET6, optarg, opt == 's' ? &cfg.src : &cfg.dst) != 1)
+                usage(argv[0]);
+            break;
+        case 'S':
+            cfg.spread_src = true;
+            break;
+        case 'D':
+            cfg.spread_dst = true;
+            break;
+        case 'n':
+            cfg.count = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            threads = strtoul(optarg, NULL, 0);
+            break;
+        case 'T':
+            cfg.seconds = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            cfg.payload = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (!ifname || !have_mac || !have_mix || !cfg.count || !threads ||
+        cfg.payload > FRAME_MAX - 14 - 2 * 40 - 8 - 8)
+        usage(argv[0]);
+
+    cfg.ifindex = if_nametoindex(ifname);
+    if (!cfg.ifindex || get_mac(ifname, cfg.src_mac)) {
+        fprintf(stderr, "%s: no such Ethernet device\n", ifname);
+        return 1;
+    }
+
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    w = calloc(threads, sizeof(*w));
+    if (!w)
+        return 1;
+
+    for (i = 0; i < threads; i++) {
+        w[i].cpu = i % ncpu;
+        w[i].seed = 0x5eed + i;
+        w[i].ring = calloc(RING, sizeof(*w[i].ring));
+        if (!w[i].ring)
+            return 1;
+        for (j = 0; j < RING; j++)
+            build(&w[i].ring[j], &w[i].seed);
+    }
+
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&w[i].thread, NULL, worker_run, &w[i])) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join(w[i].thread, NULL);
+        sent += w[i].sent;
+        if (w[i].ns > ns)
+            ns = w[i].ns;
+        free(w[i].ring);
+    }
+
+    /* One line, for the script to parse. */
+    printf("sent %llu pps %.0f\n", (unsigned long long)sent, ns ? sent * 1e9 / ns : 0.0);
+
+    free(w);
+    return 0;
+}
@@ -0,0 +1,377 @@
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/bitops.h>
+#include <linux/err.h>
+#include <linux/overflow.h>
+#include "lpm.h"
+
+/* A prefix that ends inside a node: plen of its bits fall into this node's
+ * chunk, left-aligned in bits.  Only the writer looks at these; they are
+ * what the leaf slots are expanded from. */
+struct nat_lpm_route {
+    void *leaf;
+    u8 plen;
+    u8 bits;
+};
+
+/*
+ * Nodes are copy-on-write: an update builds a fresh path from the changed
+ * node up to the root and publishes it with one pointer store, so a reader
+ * always sees one consistent trie.  slots[] holds the children first, in
+ * child_vec bit order, then the leaves in leaf_vec bit order.  Slots of a
+ * node under construction are set with RCU_INIT_POINTER(): the node is
+ * only reachable once the rcu_assign_pointer() of the new root publishes
+ * it, and that store orders them.
+ */
+struct nat_lpm_node {
+    u64 child_vec;
+    u64 leaf_vec;
+    struct nat_lpm_route *routes;
+    unsigned int nroutes;
+    struct rcu_head rcu;
+    void __rcu *slots[];
+};
+
+/* Update side: the writer's mutex is held, or the trie has none because it
+ * is never updated.  Teardown: nothing can reach the trie any more. */
+#define nat_lpm_held(lpm) (!(lpm)->lock || lockdep_is_held((lpm)->lock))
+#define nat_lpm_deref(lpm, p) rcu_dereference_protected(p, nat_lpm_held(lpm))
+#define nat_lpm_deref_dead(p) rcu_dereference_protected(p, 1)
+
+/* The NAT_LPM_STRIDE address bits that select a slot at this depth.  Bits
+ * past the end of the address read as zero. */
+static unsigned int nat_lpm_chunk(const struct in6_addr *addr, unsigned int depth) {
+    unsigned int bit = depth * NAT_LPM_STRIDE;
+    unsigned int byte = bit / 8;
+    unsigned int w = addr->s6_addr[byte] << 8;
+
+    if (byte + 1 < 16)
+        w |= addr->s6_addr[byte + 1];
+
+    return (w >> (16 - NAT_LPM_STRIDE - bit % 8)) & (NAT_LPM_FANOUT - 1);
+}
+
+/* Depth of the node a prefix of this length ends in. */
+static unsigned int nat_lpm_depth(int prefix_len) {
+    return prefix_len ? (prefix_len - 1) / NAT_LPM_STRIDE : 0;
+}
+
+/* Update side only. */
+static struct nat_lpm_node *nat_lpm_child(const struct nat_lpm *lpm,
+                                          const struct nat_lpm_node *node, unsigned int idx) {
+    u64 bit = 1ULL << idx;
+
+    if (!node || !(node->child_vec & bit))
+        return NULL;
+
+    return nat_lpm_deref(lpm, node->slots[hweight64(node->child_vec & (bit - 1))]);
+}
+
+/* Longest route in this node covering slot idx.  Among equal lengths the
+ * most recently added wins. */
+static void *nat_lpm_best(const struct nat_lpm_route *routes, unsigned int nroutes,
+                          unsigned int idx) {
+    void *best = NULL;
+    int best_plen = -1;
+    unsigned int i;
+
+    for (i = 0; i < nroutes; i++) {
+        if ((idx ^ routes[i].bits) >> (NAT_LPM_STRIDE - routes[i].plen))
+            continue;
+        if (routes[i].plen >= best_plen) {
+            best = routes[i].leaf;
+            best_plen = routes[i].plen;
+        }
+    }
+
+    return best;
+}
+
+static int nat_lpm_find_route(const struct nat_lpm_node *node, unsigned int plen,
+                              unsigned int bits, const void *leaf) {
+    unsigned int i;
+
+    if (!node)
+        return -1;
+
+    for (i = 0; i < node->nroutes; i++) {
+        if (node->routes[i].leaf == leaf && node->routes[i].plen == plen &&
+            node->routes[i].bits == bits)
+            return i;
+    }
+
+    return -1;
+}
+
+/*
+ * Build a node from an old one (which may be NULL), with child slot idx
+ * replaced by child (idx < 0 keeps all children) and the given route set.
+ * The new node takes over routes.  Returns NULL if the node would be empty.
+ */
+static struct nat_lpm_node *nat_lpm_build(const struct nat_lpm *lpm,
+                                          const struct nat_lpm_node *old, int idx,
+                                          struct nat_lpm_node *child,
+                                          struct nat_lpm_route *routes, unsigned int nroutes) {
+    struct nat_lpm_node *node;
+    u64 child_vec = old ? old->child_vec : 0;
+    u64 leaf_vec = 0;
+    unsigned int i, n;
+
+    if (idx >= 0) {
+        if (child)
+            child_vec |= 1ULL << idx;
+        else
+            child_vec &= ~(1ULL << idx);
+    }
+
+    for (i = 0; i < NAT_LPM_FANOUT; i++) {
+        if (nat_lpm_best(routes, nroutes, i))
+            leaf_vec |= 1ULL << i;
+    }
+
+    if (!child_vec && !leaf_vec)
+        return NULL;
+
+    node = kmalloc(struct_size(node, slots, hweight64(child_vec) + hweight64(leaf_vec)),
+                   GFP_KERNEL_ACCOUNT);
+    if (!node)
+        return ERR_PTR(-ENOMEM);
+
+    node->child_vec = child_vec;
+    node->leaf_vec = leaf_vec;
+    node->routes = routes;
+    node->nroutes = nroutes;
+
+    n = 0;
+    for (i = 0; i < NAT_LPM_FANOUT; i++) {
+        if (child_vec & (1ULL << i))
+            RCU_INIT_POINTER(node->slots[n++],
+                             (int)i == idx ? child : nat_lpm_child(lpm, old, i));
+    }
+    for (i = 0; i < NAT_LPM_FANOUT; i++) {
+        if (leaf_vec & (1ULL << i))
+            RCU_INIT_POINTER(node->slots[n++], nat_lpm_best(routes, nroutes, i));
+    }
+
+    return node;
+}
+
+/*
+ * Add or remove one route by rebuilding the path from its node up to the
+ * root.  Nothing visible changes unless every allocation succeeds.
+ */
+static int nat_lpm_update(struct nat_lpm *lpm, const struct in6_addr *prefix, int prefix_len,
+                          void *leaf, bool insert) {
+    struct nat_lpm_node *path[NAT_LPM_LEVELS];
+    struct nat_lpm_node *fresh[NAT_LPM_LEVELS];
+    struct nat_lpm_node *node, *child = NULL;
+    struct nat_lpm_route *routes = NULL;
+    unsigned int target = nat_lpm_depth(prefix_len);
+    unsigned int plen = prefix_len - target * NAT_LPM_STRIDE;
+    unsigned int bits, nroutes, n;
+    int d, j, pos;
+
+    bits = nat_lpm_chunk(prefix, target) >> (NAT_LPM_STRIDE - plen) << (NAT_LPM_STRIDE - plen);
+
+    node = nat_lpm_deref(lpm, lpm->root);
+    for (d = 0; d <= (int)target; d++) {
+        path[d] = node;
+        node = nat_lpm_child(lpm, node, nat_lpm_chunk(prefix, d));
+    }
+
+    node = path[target];
+    n = node ? node->nroutes : 0;
+
+    if (insert) {
+        routes = kmalloc_array(n + 1, sizeof(*routes), GFP_KERNEL_ACCOUNT);
+        if (!routes)
+            return -ENOMEM;
+        if (n)
+            memcpy(routes, node->routes, n * sizeof(*routes));
+        routes[n].leaf = leaf;
+        routes[n].plen = plen;
+        routes[n].bits = bits;
+        nroutes = n + 1;
+    } else {
+        pos = nat_lpm_find_route(node, plen, bits, leaf);
+        if (pos < 0)
+            return -ENOENT;
+        nroutes = n - 1;
+        if (nroutes) {
+            routes = kmalloc_array(nroutes, sizeof(*routes), GFP_KERNEL_ACCOUNT);
+            if (!routes)
+                return -ENOMEM;
+            memcpy(routes, node->routes, pos * sizeof(*routes));
+            memcpy(routes + pos, node->routes + pos + 1, (nroutes - pos) * sizeof(*routes));
+        }
+    }
+
+    for (d = target; d >= 0; d--) {
+        if (d == (int)target)
+            node = nat_lpm_build(lpm, path[d], -1, NULL, routes, nroutes);
+        else
+            node = nat_lpm_build(lpm, path[d], nat_lpm_chunk(prefix, d), child,
+                                 path[d] ? path[d]->routes : NULL,
+                                 path[d] ? path[d]->nroutes : 0);
+        if (IS_ERR(node))
+            goto abort;
+        fresh[d] = node;
+        child = node;
+    }
+
+    rcu_assign_pointer(lpm->root, child);
+
+    /* Unchanged ancestors hand their route arrays on to the new copy. */
+    for (d = 0; d <= (int)target; d++) {
+        if (!path[d])
+            continue;
+        if (!fresh[d] || fresh[d]->routes != path[d]->routes)
+            kfree(path[d]->routes);
+        kfree_rcu(path[d], rcu);
+    }
+
+    return 0;
+
+abort:
+    for (j = d + 1; j <= (int)target; j++) {
+        if (!fresh[j])
+            continue;
+        if (!path[j] || fresh[j]->routes != path[j]->routes)
+            kfree(fresh[j]->routes);
+        kfree(fresh[j]);
+    }
+    if (d == (int)target)
+        kfree(routes);
+    return PTR_ERR(node);
+}
+
+/* Remove a route without allocating: rewrite the affected leaf slots of the
+ * live node in place.  Leaves may be left NULL and the node may be left
+ * empty; lookups skip both, and the next rebuild of the node compacts it. */
+static void nat_lpm_delete_inplace(struct nat_lpm *lpm, const struct in6_addr *prefix,
+                                   int prefix_len, void *leaf) {
+    struct nat_lpm_node *node = nat_lpm_deref(lpm, lpm->root);
+    unsigned int target = nat_lpm_depth(prefix_len);
+    unsigned int plen = prefix_len - target * NAT_LPM_STRIDE;
+    unsigned int bits, d, i, n;
+    int pos;
+
+    bits = nat_lpm_chunk(prefix, target) >> (NAT_LPM_STRIDE - plen) << (NAT_LPM_STRIDE - plen);
+
+    for (d = 0; d < target && node; d++)
+        node = nat_lpm_child(lpm, node, nat_lpm_chunk(prefix, d));
+
+    pos = nat_lpm_find_route(node, plen, bits, leaf);
+    if (WARN_ON_ONCE(pos < 0))
+        return;
+
+    memmove(node->routes + pos, node->routes + pos + 1,
+            (node->nroutes - pos - 1) * sizeof(*node->routes));
+    node->nroutes--;
+
+    n = hweight64(node->child_vec);
+    for (i = 0; i < NAT_LPM_FANOUT; i++) {
+        if (node->leaf_vec & (1ULL << i))
+            rcu_assign_pointer(node->slots[n++], nat_lpm_best(node->routes, node->nroutes, i));
+    }
+}
+
+void nat_lpm_init(struct nat_lpm *lpm, struct mutex *lock) {
+    RCU_INIT_POINTER(lpm->root, NULL);
+    lpm->lock = lock;
+}
+
+int nat_lpm_insert(struct nat_lpm *lpm, const struct in6_addr *prefix, int prefix_len, void *leaf) {
+    return nat_lpm_update(lpm, prefix, prefix_len, leaf, true);
+}
+
+/* Never fails: a deletion that cannot allocate its new path falls back to
+ * editing the live node, so callers can free the leaf afterwards. */
+void nat_lpm_delete(struct nat_lpm *lpm, const struct in6_addr *prefix, int prefix_len, void *leaf) {
+    int ret;
+
+    ret = nat_lpm_update(lpm, prefix, prefix_len, leaf, false);
+    if (ret == -ENOMEM)
+        nat_lpm_delete_inplace(lpm, prefix, prefix_len, leaf);
+    else
+        WARN_ON_ONCE(ret);
+}
+
+/* Caller must be in an RCU read-side critical section.  If probes is not
+ * NULL it is set to the number of nodes visited. */
+void *nat_lpm_lookup(struct nat_lpm *lpm, const struct in6_addr *addr, unsigned int *probes) {
+    const struct nat_lpm_node *node = rcu_dereference(lpm->root);
+    unsigned int depth = 0;
+    unsigned int visited = 0;
+    void *best = NULL;
+    void *leaf;
+    u64 bit;
+
+    while (node) {
+        visited++;
+        bit = 1ULL << nat_lpm_chunk(addr, depth);
+
+        if (node->leaf_vec & bit) {
+            leaf = rcu_dereference(node->slots[hweight64(node->child_vec) +
+                                               hweight64(node->leaf_vec & (bit - 1))]);
+            if (leaf)
+                best = leaf;
+        }
+
+        if (!(node->child_vec & bit))
+            break;
+
+        node = rcu_dereference(node->slots[hweight64(node->child_vec & (bit - 1))]);
+        depth++;
+    }
+
+    if (probes)
+        *probes = visited;
+    return best;
+}
+
+/* Exact match: the leaf that wins for this very prefix, i.e. the most
+ * recently added one.  For writers; caller must serialize with updates. */
+void *nat_lpm_find(struct nat_lpm *lpm, const struct in6_addr *prefix, int prefix_len) {
+    struct nat_lpm_node *node = nat_lpm_deref(lpm, lpm->root);
+    unsigned int target = nat_lpm_depth(prefix_len);
+    unsigned int plen = prefix_len - target * NAT_LPM_STRIDE;
+    unsigned int bits, d;
+    int i;
+
+    bits = nat_lpm_chunk(prefix, target) >> (NAT_LPM_STRIDE - plen) << (NAT_LPM_STRIDE - plen);
+
+    for (d = 0; d < target && node; d++)
+        node = nat_lpm_child(lpm, node, nat_lpm_chunk(prefix, d));
+    if (!node)
+        return NULL;
+
+    for (i = node->nroutes - 1; i >= 0; i--) {
+        if (node->routes[i].plen == plen && node->routes[i].bits == bits)
+            return node->routes[i].leaf;
+    }
+
+    return NULL;
+}
+
+static void nat_lpm_free_node(struct nat_lpm_node *node) {
+    unsigned int i, nchild;
+
+    if (!node)
+        return;
+
+    nchild = hweight64(node->child_vec);
+    for (i = 0; i < nchild; i++)
+        nat_lpm_free_node(nat_lpm_deref_dead(node->slots[i]));
+
+    kfree(node->routes);
+    kfree_rcu(node, rcu);
+}
+
+/* Only once no reader or writer can reach the trie. */
+void nat_lpm_destroy(struct nat_lpm *lpm) {
+    struct nat_lpm_node *root = nat_lpm_deref_dead(lpm->root);
+
+    RCU_INIT_POINTER(lpm->root, NULL);
+    nat_lpm_free_node(root);
+}
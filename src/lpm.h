@@ -0,0 +1,39 @@
+#ifndef LPM_H
+#define LPM_H
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/in6.h>
+#include <linux/lockdep.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+
+/*
+ * Multibit trie for IPv6 longest-prefix match.  Every level consumes
+ * NAT_LPM_STRIDE address bits and keeps its children and (prefix-expanded)
+ * leaves in popcount-compressed arrays, so a lookup costs at most
+ * NAT_LPM_LEVELS node visits no matter how many prefix lengths are in use.
+ *
+ * Readers run under rcu_read_lock().  Updates must hold the mutex given to
+ * nat_lpm_init() and may sleep; lockdep checks it on every pointer the
+ * update side follows.
+ */
+#define NAT_LPM_STRIDE 6
+#define NAT_LPM_FANOUT (1 << NAT_LPM_STRIDE)
+#define NAT_LPM_LEVELS DIV_ROUND_UP(128, NAT_LPM_STRIDE)
+
+struct nat_lpm_node;
+
+struct nat_lpm {
+    struct nat_lpm_node __rcu *root;
+    struct mutex *lock;             /* serializes updates; NULL if there are none */
+};
+
+void nat_lpm_init(struct nat_lpm *lpm, struct mutex *lock);
+void nat_lpm_destroy(struct nat_lpm *lpm);
+int nat_lpm_insert(struct nat_lpm *lpm, const struct in6_addr *prefix, int prefix_len, void *leaf);
+void nat_lpm_delete(struct nat_lpm *lpm, const struct in6_addr *prefix, int prefix_len, void *leaf);
+void *nat_lpm_lookup(struct nat_lpm *lpm, const struct in6_addr *addr, unsigned int *probes);
+void *nat_lpm_find(struct nat_lpm *lpm, const struct in6_addr *prefix, int prefix_len);
+
+#endif
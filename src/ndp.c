@@ -8,24 +8,203 @@
 #include <linux/if_ether.h>
 #include <linux/etherdevice.h>
 #include <linux/netdevice.h>
+#include <linux/interrupt.h>
+#include <linux/percpu.h>
 #include <net/ipv6.h>
 #include <net/ip6_route.h>
 #include <net/ndisc.h>
 #include <net/addrconf.h>
 #include <net/dst.h>
+#include <net/checksum.h>
+#include <net/ip6_checksum.h>
 #include "ndp.h"
 
+static bool ndp_xmit_burst;
+module_param(ndp_xmit_burst, bool, 0644);
+MODULE_PARM_DESC(ndp_xmit_burst,
+                 "Hand queued neighbour advertisements straight to the driver in bursts, "
+                 "bypassing the qdisc and tc egress, instead of one dev_queue_xmit() each "
+                 "(default)");
+
+/* ICMPv6 part of an advertisement: the message and one TLLA option. */
+#define NAT_NA_PAYLOAD_LEN (sizeof(struct nd_msg) + 8)
+#define NAT_NA_FRAME_LEN (ETH_HLEN + sizeof(struct ipv6hdr) + NAT_NA_PAYLOAD_LEN)
+
+/* Templates kept per CPU; a device that misses evicts round-robin. */
+#define NAT_NA_TMPL_SLOTS 4
+/* Replies queued on one CPU before they are sent without waiting for the
+ * end of the softirq round. */
+#define NAT_NA_BATCH 64
+
+/* A ready-made advertisement for one device: every byte of the frame that
+ * does not depend on the solicitation.  dev is only compared, never
+ * dereferenced -- the frame depends on nothing but addr, and addr is checked
+ * against dev->dev_addr on every use, so a changed MAC rebuilds the template
+ * and a recycled net_device pointer cannot hand out a stale one. */
+struct nat_na_tmpl {
+    const struct net_device *dev;
+    u8 addr[ETH_ALEN];
+    /* Sum of the ICMPv6 message with the target zeroed, for a solicited
+     * ([0]) and an unsolicited ([1], DAD) reply. */
+    __wsum csum[2];
+    u8 frame[NAT_NA_FRAME_LEN];
+};
+
+struct nat_na_cpu {
+    struct nat_na_tmpl tmpl[NAT_NA_TMPL_SLOTS];
+    unsigned int victim;
+    /* Built replies, each holding a reference on its device.  Only touched
+     * on this CPU with bottom halves disabled. */
+    struct sk_buff_head queue;
+    struct tasklet_struct flush;
+};
+
+static DEFINE_PER_CPU(struct nat_na_cpu, nat_na_cpu);
+
+static void nat_na_tmpl_build(struct nat_na_tmpl *tmpl, const struct net_device *dev) {
+    struct ethhdr *eth = (struct ethhdr *)tmpl->frame;
+    struct ipv6hdr *iph = (struct ipv6hdr *)(eth + 1);
+    struct nd_msg *na = (struct nd_msg *)(iph + 1);
+    unsigned char *opt = (unsigned char *)(na + 1);
+
+    memset(tmpl->frame, 0, sizeof(tmpl->frame));
+    tmpl->dev = dev;
+    ether_addr_copy(tmpl->addr, dev->dev_addr);
+
+    ether_addr_copy(eth->h_source, dev->dev_addr);
+    eth->h_proto = htons(ETH_P_IPV6);
+
+    iph->version = 6;
+    iph->payload_len = htons(NAT_NA_PAYLOAD_LEN);
+    iph->nexthdr = IPPROTO_ICMPV6;
+    iph->hop_limit = 255;
+
+    na->icmph.icmp6_type = NDISC_NEIGHBOUR_ADVERTISEMENT;
+    na->icmph.icmp6_dataun.u_nd_advt.override = 1;
+
+    opt[0] = ND_OPT_TARGET_LL_ADDR;
+    opt[1] = 1; /* length in 8-byte units */
+    ether_addr_copy(opt + 2, dev->dev_addr);
+
+    tmpl->csum[1] = csum_partial(na, NAT_NA_PAYLOAD_LEN, 0);
+    na->icmph.icmp6_dataun.u_nd_advt.solicited = 1;
+    tmpl->csum[0] = csum_partial(na, NAT_NA_PAYLOAD_LEN, 0);
+}
+
+static const struct nat_na_tmpl *nat_na_tmpl_get(struct nat_na_cpu *c,
+                                                 const struct net_device *dev) {
+    struct nat_na_tmpl *tmpl;
+    int i;
+
+    for (i = 0; i < NAT_NA_TMPL_SLOTS; i++) {
+        tmpl = &c->tmpl[i];
+        if (tmpl->dev != dev)
+            continue;
+        if (!ether_addr_equal(tmpl->addr, dev->dev_addr))
+            nat_na_tmpl_build(tmpl, dev);
+        return tmpl;
+    }
+
+    tmpl = &c->tmpl[c->victim];
+    c->victim = (c->victim + 1) % NAT_NA_TMPL_SLOTS;
+    nat_na_tmpl_build(tmpl, dev);
+    return tmpl;
+}
+
+/* Sends a run of queued replies for one device and TX queue under a single
+ * TX lock, with xmit_more set on all but the last so the driver rings its
+ * doorbell once, as pktgen does.  The queue is picked the way
+ * dev_queue_xmit() would (ndo_select_queue, XPS), per reply.  Stops at the
+ * first reply for another device or queue, or when the queue is stopped,
+ * leaving the rest on q; returns false if it sent nothing.  Opt-in: the
+ * qdisc and tc egress never see these. */
+static bool nat_na_xmit_burst(struct net_device *dev, struct sk_buff_head *q) {
+    struct netdev_queue *txq, *next_txq;
+    struct sk_buff *skb, *next;
+    int cpu = smp_processor_id();
+    netdev_tx_t rc;
+    bool more, sent = false;
+
+    skb = skb_peek(q);
+    txq = netdev_core_pick_tx(dev, skb, NULL);
+
+    HARD_TX_LOCK(dev, txq, cpu);
+    while (skb) {
+        if (netif_xmit_frozen_or_drv_stopped(txq))
+            break;
+
+        next = skb_peek_next(skb, q);
+        next_txq = next && next->dev == dev ? netdev_core_pick_tx(dev, next, NULL) : NULL;
+        more = next_txq == txq;
+
+        __skb_unlink(skb, q);
+        if (dev_nit_active(dev))
+            dev_queue_xmit_nit(skb, dev);
+        rc = netdev_start_xmit(skb, dev, txq, more);
+        if (!dev_xmit_complete(rc)) {
+            /* Not consumed: let the stack retry it. */
+            __skb_queue_head(q, skb);
+            break;
+        }
+        dev_put(dev);
+        sent = true;
+
+        skb = more ? next : NULL;
+    }
+    HARD_TX_UNLOCK(dev, txq);
+
+    return sent;
+}
+
+static void nat_na_xmit_list(struct sk_buff_head *q) {
+    struct net_device *dev;
+    struct sk_buff *skb;
+
+    while ((skb = skb_peek(q))) {
+        dev = skb->dev;
+
+        if (!netif_running(dev)) {
+            __skb_unlink(skb, q);
+            kfree_skb(skb);
+            dev_put(dev);
+            continue;
+        }
+
+        /* A reply the burst could not send at all takes the slow way. */
+        if (ndp_xmit_burst && nat_na_xmit_burst(dev, q))
+            continue;
+
+        __skb_unlink(skb, q);
+        if (dev_queue_xmit(skb) < 0)
+            pr_err_ratelimited("Slick NAT: Failed to send NA\n");
+        dev_put(dev);
+    }
+}
+
+static void nat_na_flush(struct tasklet_struct *t) {
+    struct nat_na_cpu *c = from_tasklet(c, t, flush);
+    struct sk_buff_head q;
+
+    __skb_queue_head_init(&q);
+    skb_queue_splice_init(&c->queue, &q);
+
+    rcu_read_lock_bh();
+    nat_na_xmit_list(&q);
+    rcu_read_unlock_bh();
+}
+
 void send_neighbor_advertisement(struct sk_buff *orig_skb, const struct nf_hook_state *state,
                                 const struct in6_addr *target_addr, const struct in6_addr *solicitor_addr) {
+    const struct nat_na_tmpl *tmpl;
+    struct nat_na_cpu *c;
     struct sk_buff *reply_skb;
     struct ipv6hdr *reply_iph;
     struct nd_msg *reply_na;
     struct net_device *dev;
     struct in6_addr dst_addr;
-    unsigned char *opt;
-    int total_len;
-    bool is_dad;
     struct ethhdr *eth;
+    __wsum csum;
+    bool is_dad;
 
     dev = state->in;
     if (!dev)
@@ -48,73 +227,84 @@ void send_neighbor_advertisement(struct sk_buff *orig_skb, const struct nf_hook_
     is_dad = ipv6_addr_any(solicitor_addr);
     dst_addr = is_dad ? in6addr_linklocal_allnodes : *solicitor_addr;
 
-    // Calculate total length: IPv6 + ICMPv6 ND + target link-layer address option
-    total_len = sizeof(struct ipv6hdr) + sizeof(struct nd_msg) + 8; // 8 bytes for target LL addr option
-
-    reply_skb = alloc_skb(total_len + LL_MAX_HEADER, GFP_ATOMIC);
+    reply_skb = alloc_skb(LL_RESERVED_SPACE(dev) + NAT_NA_FRAME_LEN, GFP_ATOMIC);
     if (!reply_skb) {
-        pr_err("Slick NAT: Failed to allocate skb for NA\n");
+        pr_err_ratelimited("Slick NAT: Failed to allocate skb for NA\n");
         return;
     }
+    skb_reserve(reply_skb, LL_RESERVED_SPACE(dev));
 
-    skb_reserve(reply_skb, LL_MAX_HEADER);
-    skb_put(reply_skb, total_len);
-    skb_reset_network_header(reply_skb);
+    /* The hook may run in process context; the per-CPU state is only ever
+     * used with bottom halves off. */
+    local_bh_disable();
+    c = this_cpu_ptr(&nat_na_cpu);
+    tmpl = nat_na_tmpl_get(c, dev);
 
+    eth = skb_put_data(reply_skb, tmpl->frame, NAT_NA_FRAME_LEN);
+    skb_reset_mac_header(reply_skb);
+    skb_set_network_header(reply_skb, ETH_HLEN);
+    skb_set_transport_header(reply_skb, ETH_HLEN + sizeof(struct ipv6hdr));
     reply_iph = ipv6_hdr(reply_skb);
-    reply_iph->version = 6;
-    reply_iph->priority = 0;
-    memset(reply_iph->flow_lbl, 0, sizeof(reply_iph->flow_lbl));
-    reply_iph->payload_len = htons(sizeof(struct nd_msg) + 8);
-    reply_iph->nexthdr = IPPROTO_ICMPV6;
-    reply_iph->hop_limit = 255;
-    reply_iph->saddr = *target_addr;
-    reply_iph->daddr = dst_addr;
-
-    skb_set_transport_header(reply_skb, sizeof(struct ipv6hdr));
     reply_na = (struct nd_msg *)skb_transport_header(reply_skb);
 
-    reply_na->icmph.icmp6_type = NDISC_NEIGHBOUR_ADVERTISEMENT;
-    reply_na->icmph.icmp6_code = 0;
-    reply_na->icmph.icmp6_cksum = 0;
-    reply_na->icmph.icmp6_dataun.u_nd_advt.solicited = is_dad ? 0 : 1;
-    reply_na->icmph.icmp6_dataun.u_nd_advt.override = 1;
-    reply_na->icmph.icmp6_dataun.u_nd_advt.router = 0;
-    reply_na->icmph.icmp6_dataun.u_nd_advt.reserved = 0;
-    reply_na->target = *target_addr;
-
-    // Add target link-layer address option
-    opt = (unsigned char *)(reply_na + 1);
-    opt[0] = ND_OPT_TARGET_LL_ADDR;
-    opt[1] = 1; // length in 8-byte units
-    memcpy(opt + 2, dev->dev_addr, ETH_ALEN);
-
-    // Calculate checksum
-    reply_na->icmph.icmp6_cksum = csum_ipv6_magic(&reply_iph->saddr, &reply_iph->daddr,
-                                                  ntohs(reply_iph->payload_len), IPPROTO_ICMPV6,
-                                                  csum_partial(reply_na, ntohs(reply_iph->payload_len), 0));
-
-    // Add Ethernet header
-    skb_push(reply_skb, ETH_HLEN);
-    skb_reset_mac_header(reply_skb);
-    eth = eth_hdr(reply_skb);
-
     if (is_dad) {
         /* 33:33:00:00:00:01 for ff02::1 */
         ipv6_eth_mc_map(&dst_addr, eth->h_dest);
+        reply_na->icmph.icmp6_dataun.u_nd_advt.solicited = 0;
     } else {
-        memcpy(eth->h_dest, eth_hdr(orig_skb)->h_source, ETH_ALEN);
+        ether_addr_copy(eth->h_dest, eth_hdr(orig_skb)->h_source);
     }
-    memcpy(eth->h_source, dev->dev_addr, ETH_ALEN);
-    eth->h_proto = htons(ETH_P_IPV6);
+
+    reply_iph->saddr = *target_addr;
+    reply_iph->daddr = dst_addr;
+    reply_na->target = *target_addr;
+
+    /* The template already sums everything but the target. */
+    csum = csum_partial(target_addr, sizeof(*target_addr), tmpl->csum[is_dad]);
+    reply_na->icmph.icmp6_cksum = csum_ipv6_magic(target_addr, &dst_addr, NAT_NA_PAYLOAD_LEN,
+                                                  IPPROTO_ICMPV6, csum);
 
     reply_skb->dev = dev;
     reply_skb->protocol = htons(ETH_P_IPV6);
     reply_skb->ip_summed = CHECKSUM_NONE;
     reply_skb->pkt_type = PACKET_OUTGOING;
 
-    // Send the packet
-    if (dev_queue_xmit(reply_skb) < 0) {
-        pr_err("Slick NAT: Failed to send NA\n");
+    /* Queued, not sent: the flush runs once the current softirq round has
+     * handled every solicitation in it, so a storm of them goes out as a
+     * few bursts.  Direct transmit rather than netif_receive_skb(): egress
+     * bypasses PRE_ROUTING, so the reply cannot loop back into us. */
+    dev_hold(dev);
+    __skb_queue_tail(&c->queue, reply_skb);
+    if (skb_queue_len(&c->queue) >= NAT_NA_BATCH)
+        nat_na_flush(&c->flush);
+    else
+        tasklet_schedule(&c->flush);
+    local_bh_enable();
+}
+
+void nat_ndp_init(void) {
+    struct nat_na_cpu *c;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        c = per_cpu_ptr(&nat_na_cpu, cpu);
+        __skb_queue_head_init(&c->queue);
+        tasklet_setup(&c->flush, nat_na_flush);
+    }
+}
+
+/* Called once no hook can queue another reply. */
+void nat_ndp_exit(void) {
+    struct nat_na_cpu *c;
+    struct sk_buff *skb;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        c = per_cpu_ptr(&nat_na_cpu, cpu);
+        tasklet_kill(&c->flush);
+        while ((skb = __skb_dequeue(&c->queue))) {
+            dev_put(skb->dev);
+            kfree_skb(skb);
+        }
     }
 }
@@ -7,5 +7,7 @@
 
 void send_neighbor_advertisement(struct sk_buff *skb, const struct nf_hook_state *state, 
                                 const struct in6_addr *target, const struct in6_addr *dest);
+void nat_ndp_init(void);
+void nat_ndp_exit(void);
 
 #endif
@@ -21,18 +21,29 @@ validate_batch_file() {
         fi
         
         # Parse line for different commands
-        if [[ "$line" =~ ^(add|del|drop)[[:space:]]+([^[:space:]]+)([[:space:]]+([^[:space:]]+))?([[:space:]]+([^[:space:]]+))?$ ]]; then
+        if [[ "$line" =~ ^(add|del|drop|internal|nointernal)[[:space:]]+([^[:space:]]+)([[:space:]]+([^[:space:]]+))?([[:space:]]+([^[:space:]]+))?([[:space:]]+([^[:space:]]+))?$ ]]; then
             local cmd="${BASH_REMATCH[1]}"
             local interface="${BASH_REMATCH[2]}"
             local internal="${BASH_REMATCH[4]}"
             local external="${BASH_REMATCH[6]}"
+            local mode="${BASH_REMATCH[8]}"
             
             # Validate command
-            if [ "$cmd" != "add" ] && [ "$cmd" != "del" ] && [ "$cmd" != "drop" ]; then
+            if [ "$cmd" != "add" ] && [ "$cmd" != "del" ] && [ "$cmd" != "drop" ] &&
+               [ "$cmd" != "internal" ] && [ "$cmd" != "nointernal" ]; then
                 echo "Line $line_num: Invalid command '$cmd'"
                 errors=$((errors + 1))
                 continue
             fi
+
+            # internal/nointernal take the interface only
+            if [ "$cmd" = "internal" ] || [ "$cmd" = "nointernal" ]; then
+                if [ -n "$internal" ]; then
+                    echo "Line $line_num: '$cmd' takes only an interface name"
+                    errors=$((errors + 1))
+                fi
+                continue
+            fi
             
             # Validate add command has both prefixes
             if [ "$cmd" = "add" ] && ([ -z "$internal" ] || [ -z "$external" ]); then
@@ -41,6 +52,13 @@ validate_batch_file() {
                 continue
             fi
             
+            # Only add takes a mode
+            if [ -n "$mode" ] && ([ "$cmd" != "add" ] || [ "$mode" != "nptv6" ]); then
+                echo "Line $line_num: Unexpected argument '$mode'"
+                errors=$((errors + 1))
+                continue
+            fi
+            
             # Validate del command has internal prefix
             if [ "$cmd" = "del" ] && [ -z "$internal" ]; then
                 echo "Line $line_num: 'del' command requires internal prefix"
@@ -88,6 +106,29 @@ validate_batch_file() {
 }
 
 
+# Write a batch file and read the module's result back on the same
+# descriptor; the read applies the batch.  Prints the failed lines and
+# fails if any line failed or the batch was abandoned.
+apply_batch_file() {
+    local file="$1"
+    local result errors status
+
+    exec 3<>"$PROC_BATCH_FILE" || return 1
+    if ! cat "$file" >&3 2>/dev/null; then
+        exec 3>&-
+        return 1
+    fi
+    result=$(cat <&3)
+    exec 3>&-
+
+    echo "$result" | awk '$1 == "line" { print "  line " $2 ": error " $3 }'
+    errors=$(echo "$result" | awk '$1 == "errors" { print $2 }')
+    status=$(echo "$result" | awk '$1 == "result" { print $2 }')
+    echo "Lines: $(echo "$result" | awk '$1 == "lines" { print $2 }'), errors: ${errors:-?}"
+
+    [ "$status" = 0 ] && [ "$errors" = 0 ]
+}
+
 add_batch() {
     local file="$1"
     
@@ -95,10 +136,11 @@ add_batch() {
         echo "Usage: $0 add-batch <file>"
         echo ""
         echo "File format (one operation per line):"
-        echo "  add <interface> <internal_prefix/len> <external_prefix/len>"
+        echo "  add <interface> <internal_prefix/len> <external_prefix/len> [nptv6]"
         echo "  del <interface> <internal_prefix/len>"
         echo "  drop <interface>    - Drop all mappings for interface"
         echo "  drop --all         - Drop all mappings"
+        echo "  internal <interface> - Declare an internal interface (hook_mode=ingress)"
         echo "  # Comments are ignored"
         echo ""
         echo "Example:"
@@ -132,7 +174,7 @@ add_batch() {
     echo "Total operations to process: $total_lines"
     
     # Process the batch
-    if cat "$file" > "$PROC_BATCH_FILE" 2>/dev/null; then
+    if apply_batch_file "$file"; then
         echo "Batch operation completed successfully"
         echo "Use '$0 status' to verify the mappings"
         return 0
@@ -194,7 +236,7 @@ del_batch() {
     echo "Total delete operations to process: $total_lines"
     
     # Process the batch
-    if cat "$file" > "$PROC_BATCH_FILE" 2>/dev/null; then
+    if apply_batch_file "$file"; then
         echo "Batch delete operation completed successfully"
         echo "Use '$0 status' to verify the mappings were removed"
         return 0
@@ -227,14 +269,16 @@ create_batch_template() {
 # Slick NAT Batch Configuration Template
 # 
 # Format:
-#   add <interface> <internal_prefix/len> <external_prefix/len>
+#   add <interface> <internal_prefix/len> <external_prefix/len> [nptv6]
 #   del <interface> <internal_prefix/len>
 #   drop <interface>    - Drop all mappings for interface
 #   drop --all         - Drop all mappings
+#   internal <interface> - Internal side to hook (hook_mode=ingress only)
 #
 # Examples:
 #   add eth0 2001:db8:internal:1::/64 2001:db8:external:1::/64
 #   add eth0 2001:db8:internal:2::/64 2001:db8:external:2::/64
+#   add eth0 2001:db8:internal:4::/48 2001:db8:external:4::/48 nptv6
 #   del eth0 2001:db8:internal:3::/64
 #   drop eth1
 #   drop --all
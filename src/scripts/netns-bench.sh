@@ -0,0 +1,237 @@
+#!/bin/bash
+#
+# End-to-end forwarding benchmark on one box: internal, NAT and external
+# network namespaces joined by veth pairs, traffic from bench/pktblast.
+#
+#   internal ns            NAT ns                 external ns
+#   int0 fc00:1::2 <-> nat-in fc00:1::1
+#                          nat-out fc00:2::1 <-> ext0 fc00:2::2
+#
+# Mapping i is fd00:0:H:L::/64 <-> 2001:db8:H:L::/64 on nat-out, with
+# H:L = i, and the remote side is 3fff::1.  For every queue count, mapping
+# count and traffic mix the script reports what the generator sent, what
+# the NAT forwarded (or, for NS, answered), the p99 round trip of pings
+# through the NAT while under load, and softirq time in % of one CPU.
+#
+# Run as root from src/ (make netns-bench), with slick_nat loaded or built.
+
+set -e
+
+cd "$(dirname "$0")/.."
+
+QUEUES="1 2 4"
+COUNTS="1 100 10000 max"
+MIXES="udp-in udp-out tcp-in tcp-out icmperr-in icmperr-out ns"
+DURATION=10
+MAX_MAPPINGS=65536
+PKTBLAST=./bench/pktblast
+MODULE=./slick_nat.ko
+
+NS_INT=snb-int
+NS_NAT=snb-nat
+NS_EXT=snb-ext
+
+usage() {
+    cat <<EOF
+Usage: $0 [options]
+  -q "1 2 4"          RX queue counts (generator threads follow the queues)
+  -c "1 100 10000 max" mapping counts; max is -M
+  -x "udp-in ..."     traffic mixes: {udp,tcp,icmperr}-{in,out} and ns
+  -d 10               seconds per run
+  -M 65536            mapping count for "max" (raises net.slick_nat.max_mappings)
+EOF
+    exit 2
+}
+
+while getopts "q:c:x:d:M:h" opt; do
+    case $opt in
+        q) QUEUES="$OPTARG" ;;
+        c) COUNTS="$OPTARG" ;;
+        x) MIXES="$OPTARG" ;;
+        d) DURATION="$OPTARG" ;;
+        M) MAX_MAPPINGS="$OPTARG" ;;
+        *) usage ;;
+    esac
+done
+
+if [ "$(id -u)" -ne 0 ]; then
+    echo "Error: must run as root"
+    exit 1
+fi
+
+for tool in ip ethtool ping; do
+    if ! command -v $tool >/dev/null; then
+        echo "Error: $tool not found"
+        exit 1
+    fi
+done
+
+if [ ! -x "$PKTBLAST" ]; then
+    echo "Error: $PKTBLAST not built (make -C src netns-bench builds it)"
+    exit 1
+fi
+
+if [ ! -d /sys/module/slick_nat ]; then
+    if [ ! -f "$MODULE" ]; then
+        echo "Error: slick_nat is not loaded and $MODULE is not built"
+        exit 1
+    fi
+    insmod "$MODULE"
+    LOADED_HERE=1
+fi
+
+in_int() { ip netns exec $NS_INT "$@"; }
+in_nat() { ip netns exec $NS_NAT "$@"; }
+in_ext() { ip netns exec $NS_EXT "$@"; }
+
+teardown() {
+    ip netns del $NS_INT 2>/dev/null || true
+    ip netns del $NS_NAT 2>/dev/null || true
+    ip netns del $NS_EXT 2>/dev/null || true
+}
+
+cleanup() {
+    teardown
+    if [ -n "$LOADED_HERE" ]; then
+        # Namespaces go away asynchronously; give their exit a moment.
+        sleep 1
+        rmmod slick_nat 2>/dev/null || true
+    fi
+}
+trap cleanup EXIT
+
+mac_of() {
+    ip netns exec "$1" cat "/sys/class/net/$2/address"
+}
+
+setup() {
+    local q=$1
+
+    teardown
+    ip netns add $NS_INT
+    ip netns add $NS_NAT
+    ip netns add $NS_EXT
+
+    ip link add int0 netns $NS_INT numtxqueues "$q" numrxqueues "$q" type veth \
+        peer nat-in netns $NS_NAT numtxqueues "$q" numrxqueues "$q"
+    ip link add ext0 netns $NS_EXT numtxqueues "$q" numrxqueues "$q" type veth \
+        peer nat-out netns $NS_NAT numtxqueues "$q" numrxqueues "$q"
+
+    for pair in "$NS_INT int0" "$NS_NAT nat-in" "$NS_NAT nat-out" "$NS_EXT ext0"; do
+        set -- $pair
+        ip -n "$1" link set lo up
+        ip -n "$1" link set "$2" up
+        # GRO gives veth a NAPI context per RX queue, so the queues are
+        # really served in parallel (Linux 5.13 and later).
+        ip netns exec "$1" ethtool -K "$2" gro on >/dev/null 2>&1 || true
+    done
+
+    ip -n $NS_INT addr add fc00:1::2/64 dev int0 nodad
+    ip -n $NS_INT addr add fd00::1/64 dev int0 nodad
+    ip -n $NS_INT route add default via fc00:1::1
+
+    ip -n $NS_NAT addr add fc00:1::1/64 dev nat-in nodad
+    ip -n $NS_NAT addr add fc00:2::1/64 dev nat-out nodad
+    ip netns exec $NS_NAT sysctl -qw net.ipv6.conf.all.forwarding=1
+    ip -n $NS_NAT route add fd00::/16 via fc00:1::2
+    ip -n $NS_NAT route add default via fc00:2::2
+    # Static neighbours, so random destinations never wait on resolution.
+    ip -n $NS_NAT neigh replace fc00:1::2 lladdr "$(mac_of $NS_INT int0)" dev nat-in nud permanent
+    ip -n $NS_NAT neigh replace fc00:2::2 lladdr "$(mac_of $NS_EXT ext0)" dev nat-out nud permanent
+
+    ip -n $NS_EXT addr add fc00:2::2/64 dev ext0 nodad
+    ip -n $NS_EXT addr add 3fff::1/64 dev ext0 nodad
+    ip -n $NS_EXT route add 2001:db8::/32 via fc00:2::1
+
+    # Every solicitation answered, none suppressed or rate limited.
+    in_nat sysctl -qw net.slick_nat.max_mappings="$MAX_MAPPINGS"
+    in_nat sysctl -qw net.slick_nat.ndp_rate=0
+    in_nat sysctl -qw net.slick_nat.ndp_suppress_ms=0
+}
+
+# Replace the table with $1 mappings, streamed into one batch.
+load_mappings() {
+    local n=$1
+    local start end
+
+    start=$(date +%s.%N)
+    awk -v n="$n" 'BEGIN {
+        print "drop --all";
+        for (i = 0; i < n; i++) {
+            h = int(i / 65536); l = i % 65536;
+            printf "add nat-out fd00:0:%x:%x::/64 2001:db8:%x:%x::/64\n", h, l, h, l;
+        }
+    }' | in_nat dd of=/proc/net/slick_nat_batch bs=64K status=none
+    end=$(date +%s.%N)
+
+    if [ "$(in_nat grep -c '^nat-out' /proc/net/slick_nat_mappings || true)" -ne "$n" ]; then
+        echo "Error: loading $n mappings failed (see dmesg)"
+        exit 1
+    fi
+    LOAD_SECONDS=$(awk -v a="$start" -v b="$end" 'BEGIN { printf "%.1f", b - a }')
+}
+
+tx_packets() {
+    ip netns exec "$1" cat "/sys/class/net/$2/statistics/tx_packets"
+}
+
+softirq_ticks() {
+    awk '$1 == "cpu" { print $8 }' /proc/stat
+}
+
+# run <mix> <queues> <mappings>
+run() {
+    local mix=$1 q=$2 n=$3
+    local ns dev out args tx0 tx1 si0 si1 hz p99 gen fwd softirq pingf
+
+    case $mix in
+        *-in|ns)
+            ns=$NS_EXT dev=ext0 out=nat-in
+            args="-s 3fff::1 -d 2001:db8:: -D -M $(mac_of $NS_NAT nat-out)"
+            ;;
+        *-out)
+            ns=$NS_INT dev=int0 out=nat-out
+            args="-s fd00:: -d 3fff::1 -S -M $(mac_of $NS_NAT nat-in)"
+            ;;
+    esac
+    [ "$mix" = ns ] && out=nat-out
+
+    # Outbound packets spread over the mappings only look like ours if
+    # their source is in one: pktblast picks indexes below n.
+    pingf=$(mktemp)
+    hz=$(getconf CLK_TCK)
+    tx0=$(tx_packets $NS_NAT $out)
+    si0=$(softirq_ticks)
+
+    in_ext ping -6 -n -i 0.002 -w "$DURATION" 2001:db8::1 >"$pingf" 2>&1 &
+    gen=$(ip netns exec $ns "$PKTBLAST" -i $dev -m "${mix%-*}" $args -n "$n" \
+          -t "$q" -T "$DURATION" | awk '{ print $4 }')
+    wait
+
+    tx1=$(tx_packets $NS_NAT $out)
+    si1=$(softirq_ticks)
+
+    fwd=$(( (tx1 - tx0) / DURATION ))
+    softirq=$(( (si1 - si0) * 100 / (hz * DURATION) ))
+    p99=$(sed -n 's/.*time=\([0-9.]*\) ms.*/\1/p' "$pingf" | sort -n |
+          awk '{ v[NR] = $1 } END { if (NR) printf "%.0f", v[int((NR - 1) * 0.99) + 1] * 1000; else print "-" }')
+    rm -f "$pingf"
+
+    printf "%-12s %6s %9s %12s %12s %9s %9s\n" "$mix" "$q" "$n" "$gen" "$fwd" "$p99" "$softirq"
+}
+
+echo "slick_nat end-to-end, ${DURATION}s per run, $(nproc) CPU(s), kernel $(uname -r)"
+printf "%-12s %6s %9s %12s %12s %9s %9s\n" \
+       mix queues mappings "sent pps" "fwd pps" "p99 us" "softirq%"
+
+for q in $QUEUES; do
+    setup "$q"
+    for n in $COUNTS; do
+        [ "$n" = max ] && n=$MAX_MAPPINGS
+        load_mappings "$n"
+        echo "# $q queue(s), $n mapping(s) loaded in ${LOAD_SECONDS}s"
+        for mix in $MIXES; do
+            run "$mix" "$q" "$n"
+        done
+    done
+done
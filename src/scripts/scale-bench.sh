@@ -0,0 +1,104 @@
+#!/bin/bash
+#
+# Lookup cost against table size, from the in-kernel benchmark of the KUnit
+# module (test/slick-nat-test.c).  For every mapping count the module is
+# loaded once with bench_mappings set; it fills a private table, reports
+# the bucket count and chain lengths of both hash indexes, and times hits
+# and misses with each lookup engine.  Nothing is configured in any
+# namespace.
+#
+# Prints one table per engine: mappings, ns per lookup (internal hit and
+# miss, external hit and miss), and for the hash engine the mean and
+# longest chain of the internal and external index.  Flat chain lengths and
+# lookup times from 10k to 1M mappings are what "O(1)" means here.
+#
+# Run as root from src/ (make scale-bench), on a kernel with CONFIG_KUNIT.
+
+set -e
+
+cd "$(dirname "$0")/.."
+
+COUNTS="10000 100000 1000000"
+LENGTHS="48,56,64"
+LOOKUPS=1000000
+MODULE=./slick_nat_test.ko
+
+usage() {
+    cat <<EOF
+Usage: $0 [options]
+  -c "10000 100000 1000000"  mapping counts
+  -l 48,56,64                 prefix lengths, used round-robin
+  -n 1000000                  timed lookups per measurement
+EOF
+    exit 2
+}
+
+while getopts "c:l:n:h" opt; do
+    case $opt in
+        c) COUNTS="$OPTARG" ;;
+        l) LENGTHS="$OPTARG" ;;
+        n) LOOKUPS="$OPTARG" ;;
+        *) usage ;;
+    esac
+done
+
+if [ "$(id -u)" -ne 0 ]; then
+    echo "Error: must run as root"
+    exit 1
+fi
+
+if [ ! -f "$MODULE" ]; then
+    echo "Error: $MODULE not built (make -C src scale-bench builds it)"
+    exit 1
+fi
+
+if [ -d /sys/module/slick_nat ]; then
+    echo "Error: slick_nat is loaded; the test module replaces it (rmmod slick_nat)"
+    exit 1
+fi
+
+cleanup() {
+    rmmod slick_nat_test 2>/dev/null || true
+}
+trap cleanup EXIT
+
+# One run: load, let the suite finish, keep its log lines, unload.
+run() {
+    local count=$1 mark
+
+    mark="slick-nat scale-bench $count $$"
+    echo "$mark" > /dev/kmsg
+    insmod "$MODULE" bench_mappings="$count" bench_lengths="$LENGTHS" \
+        bench_lookups="$LOOKUPS"
+    rmmod slick_nat_test
+    dmesg | sed -n "/$mark/,\$p" | grep -E 'ns/lookup|chains:'
+}
+
+declare -A hash_int hash_ext trie_ns hash_ns
+
+for count in $COUNTS; do
+    echo "Running $count mappings..." >&2
+    while read -r line; do
+        case $line in
+            *"trie: ns/lookup"*)   trie_ns[$count]=$(echo "$line" | sed 's/.*ns\/lookup //') ;;
+            *"hash: ns/lookup"*)   hash_ns[$count]=$(echo "$line" | sed 's/.*ns\/lookup //') ;;
+            *"hash: internal chains"*) hash_int[$count]=$(echo "$line" | sed 's/.*chains: //') ;;
+            *"hash: external chains"*) hash_ext[$count]=$(echo "$line" | sed 's/.*chains: //') ;;
+        esac
+    done < <(run "$count")
+done
+
+echo
+echo "lengths $LENGTHS, $LOOKUPS lookups per figure"
+echo
+echo "trie"
+for count in $COUNTS; do
+    printf "  %9s  %s\n" "$count" "${trie_ns[$count]:-no result}"
+done
+echo
+echo "hash"
+for count in $COUNTS; do
+    printf "  %9s  %s\n" "$count" "${hash_ns[$count]:-no result}"
+    printf "  %9s  internal %s\n" "" "${hash_int[$count]:-no result}"
+    printf "  %9s  external %s\n" "" "${hash_ext[$count]:-no result}"
+done
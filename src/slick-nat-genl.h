@@ -0,0 +1,67 @@
+#ifndef SLICK_NAT_GENL_H
+#define SLICK_NAT_GENL_H
+
+/*
+ * Generic netlink interface of the slick_nat module.  Shared with user space,
+ * so only <linux/types.h> may be pulled in here.
+ *
+ * ADD and DEL carry any number of SLICK_NAT_ATTR_MAPPING nests and are
+ * applied in order under one lock acquisition.  They are answered with a
+ * SLICK_NAT_CMD_RESULT message holding SLICK_NAT_ATTR_APPLIED plus one
+ * SLICK_NAT_ATTR_ENTRY_ERROR nest for every entry that failed.
+ *
+ * DROP takes an optional SLICK_NAT_ATTR_IFNAME (none drops everything) and
+ * answers with SLICK_NAT_ATTR_DROPPED.  GET looks up one mapping by
+ * interface, internal prefix and length; with NLM_F_DUMP it lists them all.
+ */
+
+#include <linux/types.h>
+
+#define SLICK_NAT_GENL_NAME "slick_nat"
+#define SLICK_NAT_GENL_VERSION 1
+
+enum slick_nat_genl_cmd {
+    SLICK_NAT_CMD_UNSPEC,
+    SLICK_NAT_CMD_ADD,
+    SLICK_NAT_CMD_DEL,
+    SLICK_NAT_CMD_DROP,
+    SLICK_NAT_CMD_GET,
+    SLICK_NAT_CMD_RESULT,
+    __SLICK_NAT_CMD_MAX,
+};
+#define SLICK_NAT_CMD_MAX (__SLICK_NAT_CMD_MAX - 1)
+
+enum slick_nat_genl_attr {
+    SLICK_NAT_ATTR_UNSPEC,
+    SLICK_NAT_ATTR_MAPPING,         /* nest, SLICK_NAT_MAP_ATTR_*, repeatable */
+    SLICK_NAT_ATTR_IFNAME,          /* string */
+    SLICK_NAT_ATTR_DROPPED,         /* u32 */
+    SLICK_NAT_ATTR_APPLIED,         /* u32 */
+    SLICK_NAT_ATTR_ENTRY_ERROR,     /* nest, SLICK_NAT_ERR_ATTR_*, repeatable */
+    __SLICK_NAT_ATTR_MAX,
+};
+#define SLICK_NAT_ATTR_MAX (__SLICK_NAT_ATTR_MAX - 1)
+
+enum slick_nat_genl_map_attr {
+    SLICK_NAT_MAP_ATTR_UNSPEC,
+    SLICK_NAT_MAP_ATTR_IFNAME,      /* string */
+    SLICK_NAT_MAP_ATTR_INTERNAL,    /* struct in6_addr */
+    SLICK_NAT_MAP_ATTR_EXTERNAL,    /* struct in6_addr, ADD only */
+    SLICK_NAT_MAP_ATTR_PREFIX_LEN,  /* u8, 0..128, applies to both prefixes */
+    SLICK_NAT_MAP_ATTR_FLAGS,       /* u32, SLICK_NAT_MAP_F_*, ADD only */
+    __SLICK_NAT_MAP_ATTR_MAX,
+};
+#define SLICK_NAT_MAP_ATTR_MAX (__SLICK_NAT_MAP_ATTR_MAX - 1)
+
+/* RFC 6296 checksum-neutral translation; prefix length at most 64. */
+#define SLICK_NAT_MAP_F_NPTV6 (1U << 0)
+
+enum slick_nat_genl_err_attr {
+    SLICK_NAT_ERR_ATTR_UNSPEC,
+    SLICK_NAT_ERR_ATTR_INDEX,       /* u32, position of the entry in the request */
+    SLICK_NAT_ERR_ATTR_ERRNO,       /* s32, negative errno */
+    __SLICK_NAT_ERR_ATTR_MAX,
+};
+#define SLICK_NAT_ERR_ATTR_MAX (__SLICK_NAT_ERR_ATTR_MAX - 1)
+
+#endif
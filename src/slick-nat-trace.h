@@ -0,0 +1,198 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM slick_nat
+
+#if !defined(SLICK_NAT_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define SLICK_NAT_TRACE_H
+
+/*
+ * Tracepoints at the decision points of the packet path, under
+ * events/slick_nat/ in tracefs.  Disabled tracepoints cost a patched-out
+ * branch, so they stay compiled in; the always-on counterparts are the
+ * counters and histograms in /proc/net/slick_nat_stats and slick_nat_hist.
+ */
+
+#include <linux/tracepoint.h>
+#include <linux/in6.h>
+
+#ifndef SLICK_NAT_TRACE_ENUMS
+#define SLICK_NAT_TRACE_ENUMS
+
+enum nat_trace_ndp {
+    NAT_TRACE_NDP_ANSWERED,
+    NAT_TRACE_NDP_SUPPRESSED,
+    NAT_TRACE_NDP_RATELIMITED,
+};
+
+enum nat_trace_drop {
+    NAT_TRACE_DROP_WRITABLE,    /* skb_ensure_writable() failed */
+    NAT_TRACE_DROP_NPTV6,       /* no word for the NPTv6 adjustment */
+};
+
+#endif
+
+TRACE_DEFINE_ENUM(NAT_TRACE_NDP_ANSWERED);
+TRACE_DEFINE_ENUM(NAT_TRACE_NDP_SUPPRESSED);
+TRACE_DEFINE_ENUM(NAT_TRACE_NDP_RATELIMITED);
+TRACE_DEFINE_ENUM(NAT_TRACE_DROP_WRITABLE);
+TRACE_DEFINE_ENUM(NAT_TRACE_DROP_NPTV6);
+
+/* A packet the hook will look at, and the side it arrived on. */
+TRACE_EVENT(slick_nat_classify,
+    TP_PROTO(int ifindex, bool external, u8 proto, bool first_frag),
+    TP_ARGS(ifindex, external, proto, first_frag),
+
+    TP_STRUCT__entry(
+        __field(int, ifindex)
+        __field(bool, external)
+        __field(u8, proto)
+        __field(bool, first_frag)
+    ),
+
+    TP_fast_assign(
+        __entry->ifindex = ifindex;
+        __entry->external = external;
+        __entry->proto = proto;
+        __entry->first_frag = first_frag;
+    ),
+
+    TP_printk("ifindex=%d dir=%s proto=%u first_frag=%d", __entry->ifindex,
+              __entry->external ? "in" : "out", __entry->proto, __entry->first_frag)
+);
+
+/* One address lookup.  probes is the number of hash buckets or trie nodes
+ * visited; 0 when the translation cache answered. */
+TRACE_EVENT(slick_nat_lookup,
+    TP_PROTO(const struct in6_addr *addr, int ifindex, bool external, bool hit,
+             unsigned int probes, bool cached),
+    TP_ARGS(addr, ifindex, external, hit, probes, cached),
+
+    TP_STRUCT__entry(
+        __array(u8, addr, sizeof(struct in6_addr))
+        __field(int, ifindex)
+        __field(bool, external)
+        __field(bool, hit)
+        __field(unsigned int, probes)
+        __field(bool, cached)
+    ),
+
+    TP_fast_assign(
+        memcpy(__entry->addr, addr, sizeof(struct in6_addr));
+        __entry->ifindex = ifindex;
+        __entry->external = external;
+        __entry->hit = hit;
+        __entry->probes = probes;
+        __entry->cached = cached;
+    ),
+
+    TP_printk("%pI6c ifindex=%d %s %s probes=%u cached=%d", __entry->addr,
+              __entry->ifindex, __entry->external ? "external" : "internal",
+              __entry->hit ? "hit" : "miss", __entry->probes, __entry->cached)
+);
+
+/* An ICMPv6 error whose embedded packet was translated. */
+TRACE_EVENT(slick_nat_icmp_err,
+    TP_PROTO(int ifindex, bool external, u8 type, u8 code),
+    TP_ARGS(ifindex, external, type, code),
+
+    TP_STRUCT__entry(
+        __field(int, ifindex)
+        __field(bool, external)
+        __field(u8, type)
+        __field(u8, code)
+    ),
+
+    TP_fast_assign(
+        __entry->ifindex = ifindex;
+        __entry->external = external;
+        __entry->type = type;
+        __entry->code = code;
+    ),
+
+    TP_printk("ifindex=%d dir=%s type=%u code=%u", __entry->ifindex,
+              __entry->external ? "in" : "out", __entry->type, __entry->code)
+);
+
+/* A solicitation for a proxied target, and what became of it. */
+TRACE_EVENT(slick_nat_ndp,
+    TP_PROTO(int ifindex, const struct in6_addr *solicitor, const struct in6_addr *target,
+             enum nat_trace_ndp result),
+    TP_ARGS(ifindex, solicitor, target, result),
+
+    TP_STRUCT__entry(
+        __field(int, ifindex)
+        __array(u8, solicitor, sizeof(struct in6_addr))
+        __array(u8, target, sizeof(struct in6_addr))
+        __field(int, result)
+    ),
+
+    TP_fast_assign(
+        __entry->ifindex = ifindex;
+        memcpy(__entry->solicitor, solicitor, sizeof(struct in6_addr));
+        memcpy(__entry->target, target, sizeof(struct in6_addr));
+        __entry->result = result;
+    ),
+
+    TP_printk("ifindex=%d %pI6c asks for %pI6c: %s", __entry->ifindex, __entry->solicitor,
+              __entry->target,
+              __print_symbolic(__entry->result,
+                               { NAT_TRACE_NDP_ANSWERED, "answered" },
+                               { NAT_TRACE_NDP_SUPPRESSED, "suppressed" },
+                               { NAT_TRACE_NDP_RATELIMITED, "ratelimited" }))
+);
+
+/* An inbound packet that expired here; Time Exceeded goes back to saddr. */
+TRACE_EVENT(slick_nat_hop_limit,
+    TP_PROTO(int ifindex, const struct in6_addr *saddr, const struct in6_addr *daddr),
+    TP_ARGS(ifindex, saddr, daddr),
+
+    TP_STRUCT__entry(
+        __field(int, ifindex)
+        __array(u8, saddr, sizeof(struct in6_addr))
+        __array(u8, daddr, sizeof(struct in6_addr))
+    ),
+
+    TP_fast_assign(
+        __entry->ifindex = ifindex;
+        memcpy(__entry->saddr, saddr, sizeof(struct in6_addr));
+        memcpy(__entry->daddr, daddr, sizeof(struct in6_addr));
+    ),
+
+    TP_printk("ifindex=%d %pI6c -> %pI6c", __entry->ifindex, __entry->saddr, __entry->daddr)
+);
+
+/* A packet the hook dropped while translating it.  need is the number of
+ * bytes that had to be made writable. */
+TRACE_EVENT(slick_nat_drop,
+    TP_PROTO(int ifindex, bool external, enum nat_trace_drop reason, int need),
+    TP_ARGS(ifindex, external, reason, need),
+
+    TP_STRUCT__entry(
+        __field(int, ifindex)
+        __field(bool, external)
+        __field(int, reason)
+        __field(int, need)
+    ),
+
+    TP_fast_assign(
+        __entry->ifindex = ifindex;
+        __entry->external = external;
+        __entry->reason = reason;
+        __entry->need = need;
+    ),
+
+    TP_printk("ifindex=%d dir=%s reason=%s need=%d", __entry->ifindex,
+              __entry->external ? "in" : "out",
+              __print_symbolic(__entry->reason,
+                               { NAT_TRACE_DROP_WRITABLE, "writable" },
+                               { NAT_TRACE_DROP_NPTV6, "nptv6" }),
+              __entry->need)
+);
+
+#endif
+
+/* Outside the include guard: define_trace.h includes this file again. */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE slick-nat-trace
+#include <trace/define_trace.h>
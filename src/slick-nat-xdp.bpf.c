@@ -0,0 +1,225 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * XDP fast path for Slick NAT.
+ *
+ * Translates the common case -- TCP, UDP and ICMPv6 echo without extension
+ * headers -- straight from the driver, using the prefix map the module
+ * mirrors its mapping table into (see slick-nat-xdp.h), and forwards the
+ * result with a FIB lookup.  Everything else, and every packet the FIB
+ * cannot resolve, is passed up untouched to the netfilter hook, which
+ * handles it exactly as without this program.
+ *
+ * Translated packets skip netfilter altogether: FORWARD rules, conntrack
+ * and the per-mapping counters of the module do not see them.
+ */
+
+#include <stdbool.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <linux/ipv6.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <linux/icmpv6.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+#include "slick-nat-xdp.h"
+
+#ifndef AF_INET6
+#define AF_INET6 10
+#endif
+
+#define IPV6_FLOWINFO_MASK bpf_htonl(0x0FFFFFFF)
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __uint(max_entries, SLICK_NAT_XDP_MAX_ENTRIES);
+    __type(key, struct slick_nat_xdp_key);
+    __type(value, struct slick_nat_xdp_value);
+} nat_prefixes SEC(".maps");
+
+static __always_inline struct slick_nat_xdp_value *
+lookup(__u32 ifindex, const struct in6_addr *addr) {
+    struct slick_nat_xdp_key key = {
+        .prefixlen = SLICK_NAT_XDP_IFINDEX_BITS + 128,
+        .ifindex = ifindex,
+    };
+
+    __builtin_memcpy(key.addr, addr, sizeof(key.addr));
+    return bpf_map_lookup_elem(&nat_prefixes, &key);
+}
+
+/* Returns false if an NPTv6 entry finds no word to adjust. */
+static __always_inline bool remap(struct in6_addr *out, const struct in6_addr *in,
+                                  const struct slick_nat_xdp_value *v) {
+    __u32 sum;
+    int i;
+
+#pragma unroll
+    for (i = 0; i < 4; i++)
+        out->s6_addr32[i] = (v->to[i] & v->mask[i]) | (in->s6_addr32[i] & ~v->mask[i]);
+
+    if (!(v->flags & SLICK_NAT_XDP_F_NPTV6))
+        return true;
+
+#pragma unroll
+    for (i = 3; i < 8; i++) {
+        if (i < v->adjust_first || i > v->adjust_last || in->s6_addr16[i] == 0xffff)
+            continue;
+        sum = bpf_ntohs(out->s6_addr16[i]) + v->adjust;
+        sum = (sum & 0xffff) + (sum >> 16);
+        out->s6_addr16[i] = sum == 0xffff ? 0 : bpf_htons(sum);
+        return true;
+    }
+
+    return false;
+}
+
+static __always_inline __u16 csum_fold(__u32 csum) {
+    csum = (csum & 0xffff) + (csum >> 16);
+    csum = (csum & 0xffff) + (csum >> 16);
+    return (__u16)~csum;
+}
+
+static __always_inline bool is_link_local(const struct in6_addr *addr) {
+    return (addr->s6_addr32[0] & bpf_htonl(0xffc00000)) == bpf_htonl(0xfe800000);
+}
+
+SEC("xdp")
+int slick_nat_xdp(struct xdp_md *ctx) {
+    void *data_end = (void *)(long)ctx->data_end;
+    void *data = (void *)(long)ctx->data;
+    struct slick_nat_xdp_value *vs = NULL, *vd = NULL;
+    struct bpf_fib_lookup fib = { };
+    struct ethhdr *eth = data;
+    struct ipv6hdr *ip6h;
+    /* Source and destination back to back, as in the header, so the
+     * pseudo-header change is one csum_diff over 32 bytes. */
+    struct in6_addr old[2], new[2];
+    __sum16 *check = NULL;
+    __u32 ifindex = ctx->ingress_ifindex;
+    void *l4;
+    int rc;
+
+    if ((void *)(eth + 1) > data_end || eth->h_proto != bpf_htons(ETH_P_IPV6))
+        return XDP_PASS;
+
+    ip6h = (void *)(eth + 1);
+    if ((void *)(ip6h + 1) > data_end)
+        return XDP_PASS;
+
+    /* Expiry is reported by the hook, against the original addresses. */
+    if (ip6h->hop_limit <= 1)
+        return XDP_PASS;
+
+    l4 = ip6h + 1;
+    switch (ip6h->nexthdr) {
+    case IPPROTO_TCP: {
+        struct tcphdr *th = l4;
+
+        if ((void *)(th + 1) > data_end)
+            return XDP_PASS;
+        check = &th->check;
+        break;
+    }
+    case IPPROTO_UDP: {
+        struct udphdr *uh = l4;
+
+        if ((void *)(uh + 1) > data_end)
+            return XDP_PASS;
+        if (uh->check)
+            check = &uh->check;
+        break;
+    }
+    case IPPROTO_ICMPV6: {
+        struct icmp6hdr *icmp6h = l4;
+
+        /* Errors carry a packet to translate as well, and neighbour
+         * discovery may have to be answered: both go to the hook. */
+        if ((void *)(icmp6h + 1) > data_end)
+            return XDP_PASS;
+        if (icmp6h->icmp6_type != ICMPV6_ECHO_REQUEST &&
+            icmp6h->icmp6_type != ICMPV6_ECHO_REPLY)
+            return XDP_PASS;
+        check = &icmp6h->icmp6_cksum;
+        break;
+    }
+    default:
+        /* Extension headers, fragments included. */
+        return XDP_PASS;
+    }
+
+    __builtin_memcpy(&old[0], &ip6h->saddr, sizeof(old[0]));
+    __builtin_memcpy(&old[1], &ip6h->daddr, sizeof(old[1]));
+
+    if (is_link_local(&old[0]) && is_link_local(&old[1]))
+        return XDP_PASS;
+
+    /* Same decisions as nat_handle_packet(): an interface with mappings is
+     * external, and there only our external prefixes are translated. */
+    vd = lookup(ifindex, &old[1]);
+    if (vd) {
+        if (vd->flags & SLICK_NAT_XDP_F_IFACE)
+            return XDP_PASS;
+        vs = lookup(ifindex, &old[0]);
+        if (vs && (vs->flags & SLICK_NAT_XDP_F_IFACE))
+            vs = NULL;
+    } else {
+        vs = lookup(0, &old[0]);
+        if (!vs)
+            return XDP_PASS;
+        vd = lookup(0, &old[1]);
+    }
+
+    new[0] = old[0];
+    new[1] = old[1];
+    if (vs && !remap(&new[0], &old[0], vs))
+        return XDP_PASS;
+    if (vd && !remap(&new[1], &old[1], vd))
+        return XDP_PASS;
+
+    /* NPTv6 rewrites leave the pseudo-header sum, and so the checksum,
+     * unchanged. */
+    if ((!vs || (vs->flags & SLICK_NAT_XDP_F_NPTV6)) &&
+        (!vd || (vd->flags & SLICK_NAT_XDP_F_NPTV6)))
+        check = NULL;
+
+    /* Route on the translated addresses, as the stack would after the
+     * hook.  Anything short of a resolved neighbour goes up the stack. */
+    fib.family = AF_INET6;
+    fib.flowinfo = *(__be32 *)ip6h & IPV6_FLOWINFO_MASK;
+    fib.l4_protocol = ip6h->nexthdr;
+    fib.tot_len = bpf_ntohs(ip6h->payload_len) + sizeof(*ip6h);
+    fib.ifindex = ifindex;
+    __builtin_memcpy(fib.ipv6_src, &new[0], sizeof(fib.ipv6_src));
+    __builtin_memcpy(fib.ipv6_dst, &new[1], sizeof(fib.ipv6_dst));
+
+    rc = bpf_fib_lookup(ctx, &fib, sizeof(fib), 0);
+    if (rc != BPF_FIB_LKUP_RET_SUCCESS)
+        return XDP_PASS;
+
+    if (check) {
+        __u32 csum;
+        __u16 folded;
+
+        csum = bpf_csum_diff((__be32 *)old, sizeof(old), (__be32 *)new, sizeof(new),
+                             (__u16)~*check);
+        folded = csum_fold(csum);
+        if (!folded && ip6h->nexthdr == IPPROTO_UDP)
+            folded = 0xffff;
+        *check = folded;
+    }
+
+    __builtin_memcpy(&ip6h->saddr, &new[0], sizeof(new[0]));
+    __builtin_memcpy(&ip6h->daddr, &new[1], sizeof(new[1]));
+    ip6h->hop_limit--;
+
+    __builtin_memcpy(eth->h_dest, fib.dmac, ETH_ALEN);
+    __builtin_memcpy(eth->h_source, fib.smac, ETH_ALEN);
+
+    return bpf_redirect(fib.ifindex, 0);
+}
+
+char _license[] SEC("license") = "GPL";
@@ -0,0 +1,57 @@
+#ifndef SLICK_NAT_XDP_H
+#define SLICK_NAT_XDP_H
+
+/*
+ * Layout of the LPM trie map shared by the module, which fills it, and the
+ * XDP program, which reads it.  Shared with BPF and user space, so only
+ * <linux/types.h> may be pulled in here.
+ *
+ * Each mapping has two entries:
+ *   ifindex 0,       internal prefix -> external prefix   (outbound)
+ *   ingress ifindex, external prefix -> internal prefix   (inbound)
+ * and every interface that carries mappings has a marker entry covering
+ * its whole ifindex (prefixlen 32), so the program can tell an external
+ * interface without a matching mapping from an internal one.
+ */
+
+#include <linux/types.h>
+
+#define SLICK_NAT_XDP_MAP_NAME "nat_prefixes"
+/* Entries a namespace capped at max_mappings can need: two per mapping and
+ * at most one marker per mapping, since every marked interface carries
+ * one.  slnat-xdp sizes the map with this before loading it; an LPM trie
+ * allocates per entry, so a generous cap costs nothing up front. */
+#define SLICK_NAT_XDP_ENTRIES(max_mappings) (3 * (__u64)(max_mappings))
+/* What the object declares, for loaders that do not resize it: enough for
+ * the default cap of 10,000 mappings. */
+#define SLICK_NAT_XDP_MAX_ENTRIES 32768
+
+/* The ifindex takes the first 32 bits of the key. */
+#define SLICK_NAT_XDP_IFINDEX_BITS 32
+
+#define SLICK_NAT_XDP_F_IFACE 0x1   /* interface marker, no translation */
+#define SLICK_NAT_XDP_F_NPTV6 0x2   /* RFC 6296: also adjust one word, see below */
+
+struct slick_nat_xdp_key {
+    __u32 prefixlen;                /* SLICK_NAT_XDP_IFINDEX_BITS + prefix length */
+    __u32 ifindex;                  /* host byte order */
+    __u8 addr[16];
+};
+
+/*
+ * New address = (to & mask) | (old & ~mask), as remap_address_with_len().
+ * With SLICK_NAT_XDP_F_NPTV6 the first 16-bit word in adjust_first ..
+ * adjust_last that is not 0xffff then gets adjust added in one's
+ * complement (0xffff results become 0), as nat_nptv6_remap(); no word
+ * qualifying means the packet is left to the hook.
+ */
+struct slick_nat_xdp_value {
+    __u32 to[4];
+    __u32 mask[4];
+    __u32 flags;
+    __u16 adjust;                   /* host byte order */
+    __u8 adjust_first;              /* word index, 0..7 */
+    __u8 adjust_last;
+};
+
+#endif
@@ -15,13 +15,29 @@
 #include <linux/seq_file.h>
 #include <linux/list.h>
 #include <linux/slab.h>
-#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/rculist.h>
 #include <linux/inet.h>
 #include <linux/jhash.h>
+#include <linux/hashtable.h>
+#include <linux/rhashtable.h>
+#include <linux/sysctl.h>
+#include <linux/percpu.h>
+#include <linux/atomic.h>
+#include <linux/sched/clock.h>
 #include <net/addrconf.h>
 #include <net/net_namespace.h>
 #include <net/netns/generic.h>
+#include <net/genetlink.h>
 #include "ndp.h"
+#include "lpm.h"
+#include "slick-nat-genl.h"
+#include "slick-nat-xdp.h"
+#include "xdp-sync.h"
+#include "xlate.h"
+
+#define CREATE_TRACE_POINTS
+#include "slick-nat-trace.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Lukasz Xu-Kafarski");
@@ -30,137 +46,476 @@ MODULE_VERSION("0.0.4");
 
 #define PROC_FILENAME "slick_nat_mappings"
 #define PROC_BATCH_FILENAME "slick_nat_batch"
+#define PROC_STATS_FILENAME "slick_nat_stats"
+#define PROC_MAPPING_STATS_FILENAME "slick_nat_mapping_stats"
+#define PROC_XDP_FILENAME "slick_nat_xdp"
+#define PROC_HIST_FILENAME "slick_nat_hist"
 
-#define SLICK_NAT_HASH_BITS 8
-#define SLICK_NAT_HASH_SIZE (1u << SLICK_NAT_HASH_BITS)
+#define SLICK_NAT_IFACE_HASH_BITS 4
+/* Default for net.slick_nat.max_mappings, and the most it may be set to. */
 #define SLICK_NAT_MAX_MAPPINGS 10000
-#define SLICK_NAT_BATCH_MAX (1024 * 1024)
+#define SLICK_NAT_MAX_MAPPINGS_LIMIT (1u << 24)
+/* Defaults for net.slick_nat.ndp_rate, ndp_burst and ndp_suppress_ms. */
+#define SLICK_NAT_NDP_RATE 1000
+#define SLICK_NAT_NDP_BURST 100
+#define SLICK_NAT_NDP_SUPPRESS_MS 250
+#define SLICK_NAT_NDP_LIMIT 1000000
+/* Bytes of a batch applied per mapping_mutex hold. */
+#define SLICK_NAT_BATCH_CHUNK (64 * 1024)
 #define SLICK_NAT_LINE_MAX 256
 
+static char *lookup_engine = "trie";
+module_param(lookup_engine, charp, 0444);
+MODULE_PARM_DESC(lookup_engine, "Prefix lookup structure: \"trie\" (default) or \"hash\"");
+
+/* Resolved from lookup_engine at load time; fixed for the module's life. */
+static bool nat_use_trie __read_mostly;
+
+static char *hook_mode = "prerouting";
+module_param(hook_mode, charp, 0444);
+MODULE_PARM_DESC(hook_mode, "Where packets are caught: \"prerouting\" (default, every interface) "
+                 "or \"ingress\" (only interfaces with mappings or declared internal)");
+
+/* Resolved from hook_mode at load time, like nat_use_trie. */
+static bool nat_hook_ingress __read_mostly;
+
+static unsigned int xlate_cache_bits = 10;
+module_param(xlate_cache_bits, uint, 0444);
+MODULE_PARM_DESC(xlate_cache_bits, "log2 of per-CPU translation cache entries (0 disables, max 16)");
+
+/* log2 histogram sizes, see nat_hist_bucket().  Hook times run up to
+ * 2^25 ns (33 ms); a lookup probes at most 129 prefix lengths. */
+#define NAT_HOOK_NS_BUCKETS 26
+#define NAT_PROBE_BUCKETS 9
+
+/* Per-CPU counters; summed over all CPUs when read.  Nothing but u64s, see
+ * nat_stats_sum(). */
+struct nat_pcpu_stats {
+    u64 xcache_hits;
+    u64 xcache_misses;
+    /* Neighbour solicitations for proxied targets, by outcome. */
+    u64 ndp_answered;
+    u64 ndp_suppressed;
+    u64 ndp_ratelimited;
+    /* Packet path.  lookups only counts index walks, not cache hits. */
+    u64 hook_packets;
+    u64 lookups;
+    u64 lookup_hits;
+    u64 lookup_probes;
+    u64 icmp_err_translated;
+    u64 hop_limit_expired;
+    u64 drop_writable;
+    u64 drop_nptv6;
+    /* Time spent in the hook per packet, and probes per index walk. */
+    u64 hook_ns[NAT_HOOK_NS_BUCKETS];
+    u64 probes[NAT_PROBE_BUCKETS];
+};
+
+/* Token bucket for the advertisements sent on one interface, keyed by its
+ * exact ifindex.  Created by the first solicitation the interface answers
+ * and freed when the device goes away, so no two interfaces ever share
+ * one.  Solicitations are answered on internal interfaces too, which have
+ * no nat_iface, hence a table of its own rather than a field there. */
+#define NAT_NDP_HASH_BITS 4
+
+struct nat_ndp_bucket {
+    struct hlist_node node;
+    int ifindex;
+    spinlock_t lock;
+    u32 tokens;
+    unsigned long stamp;
+    struct rcu_head rcu;
+};
+
+struct nat_ndp_buckets {
+    /* Serialises inserts and removals; lookups walk under RCU. */
+    spinlock_t lock;
+    DECLARE_HASHTABLE(index, NAT_NDP_HASH_BITS);
+};
+
+/*
+ * Everything the packet path consults.  Single-line changes edit the
+ * published table in place; a batch builds a private copy, applies all of
+ * its lines there and publishes it with one pointer store, so readers see
+ * either the old configuration or the new one, never a mix.
+ */
+struct nat_table {
+    struct list_head mapping_list;
+    unsigned int mapping_count;
+    /* Hash index, keyed by (masked prefix, length).  Resizes itself with
+     * the load factor, so probes stay O(1) however many mappings there
+     * are.  Lists, because several interfaces may use the same prefix. */
+    struct rhltable internal_index;
+    struct rhltable external_index;
+    /* Number of mappings using each prefix length; drives the
+     * longest-prefix-match walk without touching every mapping. */
+    u32 prefix_len_use[129];
+    /* Internal-prefix trie, used instead of the hash index when
+     * lookup_engine=trie.  External prefixes live in one trie per
+     * interface, in struct nat_iface, for translation, and all of them in
+     * external_lpm, for NDP proxying on internal interfaces. */
+    struct nat_lpm internal_lpm;
+    struct nat_lpm external_lpm;
+    /* Interfaces named by at least one mapping.  The list is the writer's
+     * view, keyed by name; the hash indexes the bound ones by ifindex so the
+     * hook can classify state->in without looking at any mapping. */
+    struct list_head iface_list;
+    DECLARE_HASHTABLE(iface_index, SLICK_NAT_IFACE_HASH_BITS);
+    /* Interfaces declared internal with "internal <iface>", by name.  Only
+     * consulted by writers, to place the ingress hooks of hook_mode=ingress;
+     * RCU only so that the proc listing can walk it. */
+    struct list_head internal_list;
+};
+
+struct nat_internal_if {
+    struct list_head list;
+    char name[IFNAMSIZ];
+    struct rcu_head rcu;
+};
+
 // Per-namespace data structure
 struct slick_nat_net {
-    struct list_head mapping_list;
-    spinlock_t mapping_lock;
+    struct nat_table __rcu *table;
+    /* Serializes writers only.  The packet path never takes it: it walks
+     * the table under rcu_read_lock(). */
+    struct mutex mapping_mutex;
     struct proc_dir_entry *proc_entry;
     struct proc_dir_entry *proc_batch_entry;
-    struct hlist_head internal_hash[SLICK_NAT_HASH_SIZE];
-    struct hlist_head external_hash[SLICK_NAT_HASH_SIZE];
-    /* Number of mappings using each prefix length; drives the
-     * longest-prefix-match walk without touching every mapping. */
-    u16 prefix_len_use[129];
-    unsigned int mapping_count;
+    /* Tags translation cache entries.  Drawn from a module-wide sequence, so
+     * it is unique across namespaces too; see nat_table_changed(). */
+    u64 xlate_gen;
+    /* Bumped by every configuration change, see nat_net_sync(); a batch
+     * file holding a copy of the table checks it before it goes on. */
+    u64 config_seq;
+    /* Allocated with ndp_buckets when the namespace is first configured,
+     * see nat_net_prepare(); NULL until then. */
+    struct nat_pcpu_stats __percpu *stats;
+    struct proc_dir_entry *proc_stats_entry;
+    struct proc_dir_entry *proc_mapping_stats_entry;
+    /* net.slick_nat.max_mappings */
+    unsigned int max_mappings;
+    /* net.slick_nat.ndp_rate (advertisements per second per interface, 0
+     * for no limit), ndp_burst and ndp_suppress_ms (0 answers every
+     * repeat). */
+    unsigned int ndp_rate;
+    unsigned int ndp_burst;
+    unsigned int ndp_suppress_ms;
+    struct nat_ndp_buckets *ndp_buckets;
+    struct ctl_table_header *sysctl_hdr;
+    /* Prefix map of the XDP fast path, mirrored from the published table;
+     * see nat_xdp_sync_table().  xdp_err stops mirroring after a failed
+     * update until the map is bound again. */
+    struct bpf_map *xdp_map;
+    int xdp_err;
+    struct proc_dir_entry *proc_xdp_entry;
+    struct proc_dir_entry *proc_hist_entry;
+    /* hook_mode=ingress: the per-device hooks currently registered, kept in
+     * step with the published table by nat_dev_hooks_sync(). */
+    struct list_head dev_hooks;
+    /* hook_mode=prerouting: nat_nf_hook_ops is registered, which it only is
+     * while there are mappings; see nat_net_sync(). */
+    bool hook_registered;
+};
+
+/* One NF_NETDEV_INGRESS hook.  The direction is fixed when the hook is
+ * registered; a device that changes sides gets a new hook. */
+struct nat_dev_hook {
+    struct list_head list;
+    struct net_device *dev;     /* referenced while the hook is registered */
+    bool external;
+    bool keep;                  /* scratch for nat_dev_hooks_sync() */
+    struct nf_hook_ops ops;
+};
+
+#define NAT_IFACE_EXTERNAL 0x01
+
+/* Per-interface state shared by all mappings configured on it.  ifindex is
+ * 0 while no device of that name exists in the namespace; the netdevice
+ * notifier binds and unbinds it as devices come, go and get renamed. */
+struct nat_iface {
+    struct list_head list;
+    struct hlist_node index_node;
+    char name[IFNAMSIZ];
+    int ifindex;
+    unsigned int refcnt;
+    u8 flags;
+    struct nat_lpm external_lpm;
+    /* Writer-only: the mappings configured on this interface, in
+     * configuration order, and exact (prefix, length) indexes over them
+     * for duplicate checks and deletes. */
+    struct list_head mappings;
+    struct rhltable internal_exact;
+    struct rhltable external_exact;
+    struct rcu_head rcu;
+};
+
+enum nat_mapping_counter {
+    NAT_CNT_OUT,        /* internal -> external */
+    NAT_CNT_IN,         /* external -> internal */
+    NAT_CNT_ICMP_ERR,   /* ICMPv6 errors whose embedded packet was rewritten */
+    NAT_CNT_NDP,        /* neighbour solicitations answered */
+    NAT_CNT_MAX,
+};
+
+/* Per-CPU, so counting never writes a cache line another CPU touches. */
+struct nat_mapping_stats {
+    u64 packets[NAT_CNT_MAX];
+    u64 bytes[NAT_CNT_MAX];
 };
 
 // Dynamic mapping structure
+/*
+ * Laid out by who reads it.  The first cache line is everything
+ * nat_xlate_set() copies out of a hit, which is all a trie lookup touches;
+ * the hash engine adds the second, with the index nodes and the ifindex
+ * its chain walk compares.  What only writers and the proc files use
+ * comes after.  Objects come from nat_mapping_cache, cache-line aligned.
+ */
 struct nat_mapping {
-    struct list_head list;
-    struct hlist_node internal_node;
-    struct hlist_node external_node;
-    char interface[IFNAMSIZ];
+    /* --- hot: translation --- */
     struct in6_addr internal_prefix;
     struct in6_addr external_prefix;
+    __be64 prefix_mask[2];  /* prefix_len as a 128-bit mask, see nat_prefix_mask() */
+    struct nat_mapping_stats __percpu *stats;
     int prefix_len;
+    /* Change of the one's complement sum of an address, host order, when
+     * the internal prefix is replaced by the external one; the reverse
+     * direction is its complement.  Both prefixes are fixed, so this is
+     * all a transport checksum fixup needs. */
+    u16 csum_delta;
+    /* RFC 6296 checksum-neutral mode: the remap also takes csum_delta back
+     * out of a 16-bit word outside the prefix, so transport checksums need
+     * no fixup at all. */
+    bool nptv6;
+
+    /* --- hot: hash engine lookup --- */
+    struct rhlist_head internal_node ____cacheline_aligned;
+    struct rhlist_head external_node;
+    /* Copy of iface->ifindex, so the external lookup compares an int
+     * instead of a name. */
+    int ifindex;
+
+    /* --- cold: configuration and lifetime --- */
+    struct list_head list;
+    struct nat_iface *iface;
+    struct list_head iface_node;            /* iface->mappings */
+    struct rhlist_head internal_exact_node; /* iface->internal_exact */
+    struct rhlist_head external_exact_node; /* iface->external_exact */
+    char interface[IFNAMSIZ];
+    /* Set while the counters belong to another copy of this mapping: the
+     * live one during a batch, or the batch's copy once it is published.
+     * Only the owner frees them. */
+    bool stats_borrowed;
+    /* The live mapping this one was copied from; only valid in a table
+     * that has not been published yet. */
+    struct nat_mapping *origin;
+    struct rcu_head rcu;
 };
 
-/* Snapshot of a mapping, taken while the lock is held, so that the packet
- * path never dereferences a mapping after dropping the lock. */
-struct nat_xlate {
-    struct in6_addr from_prefix;
-    struct in6_addr to_prefix;
-    int prefix_len;
-    bool valid;
-};
+static struct kmem_cache *nat_mapping_cache __read_mostly;
 
 static unsigned int slick_nat_net_id __read_mostly;
 
+/* The table of every namespace with nothing configured, shared so that an
+ * unused namespace costs a pointer.  Never written: writers give the
+ * namespace a table of its own first, see nat_net_activate(). */
+static struct nat_table *nat_empty_table __read_mostly;
+
 static struct slick_nat_net *slick_nat_pernet(struct net *net)
 {
     return net_generic(net, slick_nat_net_id);
 }
 
-static bool compare_prefix_with_len(const struct in6_addr *addr, const struct in6_addr *prefix, int prefix_len) {
-    int bytes = prefix_len / 8;
-    int bits = prefix_len % 8;
-    int i;
+/* The published table, for writers holding mapping_mutex. */
+static struct nat_table *nat_table_locked(struct slick_nat_net *sn_net) {
+    return rcu_dereference_protected(sn_net->table, lockdep_is_held(&sn_net->mapping_mutex));
+}
 
-    for (i = 0; i < bytes; i++) {
-        if (addr->s6_addr[i] != prefix->s6_addr[i])
-            return false;
-    }
+/* Hash index key.  Lookups mask the packet address down to the length
+ * being probed, so it hashes like the stored prefix that covers it. */
+struct nat_hkey {
+    struct in6_addr prefix;
+    u32 len;
+};
 
-    if (bits > 0 && i < 16) {
-        unsigned char mask = (0xFF << (8 - bits)) & 0xFF;
-        if ((addr->s6_addr[i] & mask) != (prefix->s6_addr[i] & mask))
-            return false;
-    }
+static u32 nat_hkey_hashfn(const void *data, u32 len, u32 seed) {
+    const struct nat_hkey *key = data;
 
-    return true;
+    return nat_hkey_hash(&key->prefix, key->len, seed);
 }
 
-static void remap_address_with_len(struct in6_addr *addr, const struct in6_addr *new_prefix, int prefix_len) {
-    int bytes = prefix_len / 8;
-    int bits = prefix_len % 8;
-    int i;
+static u32 nat_internal_obj_hashfn(const void *data, u32 len, u32 seed) {
+    const struct nat_mapping *mapping = data;
 
-    for (i = 0; i < bytes && i < 16; i++) {
-        addr->s6_addr[i] = new_prefix->s6_addr[i];
-    }
+    return nat_hkey_hash(&mapping->internal_prefix, mapping->prefix_len, seed);
+}
 
-    if (bits > 0 && i < 16) {
-        unsigned char mask = (0xFF << (8 - bits)) & 0xFF;
-        addr->s6_addr[i] = (new_prefix->s6_addr[i] & mask) | (addr->s6_addr[i] & ~mask);
-    }
+static u32 nat_external_obj_hashfn(const void *data, u32 len, u32 seed) {
+    const struct nat_mapping *mapping = data;
+
+    return nat_hkey_hash(&mapping->external_prefix, mapping->prefix_len, seed);
 }
 
-/* Hash an address masked down to prefix_len.  Because the host bits are
- * masked off first, hashing a packet address at length N yields the same
- * bucket as hashing a stored prefix of length N that covers it. */
-static u32 prefix_hash(const struct in6_addr *addr, int prefix_len) {
-    struct in6_addr masked;
+static int nat_internal_obj_cmpfn(struct rhashtable_compare_arg *arg, const void *obj) {
+    const struct nat_hkey *key = arg->key;
+    const struct nat_mapping *mapping = obj;
 
-    ipv6_addr_prefix(&masked, addr, prefix_len);
-    return jhash2((const u32 *)masked.s6_addr32, 4, prefix_len) & (SLICK_NAT_HASH_SIZE - 1);
+    return mapping->prefix_len != key->len ||
+           !ipv6_addr_equal(&mapping->internal_prefix, &key->prefix);
 }
 
-/* Longest-prefix-match lookups.  Caller must hold mapping_lock. */
-static struct nat_mapping *__find_mapping_by_internal(struct slick_nat_net *sn_net,
-                                                      const struct in6_addr *addr) {
-    struct nat_mapping *mapping;
+static int nat_external_obj_cmpfn(struct rhashtable_compare_arg *arg, const void *obj) {
+    const struct nat_hkey *key = arg->key;
+    const struct nat_mapping *mapping = obj;
+
+    return mapping->prefix_len != key->len ||
+           !ipv6_addr_equal(&mapping->external_prefix, &key->prefix);
+}
+
+static const struct rhashtable_params nat_internal_params = {
+    .head_offset = offsetof(struct nat_mapping, internal_node),
+    .key_len = sizeof(struct nat_hkey),
+    .hashfn = nat_hkey_hashfn,
+    .obj_hashfn = nat_internal_obj_hashfn,
+    .obj_cmpfn = nat_internal_obj_cmpfn,
+    .automatic_shrinking = true,
+};
+
+static const struct rhashtable_params nat_external_params = {
+    .head_offset = offsetof(struct nat_mapping, external_node),
+    .key_len = sizeof(struct nat_hkey),
+    .hashfn = nat_hkey_hashfn,
+    .obj_hashfn = nat_external_obj_hashfn,
+    .obj_cmpfn = nat_external_obj_cmpfn,
+    .automatic_shrinking = true,
+};
+
+/* The per-interface exact indexes: same keys, their own nodes. */
+static const struct rhashtable_params nat_internal_exact_params = {
+    .head_offset = offsetof(struct nat_mapping, internal_exact_node),
+    .key_len = sizeof(struct nat_hkey),
+    .hashfn = nat_hkey_hashfn,
+    .obj_hashfn = nat_internal_obj_hashfn,
+    .obj_cmpfn = nat_internal_obj_cmpfn,
+    .automatic_shrinking = true,
+};
+
+static const struct rhashtable_params nat_external_exact_params = {
+    .head_offset = offsetof(struct nat_mapping, external_exact_node),
+    .key_len = sizeof(struct nat_hkey),
+    .hashfn = nat_hkey_hashfn,
+    .obj_hashfn = nat_external_obj_hashfn,
+    .obj_cmpfn = nat_external_obj_cmpfn,
+    .automatic_shrinking = true,
+};
+
+/* Caller must be in an RCU read-side critical section. */
+static struct nat_iface *__find_iface_by_index(struct nat_table *t, int ifindex) {
+    struct nat_iface *iface;
+
+    hash_for_each_possible_rcu(t->iface_index, iface, index_node, ifindex) {
+        if (READ_ONCE(iface->ifindex) == ifindex)
+            return iface;
+    }
+
+    return NULL;
+}
+
+/* Longest-prefix-match lookups.  Caller must be in an RCU read-side
+ * critical section.  If probes is not NULL it is set to the number of hash
+ * lookups or trie nodes the walk took. */
+static struct nat_mapping *__find_mapping_by_internal(struct nat_table *t,
+                                                      const struct in6_addr *addr,
+                                                      unsigned int *probes) {
+    struct nat_mapping *mapping = NULL;
+    struct rhlist_head *list;
+    struct nat_hkey key;
+    unsigned int n = 0;
     int prefix_len;
 
+    if (nat_use_trie)
+        return nat_lpm_lookup(&t->internal_lpm, addr, probes);
+
     for (prefix_len = 128; prefix_len >= 0; prefix_len--) {
-        if (!sn_net->prefix_len_use[prefix_len])
+        if (!READ_ONCE(t->prefix_len_use[prefix_len]))
             continue;
 
-        hlist_for_each_entry(mapping, &sn_net->internal_hash[prefix_hash(addr, prefix_len)],
-                             internal_node) {
-            if (mapping->prefix_len == prefix_len &&
-                compare_prefix_with_len(addr, &mapping->internal_prefix, prefix_len))
-                return mapping;
+        nat_addr_mask(&key.prefix, addr, prefix_len);
+        key.len = prefix_len;
+        n++;
+        /* Every entry on the list has exactly this key; any will do. */
+        list = rhltable_lookup(&t->internal_index, &key, nat_internal_params);
+        if (list) {
+            mapping = container_of(list, struct nat_mapping, internal_node);
+            break;
         }
     }
 
-    return NULL;
+    if (probes)
+        *probes = n;
+    return mapping;
 }
 
-static struct nat_mapping *__find_mapping_by_external(struct slick_nat_net *sn_net,
+static struct nat_mapping *__find_mapping_by_external(struct nat_table *t,
                                                       const struct in6_addr *addr,
-                                                      const char *ifname) {
+                                                      int ifindex, unsigned int *probes) {
+    struct rhlist_head *list, *pos;
     struct nat_mapping *mapping;
+    struct nat_iface *iface;
+    struct nat_hkey key;
+    unsigned int n = 0;
     int prefix_len;
 
+    if (nat_use_trie) {
+        iface = __find_iface_by_index(t, ifindex);
+        if (iface)
+            return nat_lpm_lookup(&iface->external_lpm, addr, probes);
+        if (probes)
+            *probes = 0;
+        return NULL;
+    }
+
     for (prefix_len = 128; prefix_len >= 0; prefix_len--) {
-        if (!sn_net->prefix_len_use[prefix_len])
+        if (!READ_ONCE(t->prefix_len_use[prefix_len]))
             continue;
 
-        hlist_for_each_entry(mapping, &sn_net->external_hash[prefix_hash(addr, prefix_len)],
-                             external_node) {
-            if (mapping->prefix_len == prefix_len &&
-                strncmp(mapping->interface, ifname, IFNAMSIZ) == 0 &&
-                compare_prefix_with_len(addr, &mapping->external_prefix, prefix_len))
-                return mapping;
+        nat_addr_mask(&key.prefix, addr, prefix_len);
+        key.len = prefix_len;
+        n++;
+        list = rhltable_lookup(&t->external_index, &key, nat_external_params);
+        rhl_for_each_entry_rcu(mapping, pos, list, external_node) {
+            if (READ_ONCE(mapping->ifindex) == ifindex)
+                goto out;
         }
     }
+    mapping = NULL;
+
+out:
+    if (probes)
+        *probes = n;
+    return mapping;
+}
+
+/* The most specific external prefix covering addr on any interface. */
+static struct nat_mapping *__find_mapping_by_external_any(struct nat_table *t,
+                                                          const struct in6_addr *addr) {
+    struct rhlist_head *list;
+    struct nat_hkey key;
+    int prefix_len;
+
+    if (nat_use_trie)
+        return nat_lpm_lookup(&t->external_lpm, addr, NULL);
+
+    for (prefix_len = 128; prefix_len >= 0; prefix_len--) {
+        if (!READ_ONCE(t->prefix_len_use[prefix_len]))
+            continue;
+
+        nat_addr_mask(&key.prefix, addr, prefix_len);
+        key.len = prefix_len;
+        list = rhltable_lookup(&t->external_index, &key, nat_external_params);
+        if (list)
+            return container_of(list, struct nat_mapping, external_node);
+    }
 
     return NULL;
 }
@@ -169,70 +524,158 @@ static void nat_xlate_set(struct nat_xlate *x, const struct nat_mapping *mapping
                           bool external_to_internal) {
     if (!mapping) {
         x->valid = false;
+        x->stats = NULL;
         return;
     }
 
     x->prefix_len = mapping->prefix_len;
+    memcpy(x->prefix_mask, mapping->prefix_mask, sizeof(x->prefix_mask));
+    x->stats = mapping->stats;
+    x->nptv6 = mapping->nptv6;
     if (external_to_internal) {
         x->from_prefix = mapping->external_prefix;
         x->to_prefix = mapping->internal_prefix;
+        x->csum_delta = ~mapping->csum_delta;
     } else {
         x->from_prefix = mapping->internal_prefix;
         x->to_prefix = mapping->external_prefix;
+        x->csum_delta = mapping->csum_delta;
     }
     x->valid = true;
 }
 
-/* Look up both addresses of a header in one lock acquisition and copy out
- * everything the packet path needs. */
-static void nat_lookup_pair(struct slick_nat_net *sn_net, const struct in6_addr *saddr,
-                            const struct in6_addr *daddr, bool is_external_if,
-                            const char *ifname, struct nat_xlate *xs, struct nat_xlate *xd) {
-    unsigned long flags;
+/*
+ * Direct-mapped per-CPU cache of lookup results, misses included.  An entry
+ * is only valid while its gen equals the owning namespace's xlate_gen, so
+ * any table change invalidates every cached result of that namespace at
+ * once, and entries of different namespaces can never alias.
+ */
+struct nat_xcache_entry {
+    u64 gen;
+    struct in6_addr addr;
+    int ifindex;
+    bool external;
+    struct nat_xlate x;
+};
 
-    spin_lock_irqsave(&sn_net->mapping_lock, flags);
-    if (is_external_if) {
-        nat_xlate_set(xs, __find_mapping_by_external(sn_net, saddr, ifname), true);
-        nat_xlate_set(xd, __find_mapping_by_external(sn_net, daddr, ifname), true);
-    } else {
-        nat_xlate_set(xs, __find_mapping_by_internal(sn_net, saddr), false);
-        nat_xlate_set(xd, __find_mapping_by_internal(sn_net, daddr), false);
-    }
-    spin_unlock_irqrestore(&sn_net->mapping_lock, flags);
+static DEFINE_PER_CPU(struct nat_xcache_entry *, nat_xcache);
+static atomic64_t nat_xlate_gen_seq = ATOMIC64_INIT(0);
+
+/* Called by writers after every change to the lookup structures.  The new
+ * generation is published after the change (atomic64_inc_return() is fully
+ * ordered), so a reader that saw the old generation may cache a stale
+ * result, but only under a tag nobody will match again.  Changes to a table
+ * that is not published yet cannot have been cached. */
+static bool nat_table_is_live(struct slick_nat_net *sn_net, struct nat_table *t) {
+    return t == rcu_access_pointer(sn_net->table);
 }
 
-static bool is_external_interface(struct slick_nat_net *sn_net, const char *ifname) {
-    struct nat_mapping *mapping;
-    unsigned long flags;
-    bool found = false;
+static void nat_table_changed(struct slick_nat_net *sn_net, struct nat_table *t) {
+    if (!nat_table_is_live(sn_net, t))
+        return;
 
-    spin_lock_irqsave(&sn_net->mapping_lock, flags);
-    list_for_each_entry(mapping, &sn_net->mapping_list, list) {
-        if (strncmp(mapping->interface, ifname, IFNAMSIZ) == 0) {
-            found = true;
-            break;
+    WRITE_ONCE(sn_net->xlate_gen, atomic64_inc_return(&nat_xlate_gen_seq));
+}
+
+static u32 nat_xcache_slot(const struct in6_addr *addr, int ifindex, bool external) {
+    return jhash2((const u32 *)addr->s6_addr32, 4, ifindex ^ ((u32)external << 31)) &
+           ((1u << xlate_cache_bits) - 1);
+}
+
+/* Bucket 0 holds 0, bucket i > 0 holds [2^(i-1), 2^i), and the last one
+ * everything above. */
+static unsigned int nat_hist_bucket(u64 v, unsigned int buckets) {
+    return min_t(unsigned int, fls64(v), buckets - 1);
+}
+
+/* Runs in softirq context, so the per-CPU cache cannot be entered twice. */
+static void nat_lookup_one(struct slick_nat_net *sn_net, struct nat_table *t, u64 gen,
+                           const struct in6_addr *addr, bool external, int ifindex,
+                           struct nat_xlate *x) {
+    struct nat_xcache_entry *e = NULL;
+    struct nat_mapping *mapping;
+    unsigned int probes;
+
+    /* Internal lookups do not depend on the ingress interface. */
+    if (!external)
+        ifindex = 0;
+
+    if (xlate_cache_bits) {
+        e = this_cpu_read(nat_xcache) + nat_xcache_slot(addr, ifindex, external);
+        if (e->gen == gen && e->ifindex == ifindex && e->external == external &&
+            ipv6_addr_equal(&e->addr, addr)) {
+            *x = e->x;
+            this_cpu_inc(sn_net->stats->xcache_hits);
+            trace_slick_nat_lookup(addr, ifindex, external, x->valid, 0, true);
+            return;
         }
     }
-    spin_unlock_irqrestore(&sn_net->mapping_lock, flags);
 
-    return found;
+    mapping = external ? __find_mapping_by_external(t, addr, ifindex, &probes) :
+                         __find_mapping_by_internal(t, addr, &probes);
+    nat_xlate_set(x, mapping, external);
+
+    this_cpu_inc(sn_net->stats->lookups);
+    if (mapping)
+        this_cpu_inc(sn_net->stats->lookup_hits);
+    this_cpu_add(sn_net->stats->lookup_probes, probes);
+    this_cpu_inc(sn_net->stats->probes[nat_hist_bucket(probes, NAT_PROBE_BUCKETS)]);
+    trace_slick_nat_lookup(addr, ifindex, external, mapping != NULL, probes, false);
+
+    if (!e)
+        return;
+
+    e->gen = gen;
+    e->addr = *addr;
+    e->ifindex = ifindex;
+    e->external = external;
+    e->x = *x;
+    this_cpu_inc(sn_net->stats->xcache_misses);
+}
+
+/* The table and cache generation one packet is handled with.  Sampled once
+ * per packet, so a table swap can never split a packet across two
+ * configurations. */
+struct nat_view {
+    struct slick_nat_net *sn_net;
+    struct nat_table *t;
+    u64 gen;
+};
+
+/* Caller must be in an RCU read-side critical section and stay in it for
+ * as long as it uses the view. */
+static void nat_view_get(struct slick_nat_net *sn_net, struct nat_view *v) {
+    v->sn_net = sn_net;
+    /* Sample the generation before looking at the table; pairs with the
+     * ordering in nat_table_changed(). */
+    v->gen = READ_ONCE(sn_net->xlate_gen);
+    smp_rmb();
+    v->t = rcu_dereference(sn_net->table);
+}
+
+/* Look up both addresses of a header and copy out everything the packet
+ * path needs. */
+static void nat_lookup_pair(const struct nat_view *v, const struct in6_addr *saddr,
+                            const struct in6_addr *daddr, bool is_external_if,
+                            int ifindex, struct nat_xlate *xs, struct nat_xlate *xd) {
+    nat_lookup_one(v->sn_net, v->t, v->gen, saddr, is_external_if, ifindex, xs);
+    nat_lookup_one(v->sn_net, v->t, v->gen, daddr, is_external_if, ifindex, xd);
 }
 
-/* Locate the transport header, skipping any extension headers.  Returns a
- * negative value if the chain could not be parsed. */
-static int nat_transport_offset(struct sk_buff *skb, u8 *proto, bool *first_frag) {
-    __be16 frag_off = 0;
-    u8 nexthdr = ipv6_hdr(skb)->nexthdr;
-    int off;
+static bool is_external_interface(struct nat_table *t, int ifindex) {
+    struct nat_iface *iface;
 
-    off = ipv6_skip_exthdr(skb, sizeof(struct ipv6hdr), &nexthdr, &frag_off);
-    if (off < 0)
-        return off;
+    iface = __find_iface_by_index(t, ifindex);
+    return iface && (iface->flags & NAT_IFACE_EXTERNAL);
+}
+
+static void nat_count(struct nat_mapping_stats __percpu *stats, enum nat_mapping_counter c,
+                      unsigned int len) {
+    if (!stats)
+        return;
 
-    *proto = nexthdr;
-    /* Only the first fragment carries the transport checksum field. */
-    *first_frag = (frag_off & htons(IP6_OFFSET)) == 0;
-    return off;
+    this_cpu_inc(stats->packets[c]);
+    this_cpu_add(stats->bytes[c], len);
 }
 
 /* Bytes that must be linear and writable before we start editing. */
@@ -259,83 +702,13 @@ static int nat_writable_len(struct sk_buff *skb, int thoff, u8 proto, bool icmp_
     return min_t(int, need, skb->len);
 }
 
-/* Incremental transport checksum fixup for an outer address change.  The
- * addresses are part of the transport pseudo-header, hence pseudohdr=true. */
-static void update_csum(struct sk_buff *skb, int thoff, u8 proto, bool first_frag,
-                        const struct in6_addr *old_addr, const struct in6_addr *new_addr) {
-    __sum16 *check = NULL;
-    int i;
-
-    /* Non-initial fragments carry no transport header to fix up; the
-     * checksum lives in the first fragment and is corrected there. */
-    if (!first_frag || thoff < (int)sizeof(struct ipv6hdr))
-        return;
-
-    switch (proto) {
-    case IPPROTO_TCP:
-        if (skb->len < thoff + sizeof(struct tcphdr))
-            return;
-        check = &((struct tcphdr *)(skb->data + thoff))->check;
-        break;
-    case IPPROTO_UDP:
-    case IPPROTO_UDPLITE: {
-        struct udphdr *udph;
-
-        if (skb->len < thoff + sizeof(struct udphdr))
-            return;
-        udph = (struct udphdr *)(skb->data + thoff);
-        /* A zero UDP checksum is illegal in IPv6, but leave it alone if
-         * present rather than turning garbage into a "valid" checksum. */
-        if (udph->check == 0)
-            return;
-        check = &udph->check;
-        break;
-    }
-    case IPPROTO_ICMPV6:
-        if (skb->len < thoff + sizeof(struct icmp6hdr))
-            return;
-        check = &((struct icmp6hdr *)(skb->data + thoff))->icmp6_cksum;
-        break;
-    default:
-        return;
-    }
-
-    for (i = 0; i < 4; i++)
-        inet_proto_csum_replace4(check, skb, old_addr->s6_addr32[i],
-                                 new_addr->s6_addr32[i], true);
-}
-
-/* Recompute the ICMPv6 checksum from scratch.  Used after the embedded
- * packet of an ICMPv6 error has been rewritten, mirroring what
- * nf_nat_icmpv6_reply_translation() does. */
-static void nat_icmp6_csum_recalc(struct sk_buff *skb, int thoff) {
-    struct ipv6hdr *iph = ipv6_hdr(skb);
-    struct icmp6hdr *icmp6h;
-    unsigned int len;
-
-    if (skb->ip_summed == CHECKSUM_PARTIAL)
-        return;
-    if (skb->len < thoff + sizeof(struct icmp6hdr))
-        return;
-
-    icmp6h = (struct icmp6hdr *)(skb->data + thoff);
-    len = skb->len - thoff;
-
-    icmp6h->icmp6_cksum = 0;
-    icmp6h->icmp6_cksum = csum_ipv6_magic(&iph->saddr, &iph->daddr, len, IPPROTO_ICMPV6,
-                                          skb_checksum(skb, thoff, len, 0));
-    if (skb->ip_summed == CHECKSUM_COMPLETE)
-        skb->ip_summed = CHECKSUM_NONE;
-}
-
 /* Translate the IPv6 header embedded in an ICMPv6 error message.  The outer
  * ICMPv6 checksum is fixed up by the caller. */
-static bool handle_icmp_error_embedded_packet(struct sk_buff *skb, int thoff, struct net *net,
-                                              bool is_external_if, const char *ifname) {
-    struct slick_nat_net *sn_net = slick_nat_pernet(net);
+static bool handle_icmp_error_embedded_packet(struct sk_buff *skb, int thoff,
+                                              const struct nat_view *v,
+                                              bool is_external_if, int ifindex) {
     struct ipv6hdr *embedded_iph;
     struct nat_xlate xs, xd;
-    bool translated = false;
     int emb_off = thoff + sizeof(struct icmp6hdr);
 
     if (skb->len < emb_off + sizeof(struct ipv6hdr))
@@ -347,49 +720,216 @@ static bool handle_icmp_error_embedded_packet(struct sk_buff *skb, int thoff, st
      * is what our destination would be and vice versa - but the prefix space
      * it lives in is the same one this interface is talking, so the lookup
      * direction matches the outer packet. */
-    nat_lookup_pair(sn_net, &embedded_iph->saddr, &embedded_iph->daddr,
-                    is_external_if, ifname, &xs, &xd);
+    nat_lookup_pair(v, &embedded_iph->saddr, &embedded_iph->daddr,
+                    is_external_if, ifindex, &xs, &xd);
+
+    return nat_xlate_embedded(skb, thoff, &xs, &xd);
+}
+
+/* Look up a neighbour solicitation target among the external prefixes we
+ * proxy.  Returns the matching mapping's counters, or NULL if the target is
+ * not ours. */
+static struct nat_mapping_stats __percpu *nat_ndp_target_is_proxied(struct nat_table *t,
+                                                                    const struct in6_addr *target,
+                                                                    bool is_external_if, int ifindex) {
+    struct nat_mapping *mapping;
+
+    /* On an interface that owns mappings, only proxy that interface's
+     * external prefixes; on internal interfaces proxy any of them.  Both
+     * are index lookups, so a burst of solicitations costs what the same
+     * number of translations would. */
+    if (is_external_if)
+        mapping = __find_mapping_by_external(t, target, ifindex, NULL);
+    else
+        mapping = __find_mapping_by_external_any(t, target);
+
+    return mapping ? mapping->stats : NULL;
+}
+
+/*
+ * Direct-mapped per-CPU record of the solicitations answered lately, so a
+ * solicitor repeating itself within ndp_suppress_ms gets one advertisement.
+ * Entries are tagged with the namespace's xlate_gen, like the translation
+ * cache: namespaces never alias, and a table change forgets everything.
+ * Repeats of one (solicitor, target) pair hash to one RX queue, so a per-CPU
+ * record catches them without any shared state.
+ */
+#define NAT_NDP_SEEN_BITS 8
+
+struct nat_ndp_seen {
+    u64 gen;
+    struct in6_addr solicitor;
+    struct in6_addr target;
+    int ifindex;
+    unsigned long expires;
+};
+
+static struct nat_ndp_seen __percpu *nat_ndp_seen;
+
+/* Runs in softirq context, like the translation cache. */
+static struct nat_ndp_seen *nat_ndp_seen_slot(const struct in6_addr *solicitor,
+                                              const struct in6_addr *target, int ifindex) {
+    u32 hash;
 
-    if (xs.valid && compare_prefix_with_len(&embedded_iph->saddr, &xs.from_prefix, xs.prefix_len)) {
-        remap_address_with_len(&embedded_iph->saddr, &xs.to_prefix, xs.prefix_len);
-        translated = true;
+    hash = jhash2((const u32 *)target->s6_addr32, 4,
+                  jhash2((const u32 *)solicitor->s6_addr32, 4, ifindex));
+    return this_cpu_ptr(nat_ndp_seen) + (hash >> (32 - NAT_NDP_SEEN_BITS));
+}
+
+static bool nat_ndp_suppressed(const struct nat_ndp_seen *e, u64 gen,
+                               const struct in6_addr *solicitor,
+                               const struct in6_addr *target, int ifindex) {
+    return e->gen == gen && e->ifindex == ifindex && time_before(jiffies, e->expires) &&
+           ipv6_addr_equal(&e->target, target) && ipv6_addr_equal(&e->solicitor, solicitor);
+}
+
+/* Runs in softirq context.  Returns NULL if the bucket does not exist and
+ * cannot be allocated. */
+static struct nat_ndp_bucket *nat_ndp_bucket(struct slick_nat_net *sn_net, int ifindex,
+                                             unsigned int burst) {
+    struct nat_ndp_buckets *nb = sn_net->ndp_buckets;
+    struct nat_ndp_bucket *b;
+
+    hash_for_each_possible_rcu(nb->index, b, node, ifindex)
+        if (b->ifindex == ifindex)
+            return b;
+
+    spin_lock(&nb->lock);
+    /* Another CPU may have added it since. */
+    hash_for_each_possible(nb->index, b, node, ifindex)
+        if (b->ifindex == ifindex)
+            goto out;
+
+    b = kzalloc(sizeof(*b), GFP_ATOMIC);
+    if (b) {
+        b->ifindex = ifindex;
+        spin_lock_init(&b->lock);
+        b->tokens = burst;
+        b->stamp = jiffies;
+        hash_add_rcu(nb->index, &b->node, ifindex);
     }
+out:
+    spin_unlock(&nb->lock);
+    return b;
+}
+
+/* Takes a token from the interface's bucket, refilled at ndp_rate per
+ * second up to ndp_burst.  The stamp only advances by the time the whole
+ * tokens added stand for, so the remainder carries over to the next refill
+ * and rates below HZ are not rounded down to nothing; it jumps to now only
+ * once the bucket is full. */
+static bool nat_ndp_allow(struct slick_nat_net *sn_net, int ifindex) {
+    unsigned int rate = READ_ONCE(sn_net->ndp_rate);
+    unsigned int burst = READ_ONCE(sn_net->ndp_burst);
+    unsigned long now = jiffies;
+    struct nat_ndp_bucket *b;
+    u64 add;
+    bool ok;
+
+    if (!rate)
+        return true;
+
+    b = nat_ndp_bucket(sn_net, ifindex, burst);
+    if (!b)
+        return false;
 
-    if (xd.valid && compare_prefix_with_len(&embedded_iph->daddr, &xd.from_prefix, xd.prefix_len)) {
-        remap_address_with_len(&embedded_iph->daddr, &xd.to_prefix, xd.prefix_len);
-        translated = true;
+    spin_lock(&b->lock);
+    add = div_u64((u64)min(now - b->stamp, (unsigned long)(60 * HZ)) * rate, HZ);
+    if (b->tokens + add >= burst) {
+        b->tokens = burst;
+        b->stamp = now;
+    } else if (add) {
+        b->tokens += add;
+        b->stamp += div_u64(add * HZ, rate);
     }
+    ok = b->tokens > 0;
+    if (ok)
+        b->tokens--;
+    spin_unlock(&b->lock);
 
-    return translated;
+    return ok;
 }
 
-/* Answer a neighbour solicitation for any external prefix we proxy. */
-static bool nat_ndp_target_is_proxied(struct slick_nat_net *sn_net, const struct in6_addr *target,
-                                      bool is_external_if, const char *ifname) {
-    struct nat_mapping *mapping;
-    unsigned long flags;
-    bool found = false;
-
-    spin_lock_irqsave(&sn_net->mapping_lock, flags);
-    list_for_each_entry(mapping, &sn_net->mapping_list, list) {
-        /* On an interface that owns mappings, only proxy that interface's
-         * external prefixes; on internal interfaces proxy any of them. */
-        if (is_external_if && strncmp(mapping->interface, ifname, IFNAMSIZ) != 0)
-            continue;
-        if (compare_prefix_with_len(target, &mapping->external_prefix, mapping->prefix_len)) {
-            found = true;
-            break;
+/* Forget the bucket of a device that went away; its ifindex may be handed
+ * out again. */
+static void nat_ndp_bucket_forget(struct slick_nat_net *sn_net, int ifindex) {
+    struct nat_ndp_buckets *nb = sn_net->ndp_buckets;
+    struct nat_ndp_bucket *b;
+    struct hlist_node *tmp;
+
+    if (!nb)
+        return;
+
+    spin_lock_bh(&nb->lock);
+    hash_for_each_possible_safe(nb->index, b, tmp, node, ifindex) {
+        if (b->ifindex == ifindex) {
+            hash_del_rcu(&b->node);
+            kfree_rcu(b, rcu);
+        }
+    }
+    spin_unlock_bh(&nb->lock);
+}
+
+/* Only once nothing can look the buckets up any more. */
+static void nat_ndp_buckets_free(struct nat_ndp_buckets *nb) {
+    struct nat_ndp_bucket *b;
+    struct hlist_node *tmp;
+    int bkt;
+
+    if (!nb)
+        return;
+
+    hash_for_each_safe(nb->index, bkt, tmp, b, node)
+        kfree(b);
+    kfree(nb);
+}
+
+/* Answer a solicitation for a proxied target, at most once per solicitor
+ * and target within ndp_suppress_ms and within the interface's budget.
+ * The solicitation itself is consumed either way. */
+static void nat_ndp_answer(struct sk_buff *skb, const struct nf_hook_state *state,
+                           const struct nat_view *v, struct nat_mapping_stats __percpu *stats,
+                           const struct nd_msg *ns_msg, const struct ipv6hdr *iph,
+                           int ifindex) {
+    struct slick_nat_net *sn_net = v->sn_net;
+    unsigned int suppress_ms = READ_ONCE(sn_net->ndp_suppress_ms);
+    struct nat_ndp_seen *e = NULL;
+
+    if (suppress_ms) {
+        e = nat_ndp_seen_slot(&iph->saddr, &ns_msg->target, ifindex);
+        if (nat_ndp_suppressed(e, v->gen, &iph->saddr, &ns_msg->target, ifindex)) {
+            this_cpu_inc(sn_net->stats->ndp_suppressed);
+            trace_slick_nat_ndp(ifindex, &iph->saddr, &ns_msg->target,
+                                NAT_TRACE_NDP_SUPPRESSED);
+            return;
         }
     }
-    spin_unlock_irqrestore(&sn_net->mapping_lock, flags);
 
-    return found;
+    if (!nat_ndp_allow(sn_net, ifindex)) {
+        this_cpu_inc(sn_net->stats->ndp_ratelimited);
+        trace_slick_nat_ndp(ifindex, &iph->saddr, &ns_msg->target, NAT_TRACE_NDP_RATELIMITED);
+        return;
+    }
+
+    if (e) {
+        e->gen = v->gen;
+        e->solicitor = iph->saddr;
+        e->target = ns_msg->target;
+        e->ifindex = ifindex;
+        e->expires = jiffies + msecs_to_jiffies(suppress_ms);
+    }
+
+    this_cpu_inc(sn_net->stats->ndp_answered);
+    trace_slick_nat_ndp(ifindex, &iph->saddr, &ns_msg->target, NAT_TRACE_NDP_ANSWERED);
+    nat_count(stats, NAT_CNT_NDP, skb->len);
+    send_neighbor_advertisement(skb, state, &ns_msg->target, &iph->saddr);
 }
 
 /* Returns NF_ACCEPT/NF_DROP to short-circuit, or -1 to keep processing. */
 static int nat_handle_icmpv6(struct sk_buff *skb, const struct nf_hook_state *state,
-                             struct slick_nat_net *sn_net, int thoff, bool is_external_if,
-                             const char *ifname, bool *is_icmp_error) {
+                             const struct nat_view *v, int thoff, bool is_external_if,
+                             int ifindex, bool *is_icmp_error) {
+    struct nat_mapping_stats __percpu *stats;
     struct icmp6hdr *icmp6h;
     struct ipv6hdr *iph;
     struct nd_msg *ns_msg;
@@ -414,8 +954,9 @@ static int nat_handle_icmpv6(struct sk_buff *skb, const struct nf_hook_state *st
         if (ipv6_addr_type(&ns_msg->target) & IPV6_ADDR_MULTICAST)
             return NF_ACCEPT;
 
-        if (nat_ndp_target_is_proxied(sn_net, &ns_msg->target, is_external_if, ifname)) {
-            send_neighbor_advertisement(skb, state, &ns_msg->target, &iph->saddr);
+        stats = nat_ndp_target_is_proxied(v->t, &ns_msg->target, is_external_if, ifindex);
+        if (stats) {
+            nat_ndp_answer(skb, state, v, stats, ns_msg, iph, ifindex);
             return NF_DROP;
         }
         return NF_ACCEPT;
@@ -442,23 +983,35 @@ static int nat_handle_icmpv6(struct sk_buff *skb, const struct nf_hook_state *st
     }
 }
 
-static unsigned int nat_hook_func(void *priv, struct sk_buff *skb, const struct nf_hook_state *state) {
+/* Count and trace a drop of the translation path. */
+static unsigned int nat_drop(const struct nat_view *v, int ifindex, bool is_external_if,
+                             enum nat_trace_drop reason, int need) {
+    if (reason == NAT_TRACE_DROP_WRITABLE)
+        this_cpu_inc(v->sn_net->stats->drop_writable);
+    else
+        this_cpu_inc(v->sn_net->stats->drop_nptv6);
+    trace_slick_nat_drop(ifindex, is_external_if, reason, need);
+
+    return NF_DROP;
+}
+
+/* is_external_if is the direction of state->in: looked up per packet by the
+ * PRE_ROUTING hook, fixed per device by the ingress hooks. */
+static unsigned int nat_handle_packet(struct sk_buff *skb, const struct nf_hook_state *state,
+                                      const struct nat_view *v, bool is_external_if) {
     struct ipv6hdr *iph;
-    struct in6_addr old_addr;
     struct nat_xlate xs = { }, xd = { };
-    struct slick_nat_net *sn_net;
-    const char *ifname;
-    struct net *net = state->net;
-    bool is_external_if;
+    bool csum_neutral;
     bool is_icmp_error = false;
     bool inner_translated = false;
     bool first_frag = true;
     u8 proto = 0;
+    int ifindex;
     int thoff;
     int verdict;
     int need;
 
-    /* The module only registers PRE_ROUTING, so state->in is always set. */
+    /* PRE_ROUTING and ingress hooks both have state->in set. */
     if (!skb || !state->in)
         return NF_ACCEPT;
 
@@ -469,27 +1022,26 @@ static unsigned int nat_hook_func(void *priv, struct sk_buff *skb, const struct
     if (iph->version != 6)
         return NF_ACCEPT;
 
-    sn_net = slick_nat_pernet(net);
-
-    /* Nothing configured in this namespace: skip the locking entirely.
-     * Racing with a concurrent add at worst lets one packet through
-     * untranslated, which the sender will retransmit. */
-    if (!READ_ONCE(sn_net->mapping_count))
+    /* Nothing configured in this namespace.  Racing with a concurrent add
+     * at worst lets one packet through untranslated, which the sender will
+     * retransmit. */
+    if (!READ_ONCE(v->t->mapping_count))
         return NF_ACCEPT;
 
-    ifname = state->in->name;
-    is_external_if = is_external_interface(sn_net, ifname);
+    ifindex = state->in->ifindex;
 
     thoff = nat_transport_offset(skb, &proto, &first_frag);
     if (thoff < 0)
         return NF_ACCEPT;
 
+    trace_slick_nat_classify(ifindex, is_external_if, proto, first_frag);
+
     /* Neighbour discovery has to be inspected before the link-local
      * shortcut below: solicitations normally travel from a link-local
      * source to a solicited-node multicast group. */
     if (proto == IPPROTO_ICMPV6 && first_frag) {
-        verdict = nat_handle_icmpv6(skb, state, sn_net, thoff, is_external_if,
-                                    ifname, &is_icmp_error);
+        verdict = nat_handle_icmpv6(skb, state, v, thoff, is_external_if,
+                                    ifindex, &is_icmp_error);
         if (verdict >= 0)
             return verdict;
         /* pskb_may_pull() may have reallocated the buffer. */
@@ -503,11 +1055,18 @@ static unsigned int nat_hook_func(void *priv, struct sk_buff *skb, const struct
         (ipv6_addr_type(&iph->daddr) & IPV6_ADDR_LINKLOCAL))
         return NF_ACCEPT;
 
-    nat_lookup_pair(sn_net, &iph->saddr, &iph->daddr, is_external_if, ifname, &xs, &xd);
+    nat_lookup_pair(v, &iph->saddr, &iph->daddr, is_external_if, ifindex, &xs, &xd);
 
     if (!xs.valid && !xd.valid)
         return NF_ACCEPT;
 
+    /* With only NPTv6 mappings involved the transport header is never
+     * touched, so only the IPv6 header has to be writable.  ICMPv6 errors
+     * still need their embedded header. */
+    csum_neutral = (!xs.valid || xs.nptv6) && (!xd.valid || xd.nptv6) && !is_icmp_error;
+    need = csum_neutral ? sizeof(struct ipv6hdr) :
+                          nat_writable_len(skb, thoff, proto, is_icmp_error);
+
     if (is_external_if) {
         /* Ingress from an external interface: only traffic addressed to one
          * of our external prefixes is ours to translate. */
@@ -517,28 +1076,26 @@ static unsigned int nat_hook_func(void *priv, struct sk_buff *skb, const struct
         /* Report the expiry against the pre-translation addresses so that
          * traceroute sees the external address of this hop. */
         if (iph->hop_limit <= 1) {
+            this_cpu_inc(v->sn_net->stats->hop_limit_expired);
+            trace_slick_nat_hop_limit(ifindex, &iph->saddr, &iph->daddr);
             icmpv6_send(skb, ICMPV6_TIME_EXCEED, ICMPV6_EXC_HOPLIMIT, 0);
             return NF_DROP;
         }
 
-        need = nat_writable_len(skb, thoff, proto, is_icmp_error);
         if (skb_ensure_writable(skb, need))
-            return NF_DROP;
+            return nat_drop(v, ifindex, is_external_if, NAT_TRACE_DROP_WRITABLE, need);
         iph = ipv6_hdr(skb);
 
         if (is_icmp_error)
-            inner_translated = handle_icmp_error_embedded_packet(skb, thoff, net,
-                                                                 is_external_if, ifname);
+            inner_translated = handle_icmp_error_embedded_packet(skb, thoff, v,
+                                                                 is_external_if, ifindex);
 
-        old_addr = iph->daddr;
-        remap_address_with_len(&iph->daddr, &xd.to_prefix, xd.prefix_len);
-        update_csum(skb, thoff, proto, first_frag, &old_addr, &iph->daddr);
+        /* RFC 6296: an address NPTv6 cannot translate is dropped. */
+        if (!nat_rewrite_addr(skb, thoff, proto, first_frag, &iph->daddr, &xd) ||
+            (xs.valid && !nat_rewrite_addr(skb, thoff, proto, first_frag, &iph->saddr, &xs)))
+            return nat_drop(v, ifindex, is_external_if, NAT_TRACE_DROP_NPTV6, 0);
 
-        if (xs.valid) {
-            old_addr = iph->saddr;
-            remap_address_with_len(&iph->saddr, &xs.to_prefix, xs.prefix_len);
-            update_csum(skb, thoff, proto, first_frag, &old_addr, &iph->saddr);
-        }
+        nat_count(xd.stats, inner_translated ? NAT_CNT_ICMP_ERR : NAT_CNT_IN, skb->len);
     } else {
         /* Ingress from an internal interface: rewrite our source into the
          * external prefix.  The destination is only rewritten when it also
@@ -546,450 +1103,2696 @@ static unsigned int nat_hook_func(void *priv, struct sk_buff *skb, const struct
         if (!xs.valid)
             return NF_ACCEPT;
 
-        need = nat_writable_len(skb, thoff, proto, is_icmp_error);
         if (skb_ensure_writable(skb, need))
-            return NF_DROP;
+            return nat_drop(v, ifindex, is_external_if, NAT_TRACE_DROP_WRITABLE, need);
         iph = ipv6_hdr(skb);
 
         if (is_icmp_error)
-            inner_translated = handle_icmp_error_embedded_packet(skb, thoff, net,
-                                                                 is_external_if, ifname);
+            inner_translated = handle_icmp_error_embedded_packet(skb, thoff, v,
+                                                                 is_external_if, ifindex);
 
-        old_addr = iph->saddr;
-        remap_address_with_len(&iph->saddr, &xs.to_prefix, xs.prefix_len);
-        update_csum(skb, thoff, proto, first_frag, &old_addr, &iph->saddr);
+        if (!nat_rewrite_addr(skb, thoff, proto, first_frag, &iph->saddr, &xs) ||
+            (xd.valid && !nat_rewrite_addr(skb, thoff, proto, first_frag, &iph->daddr, &xd)))
+            return nat_drop(v, ifindex, is_external_if, NAT_TRACE_DROP_NPTV6, 0);
 
-        if (xd.valid) {
-            old_addr = iph->daddr;
-            remap_address_with_len(&iph->daddr, &xd.to_prefix, xd.prefix_len);
-            update_csum(skb, thoff, proto, first_frag, &old_addr, &iph->daddr);
-        }
+        nat_count(xs.stats, inner_translated ? NAT_CNT_ICMP_ERR : NAT_CNT_OUT, skb->len);
     }
 
-    if (inner_translated)
+    if (inner_translated) {
+        struct icmp6hdr *icmp6h = (struct icmp6hdr *)(skb->data + thoff);
+
         nat_icmp6_csum_recalc(skb, thoff);
+        this_cpu_inc(v->sn_net->stats->icmp_err_translated);
+        trace_slick_nat_icmp_err(ifindex, is_external_if, icmp6h->icmp6_type,
+                                 icmp6h->icmp6_code);
+    }
 
     return NF_ACCEPT;
 }
 
-static int mapping_show(struct seq_file *m, void *v) {
-    struct net *net = m->private;
-    struct slick_nat_net *sn_net = slick_nat_pernet(net);
-    struct nat_mapping *mapping;
-    unsigned long flags;
-
-    seq_printf(m, "# IPv6 NAT Mappings\n");
-    seq_printf(m, "# Format: interface internal_prefix/len -> external_prefix/len\n\n");
-
-    spin_lock_irqsave(&sn_net->mapping_lock, flags);
-    list_for_each_entry(mapping, &sn_net->mapping_list, list) {
-        seq_printf(m, "%s %pI6c/%d -> %pI6c/%d\n",
-                   mapping->interface,
-                   &mapping->internal_prefix, mapping->prefix_len,
-                   &mapping->external_prefix, mapping->prefix_len);
-    }
-    spin_unlock_irqrestore(&sn_net->mapping_lock, flags);
+/* Always on: local_clock() is cheap (a TSC read on x86), and both updates
+ * stay on this CPU's cache lines. */
+static void nat_hook_account(struct slick_nat_net *sn_net, u64 start) {
+    u64 ns = local_clock() - start;
 
-    return 0;
+    this_cpu_inc(sn_net->stats->hook_packets);
+    this_cpu_inc(sn_net->stats->hook_ns[nat_hist_bucket(ns, NAT_HOOK_NS_BUCKETS)]);
 }
 
-static int mapping_open(struct inode *inode, struct file *file) {
-    return single_open(file, mapping_show, pde_data(inode));
+static unsigned int nat_hook_func(void *priv, struct sk_buff *skb, const struct nf_hook_state *state) {
+    u64 start = local_clock();
+    struct nat_view v;
+    unsigned int verdict;
+
+    /* Netfilter already runs hooks under rcu_read_lock(); taking it again
+     * is free and keeps the table dereference self-evidently safe. */
+    rcu_read_lock();
+    nat_view_get(slick_nat_pernet(state->net), &v);
+    verdict = nat_handle_packet(skb, state, &v,
+                                state->in && is_external_interface(v.t, state->in->ifindex));
+    rcu_read_unlock();
+
+    nat_hook_account(v.sn_net, start);
+    return verdict;
 }
 
-static int parse_ipv6_prefix(const char *str, struct in6_addr *addr, int *prefix_len) {
-    char buf[64];
-    char *prefix_str;
-    char *len_str;
-    struct in6_addr parsed;
-    int ret;
-
-    if (strlen(str) >= sizeof(buf))
-        return -EINVAL;
+/* hook_mode=ingress.  Sees every protocol, and packets that have not been
+ * through ip6_rcv() yet; nat_handle_packet() checks the header itself. */
+static unsigned int nat_ingress_hook(void *priv, struct sk_buff *skb,
+                                     const struct nf_hook_state *state) {
+    const struct nat_dev_hook *h = priv;
+    struct nat_view v;
+    unsigned int verdict;
+    u64 start;
 
-    strcpy(buf, str);
-    prefix_str = buf;
+    if (skb->protocol != htons(ETH_P_IPV6))
+        return NF_ACCEPT;
 
-    len_str = strchr(buf, '/');
-    if (!len_str)
-        return -EINVAL;
+    start = local_clock();
+    rcu_read_lock();
+    nat_view_get(slick_nat_pernet(state->net), &v);
+    verdict = nat_handle_packet(skb, state, &v, h->external);
+    rcu_read_unlock();
 
-    *len_str = '\0';
-    len_str++;
+    nat_hook_account(v.sn_net, start);
+    return verdict;
+}
 
-    ret = in6_pton(prefix_str, -1, (u8 *)parsed.s6_addr, -1, NULL);
-    if (ret != 1)
-        return -EINVAL;
+static struct nf_hook_ops nat_nf_hook_ops = {
+    .hook     = nat_hook_func,
+    .pf       = PF_INET6,
+    .hooknum  = NF_INET_PRE_ROUTING,
+    .priority = NF_IP6_PRI_NAT_DST,
+};
 
-    ret = kstrtoint(len_str, 10, prefix_len);
-    if (ret < 0)
-        return -EINVAL;
+/* Unregister a hook and move it to dead.  nf_unregister_net_hook() only
+ * swaps the entry out: a packet already in nat_ingress_hook() may still be
+ * reading h through priv, so h is freed by nat_dev_hooks_free() after a
+ * grace period. */
+static void nat_dev_hook_unlink(struct net *net, struct nat_dev_hook *h, struct list_head *dead) {
+    nf_unregister_net_hook(net, &h->ops);
+    list_move_tail(&h->list, dead);
+}
 
-    if (*prefix_len < 0 || *prefix_len > 128)
-        return -EINVAL;
+/* Free unlinked hooks, with one grace period for all of them. */
+static void nat_dev_hooks_free(struct list_head *dead) {
+    struct nat_dev_hook *h, *tmp;
 
-    /* Store the prefix canonically so hashing and comparison agree even when
-     * the caller left host bits set. */
-    ipv6_addr_prefix(addr, &parsed, *prefix_len);
+    if (list_empty(dead))
+        return;
 
-    return 0;
+    synchronize_net();
+    list_for_each_entry_safe(h, tmp, dead, list) {
+        dev_put(h->dev);
+        kfree(h);
+    }
 }
 
-static void nat_mapping_unlink(struct slick_nat_net *sn_net, struct nat_mapping *mapping) {
-    hlist_del(&mapping->internal_node);
-    hlist_del(&mapping->external_node);
-    list_del(&mapping->list);
-    sn_net->prefix_len_use[mapping->prefix_len]--;
-    WRITE_ONCE(sn_net->mapping_count, sn_net->mapping_count - 1);
-    kfree(mapping);
-}
+static int nat_dev_hook_want(struct net *net, struct slick_nat_net *sn_net, int ifindex,
+                             bool external, struct list_head *dead) {
+    struct nat_dev_hook *h;
+    struct net_device *dev;
+    int ret;
 
-static int add_mapping_internal_unlocked(struct net *net, const char *interface,
-                                        const struct in6_addr *internal_prefix, int internal_prefix_len,
-                                        const struct in6_addr *external_prefix, int external_prefix_len) {
-    struct slick_nat_net *sn_net = slick_nat_pernet(net);
-    struct nat_mapping *mapping, *tmp;
+    list_for_each_entry(h, &sn_net->dev_hooks, list) {
+        if (h->dev->ifindex != ifindex)
+            continue;
+        /* External wins: a device with mappings is external however it
+         * was declared. */
+        if (h->keep || h->external == external) {
+            h->keep = true;
+            return 0;
+        }
+        nat_dev_hook_unlink(net, h, dead);
+        break;
+    }
 
-    // Both prefixes must have the same length
-    if (internal_prefix_len != external_prefix_len)
-        return -EINVAL;
+    /* Gone since the caller looked; the notifier syncs again for it. */
+    dev = dev_get_by_index(net, ifindex);
+    if (!dev)
+        return 0;
 
-    if (sn_net->mapping_count >= SLICK_NAT_MAX_MAPPINGS)
-        return -ENOSPC;
+    h = kzalloc(sizeof(*h), GFP_KERNEL);
+    if (!h) {
+        dev_put(dev);
+        return -ENOMEM;
+    }
 
-    // Reject duplicates on either side - two mappings claiming the same
-    // prefix on the same interface would make lookups ambiguous.
-    list_for_each_entry(tmp, &sn_net->mapping_list, list) {
-        if (strncmp(tmp->interface, interface, IFNAMSIZ) != 0)
+    h->dev = dev;
+    h->external = external;
+    h->keep = true;
+    h->ops.hook = nat_ingress_hook;
+    h->ops.pf = NFPROTO_NETDEV;
+    h->ops.hooknum = NF_NETDEV_INGRESS;
+    h->ops.priority = NF_IP6_PRI_NAT_DST;
+    h->ops.dev = dev;
+    h->ops.priv = h;
+
+    ret = nf_register_net_hook(net, &h->ops);
+    if (ret) {
+        pr_warn("Slick NAT: Failed to register ingress hook on %s (%d)\n", dev->name, ret);
+        dev_put(dev);
+        kfree(h);
+        return ret;
+    }
+
+    list_add_tail(&h->list, &sn_net->dev_hooks);
+    return 0;
+}
+
+/*
+ * Bring the ingress hooks in line with the published table: one external
+ * hook per bound interface entry, one internal hook per declared internal
+ * interface that exists, nothing anywhere else - and nothing at all while
+ * there are no mappings.  Called after every change to the table or to the
+ * devices it names.  Returns the first error; the devices it hit are left
+ * without a hook until the next sync.  Caller must hold mapping_mutex.
+ */
+static int nat_dev_hooks_sync(struct net *net, struct slick_nat_net *sn_net) {
+    struct nat_table *t = nat_table_locked(sn_net);
+    struct nat_internal_if *in;
+    struct nat_dev_hook *h, *tmp;
+    struct nat_iface *iface;
+    struct net_device *dev;
+    LIST_HEAD(dead);
+    int ifindex, ret, err = 0;
+
+    if (!nat_hook_ingress)
+        return 0;
+
+    list_for_each_entry(h, &sn_net->dev_hooks, list)
+        h->keep = false;
+
+    if (!t->mapping_count)
+        goto out;
+
+    list_for_each_entry(iface, &t->iface_list, list) {
+        if (!iface->ifindex)
             continue;
-        if (tmp->prefix_len != internal_prefix_len)
+        ret = nat_dev_hook_want(net, sn_net, iface->ifindex, true, &dead);
+        if (ret && !err)
+            err = ret;
+    }
+
+    list_for_each_entry(in, &t->internal_list, list) {
+        rcu_read_lock();
+        dev = dev_get_by_name_rcu(net, in->name);
+        ifindex = dev ? dev->ifindex : 0;
+        rcu_read_unlock();
+        if (!ifindex)
             continue;
-        if (ipv6_addr_equal(&tmp->internal_prefix, internal_prefix) ||
-            ipv6_addr_equal(&tmp->external_prefix, external_prefix))
-            return -EEXIST;
+        ret = nat_dev_hook_want(net, sn_net, ifindex, false, &dead);
+        if (ret && !err)
+            err = ret;
     }
 
-    mapping = kmalloc(sizeof(*mapping), GFP_ATOMIC);
-    if (!mapping)
+out:
+    list_for_each_entry_safe(h, tmp, &sn_net->dev_hooks, list) {
+        if (!h->keep)
+            nat_dev_hook_unlink(net, h, &dead);
+    }
+    nat_dev_hooks_free(&dead);
+
+    return err;
+}
+
+/*
+ * The mappings and mapping_stats files are streamed: seq_file asks for one
+ * record at a time and only ever holds a page or so, whatever the size of
+ * the table.  The walk runs under rcu_read_lock() from start to stop, so
+ * packets and writers never wait on a reader.
+ *
+ * A large dump takes many read() calls.  Between them the iterator keeps a
+ * cursor (the record it is about to show and its position), and the next
+ * start() resumes from it if the namespace's translation generation has not
+ * moved.  That is safe without any reference: a mapping is unlinked and
+ * freed only after the generation is bumped and a grace period has passed.
+ * When the table did change, the walk starts over from the head and skips
+ * to the position, like any other seq_file.
+ */
+struct nat_dump_iter {
+    struct net *net;
+    bool with_internal;     /* also list internal_list after the mappings */
+    struct nat_table *t;
+    u64 gen;
+    loff_t pos;
+    void *cur;              /* nat_mapping, or nat_internal_if if internal */
+    bool internal;
+};
+
+/* Moves the cursor to the next record, the first one if there is none. */
+static void *nat_dump_advance(struct nat_dump_iter *it) {
+    struct nat_table *t = it->t;
+    struct nat_mapping *mapping = it->cur;
+    struct nat_internal_if *in = it->cur;
+
+    if (!it->internal) {
+        if (mapping)
+            mapping = list_next_or_null_rcu(&t->mapping_list, &mapping->list,
+                                            struct nat_mapping, list);
+        else
+            mapping = list_first_or_null_rcu(&t->mapping_list, struct nat_mapping, list);
+        if (mapping || !it->with_internal) {
+            it->cur = mapping;
+            return mapping;
+        }
+        it->internal = true;
+        in = list_first_or_null_rcu(&t->internal_list, struct nat_internal_if, list);
+    } else {
+        in = list_next_or_null_rcu(&t->internal_list, &in->list, struct nat_internal_if, list);
+    }
+
+    it->cur = in;
+    return in;
+}
+
+static void *nat_dump_start(struct seq_file *m, loff_t *pos) __acquires(RCU) {
+    struct nat_dump_iter *it = m->private;
+    struct nat_view v;
+    loff_t i;
+
+    rcu_read_lock();
+    nat_view_get(slick_nat_pernet(it->net), &v);
+
+    if (*pos && it->cur && it->pos == *pos && it->t == v.t && it->gen == v.gen)
+        return it->cur;
+
+    it->t = v.t;
+    it->gen = v.gen;
+    it->cur = NULL;
+    it->internal = false;
+    it->pos = *pos;
+    if (*pos == 0)
+        return SEQ_START_TOKEN;
+
+    for (i = 0; i < *pos; i++) {
+        if (!nat_dump_advance(it))
+            return NULL;
+    }
+    return it->cur;
+}
+
+static void *nat_dump_next(struct seq_file *m, void *v, loff_t *pos) {
+    struct nat_dump_iter *it = m->private;
+
+    ++*pos;
+    v = nat_dump_advance(it);
+    it->pos = *pos;
+    return v;
+}
+
+static void nat_dump_stop(struct seq_file *m, void *v) __releases(RCU) {
+    rcu_read_unlock();
+}
+
+static int nat_dump_open(struct inode *inode, struct file *file,
+                         const struct seq_operations *ops, bool with_internal) {
+    struct nat_dump_iter *it;
+
+    it = __seq_open_private(file, ops, sizeof(*it));
+    if (!it)
         return -ENOMEM;
 
-    strscpy(mapping->interface, interface, IFNAMSIZ);
-    mapping->internal_prefix = *internal_prefix;
-    mapping->external_prefix = *external_prefix;
-    mapping->prefix_len = internal_prefix_len;
+    it->net = pde_data(inode);
+    it->with_internal = with_internal;
+    return 0;
+}
+
+static int mapping_show(struct seq_file *m, void *v) {
+    struct nat_dump_iter *it = m->private;
+    struct nat_mapping *mapping = v;
+    struct nat_internal_if *in = v;
+
+    if (v == SEQ_START_TOKEN) {
+        seq_printf(m, "# IPv6 NAT Mappings\n");
+        seq_printf(m, "# Format: interface internal_prefix/len -> external_prefix/len [nptv6]\n\n");
+        return 0;
+    }
 
-    hlist_add_head(&mapping->internal_node,
-                   &sn_net->internal_hash[prefix_hash(internal_prefix, internal_prefix_len)]);
-    hlist_add_head(&mapping->external_node,
-                   &sn_net->external_hash[prefix_hash(external_prefix, external_prefix_len)]);
-    list_add_tail(&mapping->list, &sn_net->mapping_list);
-    sn_net->prefix_len_use[internal_prefix_len]++;
-    WRITE_ONCE(sn_net->mapping_count, sn_net->mapping_count + 1);
+    if (it->internal) {
+        seq_printf(m, "internal %s\n", in->name);
+        return 0;
+    }
 
+    seq_printf(m, "%s %pI6c/%d -> %pI6c/%d%s\n",
+               mapping->interface,
+               &mapping->internal_prefix, mapping->prefix_len,
+               &mapping->external_prefix, mapping->prefix_len,
+               mapping->nptv6 ? " nptv6" : "");
     return 0;
 }
 
-static int del_mapping_internal_unlocked(struct net *net, const char *interface,
-                                        const struct in6_addr *internal_prefix, int internal_prefix_len) {
-    struct slick_nat_net *sn_net = slick_nat_pernet(net);
-    struct nat_mapping *mapping, *tmp;
+static const struct seq_operations mapping_seq_ops = {
+    .start = nat_dump_start,
+    .next = nat_dump_next,
+    .stop = nat_dump_stop,
+    .show = mapping_show,
+};
 
-    list_for_each_entry_safe(mapping, tmp, &sn_net->mapping_list, list) {
-        if (strncmp(mapping->interface, interface, IFNAMSIZ) == 0 &&
-            ipv6_addr_equal(&mapping->internal_prefix, internal_prefix) &&
-            mapping->prefix_len == internal_prefix_len) {
-            nat_mapping_unlink(sn_net, mapping);
-            return 0;
+static int mapping_open(struct inode *inode, struct file *file) {
+    return nat_dump_open(inode, file, &mapping_seq_ops, true);
+}
+
+static int parse_ipv6_prefix(const char *str, struct in6_addr *addr, int *prefix_len) {
+    char buf[64];
+    char *prefix_str;
+    char *len_str;
+    struct in6_addr parsed;
+    int ret;
+
+    if (strlen(str) >= sizeof(buf))
+        return -EINVAL;
+
+    strcpy(buf, str);
+    prefix_str = buf;
+
+    len_str = strchr(buf, '/');
+    if (!len_str)
+        return -EINVAL;
+
+    *len_str = '\0';
+    len_str++;
+
+    ret = in6_pton(prefix_str, -1, (u8 *)parsed.s6_addr, -1, NULL);
+    if (ret != 1)
+        return -EINVAL;
+
+    ret = kstrtoint(len_str, 10, prefix_len);
+    if (ret < 0)
+        return -EINVAL;
+
+    if (*prefix_len < 0 || *prefix_len > 128)
+        return -EINVAL;
+
+    /* Store the prefix canonically so hashing and comparison agree even when
+     * the caller left host bits set. */
+    ipv6_addr_prefix(addr, &parsed, *prefix_len);
+
+    return 0;
+}
+
+/* The mapping a lookup of exactly this internal prefix resolves to: the most
+ * recently added one, as in the lookup structures.  Caller must hold
+ * mapping_mutex. */
+static struct nat_mapping *nat_find_internal_exact(struct nat_table *t,
+                                                   const struct in6_addr *prefix, int prefix_len) {
+    struct rhlist_head *list;
+    struct nat_hkey key;
+
+    if (nat_use_trie)
+        return nat_lpm_find(&t->internal_lpm, prefix, prefix_len);
+
+    key.prefix = *prefix;
+    key.len = prefix_len;
+    /* The lookup wants RCU; mapping_mutex keeps the result alive after. */
+    rcu_read_lock();
+    list = rhltable_lookup(&t->internal_index, &key, nat_internal_params);
+    rcu_read_unlock();
+    return list ? container_of(list, struct nat_mapping, internal_node) : NULL;
+}
+
+/*
+ * Mirror of the published table in the XDP prefix map.  The XDP program
+ * only acts on a hit and hands everything else to the hook, so a missing
+ * entry is always safe, but a hit on a shorter prefix than the module
+ * would pick is not.  Entries therefore go in longest first and come out
+ * shortest first, and an interface marker goes in before, and comes out
+ * after, the entries of its interface.
+ */
+static bool nat_xdp_active(struct slick_nat_net *sn_net, struct nat_table *t) {
+    return sn_net->xdp_map && !sn_net->xdp_err && nat_table_is_live(sn_net, t);
+}
+
+/* only: restrict to the external entries of one interface. */
+static int nat_xdp_add_mapping(struct bpf_map *map, const struct nat_mapping *mapping,
+                               const struct nat_iface *only) {
+    u32 flags = mapping->nptv6 ? SLICK_NAT_XDP_F_NPTV6 : 0;
+    int ret = 0;
+
+    if (!only)
+        ret = nat_xdp_update(map, 0, &mapping->internal_prefix, mapping->prefix_len,
+                             &mapping->external_prefix, flags, ~mapping->csum_delta);
+    if (!ret && mapping->ifindex)
+        ret = nat_xdp_update(map, mapping->ifindex, &mapping->external_prefix,
+                             mapping->prefix_len, &mapping->internal_prefix, flags,
+                             mapping->csum_delta);
+
+    return ret;
+}
+
+static void nat_xdp_del_mapping(struct bpf_map *map, const struct nat_mapping *mapping,
+                                const struct nat_iface *only) {
+    if (!only)
+        nat_xdp_delete(map, 0, &mapping->internal_prefix, mapping->prefix_len);
+    if (mapping->ifindex)
+        nat_xdp_delete(map, mapping->ifindex, &mapping->external_prefix, mapping->prefix_len);
+}
+
+static int nat_xdp_add_marker(struct bpf_map *map, const struct nat_iface *iface) {
+    return nat_xdp_update(map, iface->ifindex, &in6addr_any, 0, &in6addr_any,
+                          SLICK_NAT_XDP_F_IFACE, 0);
+}
+
+/* Add or remove, in the safe order, every entry of a table, or only those
+ * of one interface.  Caller must hold mapping_mutex. */
+static int nat_xdp_sync_table(struct bpf_map *map, struct nat_table *t,
+                              const struct nat_iface *only, bool add) {
+    struct nat_mapping *mapping;
+    struct nat_iface *iface;
+    int i, len, ret;
+
+    list_for_each_entry(iface, &t->iface_list, list) {
+        if (!add || !iface->ifindex || (only && iface != only))
+            continue;
+        ret = nat_xdp_add_marker(map, iface);
+        if (ret)
+            return ret;
+    }
+
+    for (i = 0; i <= 128; i++) {
+        len = add ? 128 - i : i;
+        if (!t->prefix_len_use[len])
+            continue;
+
+        list_for_each_entry(mapping, &t->mapping_list, list) {
+            if (mapping->prefix_len != len || (only && mapping->iface != only))
+                continue;
+            if (!add) {
+                nat_xdp_del_mapping(map, mapping, only);
+                continue;
+            }
+            ret = nat_xdp_add_mapping(map, mapping, only);
+            if (ret)
+                return ret;
         }
+        cond_resched();
+    }
+
+    list_for_each_entry(iface, &t->iface_list, list) {
+        if (add || !iface->ifindex || (only && iface != only))
+            continue;
+        nat_xdp_delete(map, iface->ifindex, &in6addr_any, 0);
     }
-    return -ENOENT;
+
+    return 0;
 }
 
-static int drop_mappings_internal_unlocked(struct net *net, const char *interface) {
-    struct slick_nat_net *sn_net = slick_nat_pernet(net);
-    struct nat_mapping *mapping, *tmp;
-    int dropped = 0;
+/* Take our entries out again and stop mirroring, so the XDP program hands
+ * every packet to the hook until the map is bound anew. */
+static void nat_xdp_fail(struct slick_nat_net *sn_net, struct nat_table *t, int err) {
+    pr_err("Slick NAT: XDP map update failed (%d) at %u mappings, map holds %u entries; "
+           "XDP translation disabled until the map is bound again\n",
+           err, t->mapping_count, nat_xdp_map_max_entries(sn_net->xdp_map));
+    sn_net->xdp_err = err;
+    nat_xdp_sync_table(sn_net->xdp_map, t, NULL, false);
+    nat_xdp_flush(sn_net->xdp_map);
+}
 
-    list_for_each_entry_safe(mapping, tmp, &sn_net->mapping_list, list) {
-        // If interface is specified, only drop mappings for that interface
-        if (interface && strncmp(mapping->interface, interface, IFNAMSIZ) != 0)
-            continue;
+/* Called once the mapping is out of the table.  Another mapping may use
+ * the same internal prefix on a different interface; it takes the entry
+ * over in place rather than leaving a gap a shorter prefix could fill. */
+static void nat_xdp_unlink_mapping(struct slick_nat_net *sn_net, struct nat_table *t,
+                                   const struct nat_mapping *mapping) {
+    struct bpf_map *map = sn_net->xdp_map;
+    struct nat_mapping *next;
+    int ret;
 
-        nat_mapping_unlink(sn_net, mapping);
-        dropped++;
+    if (mapping->ifindex)
+        nat_xdp_delete(map, mapping->ifindex, &mapping->external_prefix, mapping->prefix_len);
+
+    next = nat_find_internal_exact(t, &mapping->internal_prefix, mapping->prefix_len);
+    if (!next) {
+        nat_xdp_delete(map, 0, &mapping->internal_prefix, mapping->prefix_len);
+        return;
     }
 
-    return dropped;
+    ret = nat_xdp_update(map, 0, &next->internal_prefix, next->prefix_len,
+                         &next->external_prefix, next->nptv6 ? SLICK_NAT_XDP_F_NPTV6 : 0,
+                         ~next->csum_delta);
+    if (ret)
+        nat_xdp_fail(sn_net, t, ret);
 }
 
-/* Pull the next whitespace-delimited token out of *s, NUL-terminating it. */
-static char *nat_next_token(char **s) {
-    char *tok;
+/* (Re)bind an interface entry to a device index, or unbind it with 0, and
+ * carry the new index into every mapping that uses it.  Caller must hold
+ * mapping_mutex. */
+static void nat_iface_set_ifindex(struct slick_nat_net *sn_net, struct nat_table *t,
+                                  struct nat_iface *iface, int ifindex) {
+    struct nat_mapping *mapping;
+    bool xdp = nat_xdp_active(sn_net, t);
+    int ret;
 
-    if (!*s)
+    if (iface->ifindex == ifindex)
+        return;
+
+    if (xdp)
+        nat_xdp_sync_table(sn_net->xdp_map, t, iface, false);
+
+    if (iface->ifindex)
+        hash_del_rcu(&iface->index_node);
+    WRITE_ONCE(iface->ifindex, ifindex);
+    if (ifindex)
+        hash_add_rcu(t->iface_index, &iface->index_node, ifindex);
+
+    list_for_each_entry(mapping, &iface->mappings, iface_node)
+        WRITE_ONCE(mapping->ifindex, ifindex);
+
+    nat_table_changed(sn_net, t);
+
+    if (xdp) {
+        ret = nat_xdp_sync_table(sn_net->xdp_map, t, iface, true);
+        if (ret)
+            nat_xdp_fail(sn_net, t, ret);
+    }
+}
+
+/* The entry of an interface some mapping names, or NULL.  Caller must hold
+ * mapping_mutex. */
+static struct nat_iface *nat_iface_find(struct nat_table *t, const char *name) {
+    struct nat_iface *iface;
+
+    list_for_each_entry(iface, &t->iface_list, list) {
+        if (strncmp(iface->name, name, IFNAMSIZ) == 0)
+            return iface;
+    }
+
+    return NULL;
+}
+
+/* Find or create the interface entry for a mapping and take a reference on
+ * it.  Caller must hold mapping_mutex. */
+static struct nat_iface *nat_iface_get(struct net *net, struct slick_nat_net *sn_net,
+                                       struct nat_table *t, const char *name) {
+    struct nat_iface *iface;
+    struct net_device *dev;
+    int ifindex;
+
+    iface = nat_iface_find(t, name);
+    if (iface) {
+        iface->refcnt++;
+        return iface;
+    }
+
+    iface = kzalloc(sizeof(*iface), GFP_KERNEL_ACCOUNT);
+    if (!iface)
+        return NULL;
+
+    if (rhltable_init(&iface->internal_exact, &nat_internal_exact_params))
+        goto err_free;
+    if (rhltable_init(&iface->external_exact, &nat_external_exact_params))
+        goto err_internal;
+
+    strscpy(iface->name, name, IFNAMSIZ);
+    nat_lpm_init(&iface->external_lpm, &sn_net->mapping_mutex);
+    INIT_LIST_HEAD(&iface->mappings);
+    iface->flags = NAT_IFACE_EXTERNAL;
+    iface->refcnt = 1;
+    list_add_tail(&iface->list, &t->iface_list);
+
+    /* The device may not exist yet; NETDEV_REGISTER binds it later.  The
+     * notifier also takes mapping_mutex, so it cannot slip in between this
+     * lookup and the bind. */
+    rcu_read_lock();
+    dev = dev_get_by_name_rcu(net, name);
+    ifindex = dev ? dev->ifindex : 0;
+    rcu_read_unlock();
+
+    nat_iface_set_ifindex(sn_net, t, iface, ifindex);
+    return iface;
+
+err_internal:
+    rhltable_destroy(&iface->internal_exact);
+err_free:
+    kfree(iface);
+    return NULL;
+}
+
+static void nat_iface_put(struct slick_nat_net *sn_net, struct nat_table *t,
+                          struct nat_iface *iface) {
+    if (--iface->refcnt)
+        return;
+
+    if (iface->ifindex && nat_xdp_active(sn_net, t))
+        nat_xdp_delete(sn_net->xdp_map, iface->ifindex, &in6addr_any, 0);
+    if (iface->ifindex)
+        hash_del_rcu(&iface->index_node);
+    list_del(&iface->list);
+    nat_lpm_destroy(&iface->external_lpm);
+    /* Empty by now, and never seen by readers. */
+    rhltable_destroy(&iface->internal_exact);
+    rhltable_destroy(&iface->external_exact);
+    kfree_rcu(iface, rcu);
+}
+
+/* Publish a fully initialised mapping in the selected lookup structures.
+ * Caller must hold mapping_mutex. */
+static int nat_index_add(struct nat_table *t, struct nat_mapping *mapping) {
+    int len = mapping->prefix_len;
+    int ret;
+
+    if (!nat_use_trie) {
+        ret = rhltable_insert(&t->internal_index, &mapping->internal_node, nat_internal_params);
+        if (ret)
+            return ret;
+
+        ret = rhltable_insert(&t->external_index, &mapping->external_node, nat_external_params);
+        if (ret) {
+            rhltable_remove(&t->internal_index, &mapping->internal_node, nat_internal_params);
+            return ret;
+        }
+    } else {
+        ret = nat_lpm_insert(&t->internal_lpm, &mapping->internal_prefix, len, mapping);
+        if (ret)
+            return ret;
+
+        ret = nat_lpm_insert(&mapping->iface->external_lpm, &mapping->external_prefix, len,
+                             mapping);
+        if (ret)
+            goto err_internal;
+
+        ret = nat_lpm_insert(&t->external_lpm, &mapping->external_prefix, len, mapping);
+        if (ret) {
+            nat_lpm_delete(&mapping->iface->external_lpm, &mapping->external_prefix, len,
+                           mapping);
+            goto err_internal;
+        }
+    }
+
+    /* Maintained for both engines: the XDP sync walks lengths too. */
+    WRITE_ONCE(t->prefix_len_use[len], t->prefix_len_use[len] + 1);
+    return 0;
+
+err_internal:
+    nat_lpm_delete(&t->internal_lpm, &mapping->internal_prefix, len, mapping);
+    return ret;
+}
+
+static void nat_index_del(struct nat_table *t, struct nat_mapping *mapping) {
+    int len = mapping->prefix_len;
+
+    if (!nat_use_trie) {
+        rhltable_remove(&t->internal_index, &mapping->internal_node, nat_internal_params);
+        rhltable_remove(&t->external_index, &mapping->external_node, nat_external_params);
+    } else {
+        nat_lpm_delete(&t->internal_lpm, &mapping->internal_prefix, len, mapping);
+        nat_lpm_delete(&mapping->iface->external_lpm, &mapping->external_prefix, len, mapping);
+        nat_lpm_delete(&t->external_lpm, &mapping->external_prefix, len, mapping);
+    }
+
+    WRITE_ONCE(t->prefix_len_use[len], t->prefix_len_use[len] - 1);
+}
+
+/* Add a mapping to the writer-side structures of its interface.  Readers
+ * never look at them, so unlike nat_index_add() this needs no grace period
+ * to undo. */
+static int nat_exact_add(struct nat_mapping *mapping) {
+    struct nat_iface *iface = mapping->iface;
+    int ret;
+
+    ret = rhltable_insert(&iface->internal_exact, &mapping->internal_exact_node,
+                          nat_internal_exact_params);
+    if (ret)
+        return ret;
+
+    ret = rhltable_insert(&iface->external_exact, &mapping->external_exact_node,
+                          nat_external_exact_params);
+    if (ret) {
+        rhltable_remove(&iface->internal_exact, &mapping->internal_exact_node,
+                        nat_internal_exact_params);
+        return ret;
+    }
+
+    list_add_tail(&mapping->iface_node, &iface->mappings);
+    return 0;
+}
+
+static void nat_exact_del(struct nat_mapping *mapping) {
+    struct nat_iface *iface = mapping->iface;
+
+    list_del(&mapping->iface_node);
+    rhltable_remove(&iface->internal_exact, &mapping->internal_exact_node,
+                    nat_internal_exact_params);
+    rhltable_remove(&iface->external_exact, &mapping->external_exact_node,
+                    nat_external_exact_params);
+}
+
+/* The mapping configured on iface with exactly this internal prefix, or
+ * external prefix if external.  Caller must hold mapping_mutex. */
+static struct nat_mapping *nat_exact_find(struct nat_iface *iface, const struct in6_addr *prefix,
+                                          int prefix_len, bool external) {
+    struct nat_mapping *mapping = NULL;
+    struct rhlist_head *list;
+    struct nat_hkey key;
+
+    key.prefix = *prefix;
+    key.len = prefix_len;
+    /* The lookup wants RCU; mapping_mutex keeps the result alive after. */
+    rcu_read_lock();
+    if (external) {
+        list = rhltable_lookup(&iface->external_exact, &key, nat_external_exact_params);
+        if (list)
+            mapping = container_of(list, struct nat_mapping, external_exact_node);
+    } else {
+        list = rhltable_lookup(&iface->internal_exact, &key, nat_internal_exact_params);
+        if (list)
+            mapping = container_of(list, struct nat_mapping, internal_exact_node);
+    }
+    rcu_read_unlock();
+
+    return mapping;
+}
+
+/* The mapping "del <interface> <internal_prefix/len>" names.  Caller must
+ * hold mapping_mutex. */
+static struct nat_mapping *nat_find_mapping_exact(struct nat_table *t, const char *interface,
+                                                  const struct in6_addr *internal_prefix,
+                                                  int prefix_len) {
+    struct nat_iface *iface = nat_iface_find(t, interface);
+
+    return iface ? nat_exact_find(iface, internal_prefix, prefix_len, false) : NULL;
+}
+
+static void nat_mapping_free(struct nat_mapping *mapping) {
+    if (!mapping->stats_borrowed)
+        free_percpu(mapping->stats);
+    kmem_cache_free(nat_mapping_cache, mapping);
+}
+
+static void nat_mapping_free_rcu(struct rcu_head *head) {
+    nat_mapping_free(container_of(head, struct nat_mapping, rcu));
+}
+
+/* Bind a mapping to its interface and add it to a table.  On failure the
+ * mapping is left unlinked, but a reader may have seen it in a
+ * half-built index, so it must still be freed after a grace period.
+ * Caller must hold mapping_mutex. */
+static int nat_mapping_link(struct net *net, struct slick_nat_net *sn_net, struct nat_table *t,
+                            struct nat_mapping *mapping) {
+    int ret;
+
+    mapping->iface = nat_iface_get(net, sn_net, t, mapping->interface);
+    if (!mapping->iface)
+        return -ENOMEM;
+
+    mapping->ifindex = mapping->iface->ifindex;
+
+    ret = nat_exact_add(mapping);
+    if (ret) {
+        nat_iface_put(sn_net, t, mapping->iface);
+        return ret;
+    }
+
+    /* The mapping is fully initialised before the first publish below;
+     * the _rcu primitives order those stores for lockless readers. */
+    ret = nat_index_add(t, mapping);
+    if (ret) {
+        nat_exact_del(mapping);
+        nat_iface_put(sn_net, t, mapping->iface);
+        return ret;
+    }
+
+    nat_table_changed(sn_net, t);
+    list_add_tail_rcu(&mapping->list, &t->mapping_list);
+    WRITE_ONCE(t->mapping_count, t->mapping_count + 1);
+
+    /* A single entry can only make a lookup more specific. */
+    if (nat_xdp_active(sn_net, t)) {
+        ret = nat_xdp_add_mapping(sn_net->xdp_map, mapping, NULL);
+        if (ret)
+            nat_xdp_fail(sn_net, t, ret);
+    }
+
+    return 0;
+}
+
+/* Readers may still be walking the index, so the mapping is only freed
+ * after a grace period.  Caller must hold mapping_mutex. */
+static void nat_mapping_unlink(struct slick_nat_net *sn_net, struct nat_table *t,
+                               struct nat_mapping *mapping) {
+    nat_index_del(t, mapping);
+    nat_table_changed(sn_net, t);
+    list_del_rcu(&mapping->list);
+    WRITE_ONCE(t->mapping_count, t->mapping_count - 1);
+    if (nat_xdp_active(sn_net, t))
+        nat_xdp_unlink_mapping(sn_net, t, mapping);
+    nat_exact_del(mapping);
+    nat_iface_put(sn_net, t, mapping->iface);
+    call_rcu(&mapping->rcu, nat_mapping_free_rcu);
+}
+
+/* A new, unlinked mapping with its counters.  Freed with nat_mapping_free()
+ * until nat_mapping_link() succeeds. */
+static struct nat_mapping *nat_mapping_alloc(const char *interface,
+                                             const struct in6_addr *internal_prefix,
+                                             const struct in6_addr *external_prefix,
+                                             int prefix_len, bool nptv6) {
+    struct nat_mapping *mapping;
+
+    mapping = kmem_cache_zalloc(nat_mapping_cache, GFP_KERNEL_ACCOUNT);
+    if (!mapping)
+        return NULL;
+
+    mapping->stats = alloc_percpu_gfp(struct nat_mapping_stats, GFP_KERNEL_ACCOUNT);
+    if (!mapping->stats) {
+        kmem_cache_free(nat_mapping_cache, mapping);
         return NULL;
+    }
+
+    strscpy(mapping->interface, interface, IFNAMSIZ);
+    mapping->internal_prefix = *internal_prefix;
+    mapping->external_prefix = *external_prefix;
+    mapping->prefix_len = prefix_len;
+    nat_prefix_mask(mapping->prefix_mask, prefix_len);
+    mapping->csum_delta = nat_csum_delta(internal_prefix, external_prefix, prefix_len);
+    mapping->nptv6 = nptv6;
+
+    return mapping;
+}
+
+static int add_mapping_internal_unlocked(struct net *net, struct nat_table *t, const char *interface,
+                                        const struct in6_addr *internal_prefix, int internal_prefix_len,
+                                        const struct in6_addr *external_prefix, int external_prefix_len,
+                                        bool nptv6) {
+    struct slick_nat_net *sn_net = slick_nat_pernet(net);
+    struct nat_mapping *mapping;
+    struct nat_iface *iface;
+    int ret;
+
+    lockdep_assert_held(&sn_net->mapping_mutex);
+
+    // Both prefixes must have the same length
+    if (internal_prefix_len != external_prefix_len)
+        return -EINVAL;
+
+    // NPTv6 needs a word outside the prefix to adjust (RFC 6296 3.4, 3.5)
+    if (nptv6 && internal_prefix_len > 64)
+        return -EINVAL;
+
+    if (t->mapping_count >= READ_ONCE(sn_net->max_mappings))
+        return -ENOSPC;
+
+    // Reject duplicates on either side - two mappings claiming the same
+    // prefix on the same interface would make lookups ambiguous.
+    iface = nat_iface_find(t, interface);
+    if (iface && (nat_exact_find(iface, internal_prefix, internal_prefix_len, false) ||
+                  nat_exact_find(iface, external_prefix, internal_prefix_len, true)))
+        return -EEXIST;
+
+    mapping = nat_mapping_alloc(interface, internal_prefix, external_prefix,
+                                internal_prefix_len, nptv6);
+    if (!mapping)
+        return -ENOMEM;
+
+    ret = nat_mapping_link(net, sn_net, t, mapping);
+    if (ret)
+        call_rcu(&mapping->rcu, nat_mapping_free_rcu);
+
+    return ret;
+}
+
+static int del_mapping_internal_unlocked(struct net *net, struct nat_table *t, const char *interface,
+                                        const struct in6_addr *internal_prefix, int internal_prefix_len) {
+    struct slick_nat_net *sn_net = slick_nat_pernet(net);
+    struct nat_mapping *mapping;
+
+    lockdep_assert_held(&sn_net->mapping_mutex);
+
+    mapping = nat_find_mapping_exact(t, interface, internal_prefix, internal_prefix_len);
+    if (!mapping)
+        return -ENOENT;
+
+    nat_mapping_unlink(sn_net, t, mapping);
+    return 0;
+}
+
+static int drop_mappings_internal_unlocked(struct net *net, struct nat_table *t,
+                                           const char *interface) {
+    struct slick_nat_net *sn_net = slick_nat_pernet(net);
+    struct nat_mapping *mapping, *tmp;
+    struct nat_iface *iface;
+    int dropped = 0;
+
+    lockdep_assert_held(&sn_net->mapping_mutex);
+
+    if (!interface) {
+        list_for_each_entry_safe(mapping, tmp, &t->mapping_list, list) {
+            nat_mapping_unlink(sn_net, t, mapping);
+            dropped++;
+        }
+        return dropped;
+    }
+
+    // Only that interface's mappings.  Hold the entry, so the last unlink
+    // does not free it under the walk.
+    iface = nat_iface_find(t, interface);
+    if (!iface)
+        return 0;
+
+    iface->refcnt++;
+    list_for_each_entry_safe(mapping, tmp, &iface->mappings, iface_node) {
+        nat_mapping_unlink(sn_net, t, mapping);
+        dropped++;
+    }
+    nat_iface_put(sn_net, t, iface);
+
+    return dropped;
+}
+
+static struct nat_internal_if *nat_find_internal_if(struct nat_table *t, const char *name) {
+    struct nat_internal_if *in;
+
+    list_for_each_entry(in, &t->internal_list, list) {
+        if (strncmp(in->name, name, IFNAMSIZ) == 0)
+            return in;
+    }
+
+    return NULL;
+}
+
+/* Declare an interface internal.  Only hook_mode=ingress acts on it. */
+static int nat_internal_if_add(struct nat_table *t, const char *name) {
+    struct nat_internal_if *in;
+
+    if (nat_find_internal_if(t, name))
+        return -EEXIST;
+
+    in = kzalloc(sizeof(*in), GFP_KERNEL_ACCOUNT);
+    if (!in)
+        return -ENOMEM;
+
+    strscpy(in->name, name, IFNAMSIZ);
+    list_add_tail_rcu(&in->list, &t->internal_list);
+    return 0;
+}
+
+static int nat_internal_if_del(struct slick_nat_net *sn_net, struct nat_table *t,
+                               const char *name) {
+    struct nat_internal_if *in;
+
+    in = nat_find_internal_if(t, name);
+    if (!in)
+        return -ENOENT;
+
+    /* Invalidates dump cursors that may point at the entry. */
+    nat_table_changed(sn_net, t);
+    list_del_rcu(&in->list);
+    kfree_rcu(in, rcu);
+    return 0;
+}
+
+/* lock: the mapping_mutex its writers hold, NULL for nat_empty_table. */
+static struct nat_table *nat_table_alloc(struct mutex *lock) {
+    struct nat_table *t;
+
+    t = kzalloc(sizeof(*t), GFP_KERNEL_ACCOUNT);
+    if (!t)
+        return NULL;
+
+    if (rhltable_init(&t->internal_index, &nat_internal_params))
+        goto err_free;
+    if (rhltable_init(&t->external_index, &nat_external_params))
+        goto err_destroy_internal;
+
+    INIT_LIST_HEAD(&t->mapping_list);
+    INIT_LIST_HEAD(&t->iface_list);
+    hash_init(t->iface_index);
+    INIT_LIST_HEAD(&t->internal_list);
+    nat_lpm_init(&t->internal_lpm, lock);
+    nat_lpm_init(&t->external_lpm, lock);
+    /* prefix_len_use starts out zeroed. */
+
+    return t;
+
+err_destroy_internal:
+    rhltable_destroy(&t->internal_index);
+err_free:
+    kfree(t);
+    return NULL;
+}
+
+/* Free a table no reader can reach any more: never published, or
+ * unpublished at least one grace period ago. */
+static void nat_table_free(struct nat_table *t) {
+    struct nat_mapping *mapping, *tmp;
+    struct nat_iface *iface, *itmp;
+    struct nat_internal_if *in, *intmp;
+
+    /* First, so that a resize still queued for the indexes is cancelled
+     * before it can move entries we are about to free. */
+    rhltable_destroy(&t->external_index);
+    rhltable_destroy(&t->internal_index);
+    list_for_each_entry(iface, &t->iface_list, list) {
+        rhltable_destroy(&iface->external_exact);
+        rhltable_destroy(&iface->internal_exact);
+    }
+
+    list_for_each_entry_safe(mapping, tmp, &t->mapping_list, list)
+        nat_mapping_free(mapping);
+
+    list_for_each_entry_safe(iface, itmp, &t->iface_list, list) {
+        nat_lpm_destroy(&iface->external_lpm);
+        kfree(iface);
+    }
+
+    list_for_each_entry_safe(in, intmp, &t->internal_list, list)
+        kfree(in);
+
+    nat_lpm_destroy(&t->internal_lpm);
+    nat_lpm_destroy(&t->external_lpm);
+    kfree(t);
+}
+
+/* Build a private copy of a table for a batch to edit.  The copies share
+ * their counters with the originals, so a batch that keeps a mapping
+ * keeps its statistics.  Caller must hold mapping_mutex. */
+static struct nat_table *nat_table_clone(struct net *net, struct slick_nat_net *sn_net,
+                                         struct nat_table *src) {
+    struct nat_mapping *mapping, *copy;
+    struct nat_internal_if *in;
+    struct nat_table *t;
+
+    t = nat_table_alloc(&sn_net->mapping_mutex);
+    if (!t)
+        return NULL;
+
+    list_for_each_entry(mapping, &src->mapping_list, list) {
+        copy = kmem_cache_alloc(nat_mapping_cache, GFP_KERNEL_ACCOUNT);
+        if (!copy)
+            goto fail;
+
+        *copy = *mapping;
+        copy->stats_borrowed = true;
+        copy->origin = mapping;
+        if (nat_mapping_link(net, sn_net, t, copy)) {
+            kmem_cache_free(nat_mapping_cache, copy);
+            goto fail;
+        }
+        cond_resched();
+    }
+
+    list_for_each_entry(in, &src->internal_list, list) {
+        if (nat_internal_if_add(t, in->name))
+            goto fail;
+    }
+
+    return t;
+
+fail:
+    nat_table_free(t);
+    return NULL;
+}
+
+/* Publish a table built by nat_table_clone() and hand back the one it
+ * replaces.  The caller frees that after a grace period, which it can wait
+ * for once mapping_mutex is dropped.  Caller must hold mapping_mutex. */
+static struct nat_table *nat_table_commit(struct slick_nat_net *sn_net, struct nat_table *t) {
+    struct nat_table *old = nat_table_locked(sn_net);
+    struct nat_mapping *mapping;
+    int ret;
+
+    /* Counters of the mappings that survived move to the new copies. */
+    list_for_each_entry(mapping, &t->mapping_list, list) {
+        if (!mapping->origin)
+            continue;
+        mapping->origin->stats_borrowed = true;
+        mapping->stats_borrowed = false;
+        mapping->origin = NULL;
+    }
+
+    /* The XDP map cannot be swapped in one step.  Empty it first, so the
+     * program hands everything to the hook (which already sees the new
+     * table) until the new entries are in. */
+    if (sn_net->xdp_map && !sn_net->xdp_err)
+        nat_xdp_sync_table(sn_net->xdp_map, old, NULL, false);
+
+    rcu_assign_pointer(sn_net->table, t);
+    nat_table_changed(sn_net, t);
+
+    if (sn_net->xdp_map && !sn_net->xdp_err) {
+        ret = nat_xdp_sync_table(sn_net->xdp_map, t, NULL, true);
+        if (ret)
+            nat_xdp_fail(sn_net, t, ret);
+    }
+
+    return old == nat_empty_table ? NULL : old;
+}
+
+/* Allocate what the packet path needs besides the table, the first time
+ * the namespace is configured.  Kept until the namespace goes away, so the
+ * counters survive it being emptied.  Caller must hold mapping_mutex. */
+static int nat_net_prepare(struct slick_nat_net *sn_net) {
+    struct nat_pcpu_stats __percpu *stats;
+    struct nat_ndp_buckets *buckets;
+
+    if (sn_net->stats)
+        return 0;
+
+    buckets = kmalloc(sizeof(*buckets), GFP_KERNEL);
+    stats = alloc_percpu(struct nat_pcpu_stats);
+    if (!buckets || !stats) {
+        kfree(buckets);
+        free_percpu(stats);
+        return -ENOMEM;
+    }
+
+    spin_lock_init(&buckets->lock);
+    hash_init(buckets->index);
+
+    sn_net->ndp_buckets = buckets;
+    /* The proc readers look at stats without the mutex. */
+    smp_store_release(&sn_net->stats, stats);
+    return 0;
+}
+
+/* Replace the shared empty table with one the namespace can edit.  Caller
+ * must hold mapping_mutex. */
+static struct nat_table *nat_net_activate(struct slick_nat_net *sn_net) {
+    struct nat_table *t;
+    int ret;
+
+    ret = nat_net_prepare(sn_net);
+    if (ret)
+        return ERR_PTR(ret);
+
+    t = nat_table_alloc(&sn_net->mapping_mutex);
+    if (!t)
+        return ERR_PTR(-ENOMEM);
+
+    rcu_assign_pointer(sn_net->table, t);
+    nat_table_changed(sn_net, t);
+    return t;
+}
+
+/*
+ * Bring hooks and table in line with the configuration after a change:
+ * hooks only while there are mappings, a table of its own only while
+ * anything at all is configured.  *idle is set to a table to free after a
+ * grace period, which the caller waits for once mapping_mutex is dropped,
+ * or NULL.  Returns 0, or the error of a hook that could not be put in
+ * place; the configuration stays applied either way and the next change
+ * retries.  Caller must hold mapping_mutex.
+ */
+static int nat_net_sync(struct net *net, struct slick_nat_net *sn_net, struct nat_table **idle) {
+    struct nat_table *t = nat_table_locked(sn_net);
+    bool want = t->mapping_count != 0;
+    int ret = 0;
+
+    sn_net->config_seq++;
+    *idle = NULL;
+
+    if (nat_hook_ingress) {
+        ret = nat_dev_hooks_sync(net, sn_net);
+    } else if (want && !sn_net->hook_registered) {
+        ret = nf_register_net_hook(net, &nat_nf_hook_ops);
+        if (ret)
+            pr_warn("Slick NAT: Failed to register PRE_ROUTING hook (%d)\n", ret);
+        else
+            sn_net->hook_registered = true;
+    } else if (!want && sn_net->hook_registered) {
+        /* Packets already in the hook may still be running; the table they
+         * look at is only freed after the grace period the caller waits
+         * for, and nothing else of the namespace goes away here. */
+        nf_unregister_net_hook(net, &nat_nf_hook_ops);
+        sn_net->hook_registered = false;
+    }
+
+    if (t == nat_empty_table || t->mapping_count || !list_empty(&t->internal_list))
+        return ret;
+
+    /* With no mappings there are no interface entries either, so the XDP
+     * map holds nothing of this table. */
+    rcu_assign_pointer(sn_net->table, nat_empty_table);
+    nat_table_changed(sn_net, nat_empty_table);
+    *idle = t;
+    return ret;
+}
+
+/* Free what nat_net_sync() or nat_table_commit() handed back.  Caller must
+ * not hold mapping_mutex. */
+static void nat_table_retire(struct nat_table *t) {
+    if (!t)
+        return;
+
+    synchronize_rcu();
+    nat_table_free(t);
+}
+
+/* Pull the next whitespace-delimited token out of *s, NUL-terminating it. */
+static char *nat_next_token(char **s) {
+    char *tok;
+
+    if (!*s)
+        return NULL;
+
+    while (**s == ' ' || **s == '\t')
+        (*s)++;
+
+    if (**s == '\0')
+        return NULL;
+
+    tok = *s;
+    while (**s && **s != ' ' && **s != '\t')
+        (*s)++;
+
+    if (**s) {
+        **s = '\0';
+        (*s)++;
+    }
+
+    return tok;
+}
+
+enum nat_cmd_op {
+    NAT_CMD_ADD,
+    NAT_CMD_DEL,
+    NAT_CMD_DROP,
+    NAT_CMD_INTERNAL,
+    NAT_CMD_NOINTERNAL,
+};
+
+/* A parsed configuration line.  Parsing needs no lock at all; only applying
+ * the result does. */
+struct nat_cmd {
+    enum nat_cmd_op op;
+    char interface[IFNAMSIZ];
+    bool all;
+    struct in6_addr internal_prefix;
+    struct in6_addr external_prefix;
+    int internal_prefix_len;
+    int external_prefix_len;
+    bool nptv6;
+};
+
+/*
+ * Parse a single configuration line.  The line buffer is modified in place.
+ * Returns 0 on success, -EAGAIN for a blank line or comment, or a negative
+ * errno for a malformed line.
+ */
+static int nat_parse_line(char *line, struct nat_cmd *cmd) {
+    char *op, *interface, *arg1, *arg2, *mode;
+
+    op = nat_next_token(&line);
+    if (!op || op[0] == '#')
+        return -EAGAIN;
+
+    interface = nat_next_token(&line);
+    if (!interface || interface[0] == '\0')
+        return -EINVAL;
+
+    memset(cmd, 0, sizeof(*cmd));
+
+    if (strcmp(op, "drop") == 0 && strcmp(interface, "--all") == 0) {
+        cmd->op = NAT_CMD_DROP;
+        cmd->all = true;
+        return 0;
+    }
+
+    if (strscpy(cmd->interface, interface, IFNAMSIZ) < 0)
+        return -EINVAL;
+
+    if (strcmp(op, "add") == 0) {
+        arg1 = nat_next_token(&line);
+        arg2 = nat_next_token(&line);
+        if (!arg1 || !arg2)
+            return -EINVAL;
+
+        if (parse_ipv6_prefix(arg1, &cmd->internal_prefix, &cmd->internal_prefix_len) < 0 ||
+            parse_ipv6_prefix(arg2, &cmd->external_prefix, &cmd->external_prefix_len) < 0)
+            return -EINVAL;
+
+        mode = nat_next_token(&line);
+        if (mode) {
+            if (strcmp(mode, "nptv6") != 0)
+                return -EINVAL;
+            cmd->nptv6 = true;
+        }
+
+        cmd->op = NAT_CMD_ADD;
+        return 0;
+    }
+
+    if (strcmp(op, "del") == 0) {
+        arg1 = nat_next_token(&line);
+        if (!arg1)
+            return -EINVAL;
+
+        if (parse_ipv6_prefix(arg1, &cmd->internal_prefix, &cmd->internal_prefix_len) < 0)
+            return -EINVAL;
+
+        cmd->op = NAT_CMD_DEL;
+        return 0;
+    }
+
+    if (strcmp(op, "drop") == 0) {
+        cmd->op = NAT_CMD_DROP;
+        return 0;
+    }
+
+    if (strcmp(op, "internal") == 0) {
+        cmd->op = NAT_CMD_INTERNAL;
+        return 0;
+    }
+
+    if (strcmp(op, "nointernal") == 0) {
+        cmd->op = NAT_CMD_NOINTERNAL;
+        return 0;
+    }
+
+    return -EINVAL;
+}
+
+/*
+ * Apply a parsed command.  Returns a negative errno on failure, the number of
+ * dropped mappings for "drop", 0 otherwise.  Caller must hold mapping_mutex.
+ */
+static int nat_apply_cmd_locked(struct net *net, struct nat_table *t, const struct nat_cmd *cmd) {
+    switch (cmd->op) {
+    case NAT_CMD_ADD:
+        return add_mapping_internal_unlocked(net, t, cmd->interface,
+                                             &cmd->internal_prefix, cmd->internal_prefix_len,
+                                             &cmd->external_prefix, cmd->external_prefix_len,
+                                             cmd->nptv6);
+    case NAT_CMD_DEL:
+        return del_mapping_internal_unlocked(net, t, cmd->interface,
+                                             &cmd->internal_prefix, cmd->internal_prefix_len);
+    case NAT_CMD_DROP:
+        return drop_mappings_internal_unlocked(net, t, cmd->all ? NULL : cmd->interface);
+    case NAT_CMD_INTERNAL:
+        return nat_internal_if_add(t, cmd->interface);
+    case NAT_CMD_NOINTERNAL:
+        return nat_internal_if_del(slick_nat_pernet(net), t, cmd->interface);
+    }
+
+    return -EINVAL;
+}
+
+/* Apply a command to the published table.  Only commands that add
+ * something need a table of their own; the rest find nothing in the
+ * shared empty one.  Caller must hold mapping_mutex and call
+ * nat_net_sync() afterwards. */
+static int nat_apply_cmd_live(struct net *net, struct slick_nat_net *sn_net,
+                              const struct nat_cmd *cmd) {
+    struct nat_table *t = nat_table_locked(sn_net);
+
+    if (t == nat_empty_table && (cmd->op == NAT_CMD_ADD || cmd->op == NAT_CMD_INTERNAL)) {
+        t = nat_net_activate(sn_net);
+        if (IS_ERR(t))
+            return PTR_ERR(t);
+    }
+
+    return nat_apply_cmd_locked(net, t, cmd);
+}
+
+static int nat_exec_line(struct net *net, char *line) {
+    struct slick_nat_net *sn_net = slick_nat_pernet(net);
+    struct nat_table *old;
+    struct nat_cmd cmd;
+    int ret, err;
+
+    ret = nat_parse_line(line, &cmd);
+    if (ret < 0)
+        return ret;
+
+    mutex_lock(&sn_net->mapping_mutex);
+    ret = nat_apply_cmd_live(net, sn_net, &cmd);
+    err = nat_net_sync(net, sn_net, &old);
+    mutex_unlock(&sn_net->mapping_mutex);
+
+    nat_table_retire(old);
+    /* The change itself went in; still tell the writer it is not live. */
+    if (ret >= 0 && err)
+        ret = err;
+    return ret;
+}
+
+/* At most this many failed lines are listed in the batch result. */
+#define SLICK_NAT_BATCH_ERRORS_MAX 128
+
+struct nat_batch_err {
+    u64 line;
+    int err;
+};
+
+/*
+ * One open slick_nat_batch file.  Everything written to it is one batch:
+ * lines are applied as they arrive, SLICK_NAT_BATCH_CHUNK bytes per
+ * mapping_mutex hold, to a private copy of the table, and the copy is
+ * published when the file is read or closed.  A line split across writes
+ * waits at the start of buf for its end.
+ */
+struct nat_batch {
+    struct net *net;
+    struct mutex lock;              /* the file's writers and reader */
+    char *buf;                      /* SLICK_NAT_LINE_MAX + SLICK_NAT_BATCH_CHUNK */
+    size_t partial;                 /* unfinished line at the start of buf */
+    bool overlong;                  /* skipping to the end of a line that is too long */
+    struct nat_table *t;            /* the copy, NULL until the first command */
+    u64 config_seq;                 /* sn_net->config_seq when it was taken */
+    u64 lines;                      /* complete lines seen */
+    u64 processed;
+    u64 errors;
+    struct nat_batch_err errs[SLICK_NAT_BATCH_ERRORS_MAX];
+    unsigned int nerrs;
+    int result;                     /* why it was abandoned, or why the hook for
+                                     * the published mappings failed, or 0 */
+    bool done;                      /* published or abandoned */
+    bool abandoned;                 /* refuses further writes */
+};
+
+static void nat_batch_error(struct nat_batch *b, u64 line, int err) {
+    b->errors++;
+    if (b->nerrs < ARRAY_SIZE(b->errs)) {
+        b->errs[b->nerrs].line = line;
+        b->errs[b->nerrs].err = err;
+        b->nerrs++;
+    }
+}
+
+/* Drop the copy and refuse further writes.  The copy was never published,
+ * so it can go straight away. */
+static void nat_batch_abandon(struct nat_batch *b, int err) {
+    if (b->t)
+        nat_table_free(b->t);
+    b->t = NULL;
+    b->result = err;
+    b->done = true;
+    b->abandoned = true;
+    pr_warn("Slick NAT: Batch abandoned after %llu lines (%d)\n", b->lines, err);
+}
+
+/* Apply one complete line.  Caller must hold mapping_mutex. */
+static void nat_batch_line(struct nat_batch *b, struct slick_nat_net *sn_net, char *line) {
+    struct nat_cmd cmd;
+    int ret;
+
+    b->lines++;
+
+    ret = nat_parse_line(line, &cmd);
+    if (ret == -EAGAIN)
+        return;                     /* blank line or comment */
+
+    if (ret == 0 && !b->t) {
+        ret = nat_net_prepare(sn_net);
+        if (!ret) {
+            b->t = nat_table_clone(b->net, sn_net, nat_table_locked(sn_net));
+            b->config_seq = sn_net->config_seq;
+        }
+        if (ret || !b->t) {
+            nat_batch_abandon(b, -ENOMEM);
+            return;
+        }
+    }
+
+    if (ret == 0)
+        ret = nat_apply_cmd_locked(b->net, b->t, &cmd);
+
+    if (ret < 0)
+        nat_batch_error(b, b->lines, ret);
+    else
+        b->processed += (ret > 0) ? ret : 1;
+}
+
+/* Apply the complete lines in buf[0, len) and keep what follows the last
+ * newline for the next write.  Caller must hold mapping_mutex. */
+static void nat_batch_chunk(struct nat_batch *b, struct slick_nat_net *sn_net, size_t len) {
+    char *line = b->buf, *end = b->buf + len, *nl;
+
+    /* The copy is only good while nobody else changed the configuration
+     * it was taken from. */
+    if (b->t && b->config_seq != sn_net->config_seq) {
+        nat_batch_abandon(b, -EBUSY);
+        return;
+    }
+
+    while ((nl = memchr(line, '\n', end - line))) {
+        *nl = '\0';
+        if (b->overlong) {
+            /* Reported when it was found. */
+            b->overlong = false;
+            b->lines++;
+        } else if (nl - line >= SLICK_NAT_LINE_MAX) {
+            b->lines++;
+            nat_batch_error(b, b->lines, -E2BIG);
+        } else {
+            nat_batch_line(b, sn_net, line);
+            if (b->done)
+                return;
+        }
+        line = nl + 1;
+        cond_resched();
+    }
+
+    b->partial = end - line;
+    if (b->overlong) {
+        b->partial = 0;
+    } else if (b->partial >= SLICK_NAT_LINE_MAX) {
+        nat_batch_error(b, b->lines + 1, -E2BIG);
+        b->overlong = true;
+        b->partial = 0;
+    } else {
+        memmove(b->buf, line, b->partial);
+    }
+}
+
+/* Bring the interface bindings of the copy up to date.  The netdevice
+ * notifier only follows the published table, and the copy may have been
+ * taken several writes ago.  Caller must hold mapping_mutex. */
+static void nat_batch_rebind(struct nat_batch *b, struct slick_nat_net *sn_net) {
+    struct net_device *dev;
+    struct nat_iface *iface;
+    int ifindex;
+
+    list_for_each_entry(iface, &b->t->iface_list, list) {
+        rcu_read_lock();
+        dev = dev_get_by_name_rcu(b->net, iface->name);
+        ifindex = dev ? dev->ifindex : 0;
+        rcu_read_unlock();
+
+        nat_iface_set_ifindex(sn_net, b->t, iface, ifindex);
+    }
+}
+
+/* Apply an unterminated last line and publish the copy.  Returns 0, or
+ * the error of a hook that could not be put in place for the published
+ * mappings, which is also left in b->result.  Caller must hold b->lock. */
+static int nat_batch_finish(struct nat_batch *b) {
+    struct slick_nat_net *sn_net = slick_nat_pernet(b->net);
+    struct nat_table *old = NULL, *idle = NULL;
+    int ret = 0;
+
+    if (b->done)
+        return 0;
+
+    mutex_lock(&sn_net->mapping_mutex);
+
+    /* A line too long to keep was reported when it was found; the end of
+     * the batch ends it. */
+    if (b->overlong)
+        b->lines++;
+
+    if (b->partial) {
+        b->buf[b->partial] = '\n';
+        nat_batch_chunk(b, sn_net, b->partial + 1);
+    } else if (b->t && b->config_seq != sn_net->config_seq) {
+        nat_batch_abandon(b, -EBUSY);
+    }
+
+    if (!b->done) {
+        if (b->processed) {
+            nat_batch_rebind(b, sn_net);
+            old = nat_table_commit(sn_net, b->t);
+            /* The batch may have emptied the namespace. */
+            ret = nat_net_sync(b->net, sn_net, &idle);
+            if (ret)
+                b->result = ret;
+        } else if (b->t) {
+            /* Nothing changed; the copy was never visible to anyone. */
+            nat_table_free(b->t);
+        }
+        b->t = NULL;
+        b->done = true;
+    }
+    /* Nothing of this batch's input carries over into the next one. */
+    b->partial = 0;
+    b->overlong = false;
+
+    mutex_unlock(&sn_net->mapping_mutex);
+
+    if (old || idle) {
+        synchronize_rcu();
+        if (old)
+            nat_table_free(old);
+        if (idle)
+            nat_table_free(idle);
+    }
+
+    if (b->lines)
+        pr_info("Slick NAT: Batch operation completed - lines: %llu, processed: %llu, errors: %llu\n",
+                b->lines, b->processed, b->errors);
+    return ret;
+}
+
+static ssize_t batch_write(struct file *file, const char __user *buffer, size_t count, loff_t *pos) {
+    struct nat_batch *b = ((struct seq_file *)file->private_data)->private;
+    struct slick_nat_net *sn_net = slick_nat_pernet(b->net);
+    size_t written = 0, n;
+    ssize_t ret = 0;
+
+    if (count == 0)
+        return -EINVAL;
+
+    mutex_lock(&b->lock);
+
+    if (b->done) {
+        /* An abandoned batch stays failed; after a read, start over, even
+         * if the hook for the last one could not be registered. */
+        if (b->abandoned) {
+            ret = b->result;
+            goto out;
+        }
+        b->result = 0;
+        b->lines = b->processed = b->errors = 0;
+        b->nerrs = 0;
+        b->partial = 0;
+        b->overlong = false;
+        b->done = false;
+    }
+
+    if (!b->buf) {
+        b->buf = kvmalloc(SLICK_NAT_LINE_MAX + SLICK_NAT_BATCH_CHUNK, GFP_KERNEL);
+        if (!b->buf) {
+            ret = -ENOMEM;
+            goto out;
+        }
+    }
+
+    while (written < count && !b->done) {
+        n = min_t(size_t, count - written, SLICK_NAT_BATCH_CHUNK);
+        if (copy_from_user(b->buf + b->partial, buffer + written, n)) {
+            ret = -EFAULT;
+            break;
+        }
+
+        /* Held for one chunk at a time, so other writers and the netdevice
+         * notifier get in between. */
+        mutex_lock(&sn_net->mapping_mutex);
+        nat_batch_chunk(b, sn_net, b->partial + n);
+        mutex_unlock(&sn_net->mapping_mutex);
+
+        written += n;
+        cond_resched();
+    }
+
+    if (b->abandoned && !written)
+        ret = b->result;
+
+out:
+    mutex_unlock(&b->lock);
+    return written ? written : ret;
+}
+
+static int batch_show(struct seq_file *m, void *v) {
+    struct nat_batch *b = m->private;
+    unsigned int i;
+
+    mutex_lock(&b->lock);
+    if (b->lines || b->result) {
+        seq_printf(m, "# Slick NAT Batch Result\n");
+        seq_printf(m, "# Failed lines (first %u): line <number> <errno>\n",
+                   SLICK_NAT_BATCH_ERRORS_MAX);
+        seq_printf(m, "lines %llu\n", b->lines);
+        seq_printf(m, "processed %llu\n", b->processed);
+        seq_printf(m, "errors %llu\n", b->errors);
+        seq_printf(m, "result %d\n", b->result);
+        for (i = 0; i < b->nerrs; i++)
+            seq_printf(m, "line %llu %d\n", b->errs[i].line, b->errs[i].err);
+        mutex_unlock(&b->lock);
+        return 0;
+    }
+    mutex_unlock(&b->lock);
+
+    seq_printf(m, "# Slick NAT Batch Interface\n");
+    seq_printf(m, "# Write batch operations to this file\n");
+    seq_printf(m, "# Format (one per line):\n");
+    seq_printf(m, "#   add <interface> <internal_prefix/len> <external_prefix/len> [nptv6]\n");
+    seq_printf(m, "#   del <interface> <internal_prefix/len>\n");
+    seq_printf(m, "#   drop <interface>    - Drop all mappings for interface\n");
+    seq_printf(m, "#   drop --all         - Drop all mappings\n");
+    seq_printf(m, "#   internal <interface>   - Hook an internal interface (hook_mode=ingress)\n");
+    seq_printf(m, "#   nointernal <interface>\n");
+    seq_printf(m, "# Lines starting with # are ignored\n");
+    seq_printf(m, "# Everything written to one open file is one batch, applied when the\n");
+    seq_printf(m, "# file is read or closed; reading it back shows the result\n");
+    return 0;
+}
+
+static int batch_open(struct inode *inode, struct file *file) {
+    struct nat_batch *b;
+    int ret;
+
+    b = kzalloc(sizeof(*b), GFP_KERNEL);
+    if (!b)
+        return -ENOMEM;
+
+    b->net = pde_data(inode);
+    mutex_init(&b->lock);
+
+    ret = single_open(file, batch_show, b);
+    if (ret)
+        kfree(b);
+    return ret;
+}
+
+/* Reading ends the batch: what was written so far is published first, so
+ * the result is complete. */
+static ssize_t batch_read(struct file *file, char __user *buf, size_t size, loff_t *ppos) {
+    struct nat_batch *b = ((struct seq_file *)file->private_data)->private;
+    int ret;
+
+    mutex_lock(&b->lock);
+    ret = nat_batch_finish(b);
+    mutex_unlock(&b->lock);
+
+    /* Only the read that published the batch fails; later ones show the
+     * result. */
+    if (ret)
+        return ret;
+
+    return seq_read(file, buf, size, ppos);
+}
+
+static int batch_release(struct inode *inode, struct file *file) {
+    struct nat_batch *b = ((struct seq_file *)file->private_data)->private;
+    int ret = 0;
+
+    /* When the namespace is being torn down, proc releases its open files
+     * with the namespace already dead; the batch is dropped then. */
+    if (maybe_get_net(b->net)) {
+        mutex_lock(&b->lock);
+        ret = nat_batch_finish(b);
+        mutex_unlock(&b->lock);
+        put_net(b->net);
+    }
+
+    if (b->t)
+        nat_table_free(b->t);
+    kvfree(b->buf);
+    kfree(b);
+    single_release(inode, file);
+    return ret;
+}
+
+static const struct proc_ops batch_proc_ops = {
+    .proc_open = batch_open,
+    .proc_read = batch_read,
+    .proc_write = batch_write,
+    .proc_lseek = seq_lseek,
+    .proc_release = batch_release,
+};
+
+static ssize_t mapping_write(struct file *file, const char __user *buffer, size_t count, loff_t *pos) {
+    struct net *net = pde_data(file_inode(file));
+    char buf[SLICK_NAT_LINE_MAX];
+    char *newline;
+    int ret;
+
+    if (count == 0 || count >= sizeof(buf))
+        return -EINVAL;
+
+    if (copy_from_user(buf, buffer, count))
+        return -EFAULT;
+
+    buf[count] = '\0';
+
+    newline = strchr(buf, '\n');
+    if (newline)
+        *newline = '\0';
+
+    ret = nat_exec_line(net, buf);
+    if (ret == -EAGAIN)
+        return count;
+    if (ret < 0)
+        return ret;
+
+    return count;
+}
+
+static const struct proc_ops mapping_proc_ops = {
+    .proc_open = mapping_open,
+    .proc_read = seq_read,
+    .proc_write = mapping_write,
+    .proc_lseek = seq_lseek,
+    .proc_release = seq_release_private,
+};
+
+/* Sums every CPU's counters; the struct is an array of u64 in all but
+ * name.  All zero for a namespace that was never configured. */
+static void nat_stats_sum(struct slick_nat_net *sn_net, struct nat_pcpu_stats *sum) {
+    struct nat_pcpu_stats __percpu *stats = smp_load_acquire(&sn_net->stats);
+    u64 *dst = (u64 *)sum;
+    const u64 *src;
+    size_t i;
+    int cpu;
+
+    BUILD_BUG_ON(sizeof(*sum) % sizeof(u64));
+
+    memset(sum, 0, sizeof(*sum));
+    if (!stats)
+        return;
+
+    for_each_possible_cpu(cpu) {
+        src = (const u64 *)per_cpu_ptr(stats, cpu);
+        for (i = 0; i < sizeof(*sum) / sizeof(u64); i++)
+            dst[i] += READ_ONCE(src[i]);
+    }
+}
+
+static int stats_show(struct seq_file *m, void *v) {
+    struct net *net = m->private;
+    struct slick_nat_net *sn_net = slick_nat_pernet(net);
+    struct nat_pcpu_stats sum;
+    unsigned int lengths = 0;
+    struct nat_table *t;
+    int len;
+
+    nat_stats_sum(sn_net, &sum);
+
+    seq_printf(m, "lookup_engine %s\n", lookup_engine);
+    seq_printf(m, "max_mappings %u\n", READ_ONCE(sn_net->max_mappings));
+
+    rcu_read_lock();
+    t = rcu_dereference(sn_net->table);
+    seq_printf(m, "mappings %u\n", READ_ONCE(t->mapping_count));
+    if (!nat_use_trie) {
+        /* Probes per lookup, and the bucket counts the entries spread over:
+         * mappings / buckets is the mean chain length. */
+        for (len = 0; len <= 128; len++)
+            lengths += READ_ONCE(t->prefix_len_use[len]) != 0;
+        seq_printf(m, "prefix_lengths %u\n", lengths);
+        seq_printf(m, "internal_index_buckets %u\n",
+                   rht_dereference_rcu(t->internal_index.ht.tbl, &t->internal_index.ht)->size);
+        seq_printf(m, "external_index_buckets %u\n",
+                   rht_dereference_rcu(t->external_index.ht.tbl, &t->external_index.ht)->size);
+    }
+    rcu_read_unlock();
+
+    seq_printf(m, "xlate_cache_entries %u\n", xlate_cache_bits ? 1u << xlate_cache_bits : 0);
+    seq_printf(m, "xlate_cache_hits %llu\n", sum.xcache_hits);
+    seq_printf(m, "xlate_cache_misses %llu\n", sum.xcache_misses);
+    seq_printf(m, "ndp_rate %u\n", READ_ONCE(sn_net->ndp_rate));
+    seq_printf(m, "ndp_burst %u\n", READ_ONCE(sn_net->ndp_burst));
+    seq_printf(m, "ndp_suppress_ms %u\n", READ_ONCE(sn_net->ndp_suppress_ms));
+    seq_printf(m, "ndp_answered %llu\n", sum.ndp_answered);
+    seq_printf(m, "ndp_suppressed %llu\n", sum.ndp_suppressed);
+    seq_printf(m, "ndp_ratelimited %llu\n", sum.ndp_ratelimited);
+    seq_printf(m, "hook_packets %llu\n", sum.hook_packets);
+    seq_printf(m, "lookups %llu\n", sum.lookups);
+    seq_printf(m, "lookup_hits %llu\n", sum.lookup_hits);
+    seq_printf(m, "lookup_probes %llu\n", sum.lookup_probes);
+    seq_printf(m, "icmp_err_translated %llu\n", sum.icmp_err_translated);
+    seq_printf(m, "hop_limit_expired %llu\n", sum.hop_limit_expired);
+    seq_printf(m, "drop_writable %llu\n", sum.drop_writable);
+    seq_printf(m, "drop_nptv6 %llu\n", sum.drop_nptv6);
+    return 0;
+}
+
+static int stats_open(struct inode *inode, struct file *file) {
+    return single_open(file, stats_show, pde_data(inode));
+}
+
+static const struct proc_ops stats_proc_ops = {
+    .proc_open = stats_open,
+    .proc_read = seq_read,
+    .proc_lseek = seq_lseek,
+    .proc_release = single_release,
+};
+
+static void hist_show_one(struct seq_file *m, const char *name, const u64 *hist,
+                          unsigned int buckets) {
+    unsigned int i;
+
+    for (i = 0; i < buckets; i++) {
+        if (i == 0)
+            seq_printf(m, "%s 0 %llu\n", name, hist[i]);
+        else if (i == buckets - 1)
+            seq_printf(m, "%s %llu+ %llu\n", name, 1ULL << (i - 1), hist[i]);
+        else
+            seq_printf(m, "%s %llu-%llu %llu\n", name, 1ULL << (i - 1),
+                       (1ULL << i) - 1, hist[i]);
+    }
+}
+
+static int hist_show(struct seq_file *m, void *v) {
+    struct net *net = m->private;
+    struct nat_pcpu_stats sum;
+
+    nat_stats_sum(slick_nat_pernet(net), &sum);
+
+    seq_printf(m, "# log2 histograms - write \"reset\" to clear\n");
+    seq_printf(m, "# Format: histogram range count\n\n");
+    hist_show_one(m, "hook_ns", sum.hook_ns, NAT_HOOK_NS_BUCKETS);
+    hist_show_one(m, "lookup_probes", sum.probes, NAT_PROBE_BUCKETS);
+    return 0;
+}
+
+static int hist_open(struct inode *inode, struct file *file) {
+    return single_open(file, hist_show, pde_data(inode));
+}
+
+/* Races with the packet path like a mapping counter reset does. */
+static ssize_t hist_write(struct file *file, const char __user *buffer, size_t count,
+                          loff_t *pos) {
+    struct net *net = pde_data(file_inode(file));
+    struct nat_pcpu_stats __percpu *stats;
+    struct nat_pcpu_stats *st;
+    char buf[16];
+    int cpu;
+
+    if (count == 0 || count >= sizeof(buf))
+        return -EINVAL;
+
+    if (copy_from_user(buf, buffer, count))
+        return -EFAULT;
+
+    buf[count] = '\0';
+    if (strcmp(strim(buf), "reset") != 0)
+        return -EINVAL;
+
+    stats = smp_load_acquire(&slick_nat_pernet(net)->stats);
+    if (!stats)
+        return count;
+
+    for_each_possible_cpu(cpu) {
+        st = per_cpu_ptr(stats, cpu);
+        memset(st->hook_ns, 0, sizeof(st->hook_ns));
+        memset(st->probes, 0, sizeof(st->probes));
+    }
+
+    return count;
+}
+
+static const struct proc_ops hist_proc_ops = {
+    .proc_open = hist_open,
+    .proc_read = seq_read,
+    .proc_write = hist_write,
+    .proc_lseek = seq_lseek,
+    .proc_release = single_release,
+};
+
+static int mapping_stats_show(struct seq_file *m, void *v) {
+    const struct nat_mapping_stats *st;
+    struct nat_mapping *mapping = v;
+    struct nat_mapping_stats sum;
+    int cpu, c;
+
+    if (v == SEQ_START_TOKEN) {
+        seq_printf(m, "# Per-mapping counters (packets bytes) - write \"reset\" to clear\n");
+        seq_printf(m, "# Format: interface internal_prefix/len out in icmp_err ndp\n\n");
+        return 0;
+    }
+
+    memset(&sum, 0, sizeof(sum));
+    for_each_possible_cpu(cpu) {
+        st = per_cpu_ptr(mapping->stats, cpu);
+        for (c = 0; c < NAT_CNT_MAX; c++) {
+            sum.packets[c] += READ_ONCE(st->packets[c]);
+            sum.bytes[c] += READ_ONCE(st->bytes[c]);
+        }
+    }
+
+    seq_printf(m, "%s %pI6c/%d", mapping->interface, &mapping->internal_prefix,
+               mapping->prefix_len);
+    for (c = 0; c < NAT_CNT_MAX; c++)
+        seq_printf(m, " %llu %llu", sum.packets[c], sum.bytes[c]);
+    seq_putc(m, '\n');
+
+    return 0;
+}
+
+static const struct seq_operations mapping_stats_seq_ops = {
+    .start = nat_dump_start,
+    .next = nat_dump_next,
+    .stop = nat_dump_stop,
+    .show = mapping_stats_show,
+};
+
+static int mapping_stats_open(struct inode *inode, struct file *file) {
+    return nat_dump_open(inode, file, &mapping_stats_seq_ops, false);
+}
+
+/* Zeroing another CPU's counters can lose an increment that races with it;
+ * that is acceptable for a statistics reset. */
+static ssize_t mapping_stats_write(struct file *file, const char __user *buffer, size_t count,
+                                   loff_t *pos) {
+    struct net *net = pde_data(file_inode(file));
+    struct slick_nat_net *sn_net = slick_nat_pernet(net);
+    struct nat_mapping *mapping;
+    char buf[16];
+    int cpu;
+
+    if (count == 0 || count >= sizeof(buf))
+        return -EINVAL;
+
+    if (copy_from_user(buf, buffer, count))
+        return -EFAULT;
+
+    buf[count] = '\0';
+    if (strcmp(strim(buf), "reset") != 0)
+        return -EINVAL;
+
+    mutex_lock(&sn_net->mapping_mutex);
+    list_for_each_entry(mapping, &nat_table_locked(sn_net)->mapping_list, list) {
+        for_each_possible_cpu(cpu)
+            memset(per_cpu_ptr(mapping->stats, cpu), 0, sizeof(struct nat_mapping_stats));
+    }
+    mutex_unlock(&sn_net->mapping_mutex);
+
+    return count;
+}
+
+static const struct proc_ops mapping_stats_proc_ops = {
+    .proc_open = mapping_stats_open,
+    .proc_read = seq_read,
+    .proc_write = mapping_stats_write,
+    .proc_lseek = seq_lseek,
+    .proc_release = seq_release_private,
+};
+
+static int xdp_show(struct seq_file *m, void *v) {
+    struct net *net = m->private;
+    struct slick_nat_net *sn_net = slick_nat_pernet(net);
+
+    mutex_lock(&sn_net->mapping_mutex);
+    if (!sn_net->xdp_map) {
+        seq_printf(m, "state: unbound\n");
+    } else {
+        seq_printf(m, "state: %s\n", sn_net->xdp_err ? "failed" : "active");
+        seq_printf(m, "map_id: %u\n", nat_xdp_map_id(sn_net->xdp_map));
+        seq_printf(m, "max_entries: %u\n", nat_xdp_map_max_entries(sn_net->xdp_map));
+        seq_printf(m, "needed: %llu\n",
+                   SLICK_NAT_XDP_ENTRIES(READ_ONCE(sn_net->max_mappings)));
+        if (sn_net->xdp_err)
+            seq_printf(m, "error: %d\n", sn_net->xdp_err);
+    }
+    mutex_unlock(&sn_net->mapping_mutex);
+
+    return 0;
+}
+
+static int xdp_open(struct inode *inode, struct file *file) {
+    return single_open(file, xdp_show, pde_data(inode));
+}
+
+/* Take our entries out of the bound map and let go of it.  Caller must
+ * hold mapping_mutex. */
+static void nat_xdp_unbind(struct slick_nat_net *sn_net) {
+    if (!sn_net->xdp_map)
+        return;
+
+    if (!sn_net->xdp_err)
+        nat_xdp_sync_table(sn_net->xdp_map, nat_table_locked(sn_net), NULL, false);
+    nat_xdp_flush(sn_net->xdp_map);
+    nat_xdp_map_put(sn_net->xdp_map);
+    sn_net->xdp_map = NULL;
+    sn_net->xdp_err = 0;
+}
+
+/*
+ * "bind <fd>" mirrors the table into the prefix map behind a descriptor of
+ * the writing process (see slnat-xdp), replacing any map bound before;
+ * binding again also restarts mirroring after a failure.  "unbind" stops it.
+ */
+static ssize_t xdp_write(struct file *file, const char __user *buffer, size_t count,
+                         loff_t *pos) {
+    struct net *net = pde_data(file_inode(file));
+    struct slick_nat_net *sn_net = slick_nat_pernet(net);
+    struct bpf_map *map = NULL;
+    char buf[32];
+    char *cmd;
+    int fd, ret;
+
+    if (count == 0 || count >= sizeof(buf))
+        return -EINVAL;
+
+    if (copy_from_user(buf, buffer, count))
+        return -EFAULT;
 
-    while (**s == ' ' || **s == '\t')
-        (*s)++;
+    buf[count] = '\0';
+    cmd = strim(buf);
 
-    if (**s == '\0')
-        return NULL;
+    if (strncmp(cmd, "bind ", 5) == 0) {
+        if (kstrtoint(skip_spaces(cmd + 5), 10, &fd))
+            return -EINVAL;
 
-    tok = *s;
-    while (**s && **s != ' ' && **s != '\t')
-        (*s)++;
+        /* Resolve the descriptor now, in the writer's file table. */
+        map = nat_xdp_map_get(fd);
+        if (IS_ERR(map))
+            return PTR_ERR(map);
+    } else if (strcmp(cmd, "unbind") != 0) {
+        return -EINVAL;
+    }
 
-    if (**s) {
-        **s = '\0';
-        (*s)++;
+    mutex_lock(&sn_net->mapping_mutex);
+    nat_xdp_unbind(sn_net);
+
+    ret = 0;
+    if (map) {
+        /* Still bound: a missing entry only costs the fast path, and the
+         * namespace may never come near its cap. */
+        if (nat_xdp_map_max_entries(map) < SLICK_NAT_XDP_ENTRIES(sn_net->max_mappings))
+            pr_warn("Slick NAT: XDP map holds %u entries, max_mappings %u may need %llu; "
+                    "XDP translation stops when it fills (size it with slnat-xdp)\n",
+                    nat_xdp_map_max_entries(map), sn_net->max_mappings,
+                    SLICK_NAT_XDP_ENTRIES(sn_net->max_mappings));
+        sn_net->xdp_map = map;
+        nat_xdp_flush(map);
+        ret = nat_xdp_sync_table(map, nat_table_locked(sn_net), NULL, true);
+        if (ret)
+            nat_xdp_fail(sn_net, nat_table_locked(sn_net), ret);
     }
+    mutex_unlock(&sn_net->mapping_mutex);
 
-    return tok;
+    if (ret)
+        return ret;
+
+    return count;
 }
 
+static const struct proc_ops xdp_proc_ops = {
+    .proc_open = xdp_open,
+    .proc_read = seq_read,
+    .proc_write = xdp_write,
+    .proc_lseek = seq_lseek,
+    .proc_release = single_release,
+};
+
 /*
- * Execute a single configuration line.  The line buffer is modified in place.
- * Returns a negative errno on failure, the number of dropped mappings for
- * "drop", 0 otherwise.  -EAGAIN means "blank line or comment, nothing to do".
- * Caller must hold mapping_lock.
+ * Generic netlink control interface.  Entries are binary, so nothing is
+ * tokenised; a bulk request is parsed into struct nat_cmd first and then
+ * applied under one mapping_mutex acquisition, exactly like a batch file.
  */
-static int nat_exec_line_unlocked(struct net *net, char *line) {
-    struct in6_addr internal_prefix, external_prefix;
-    int internal_prefix_len, external_prefix_len;
-    char *cmd, *interface, *arg1, *arg2;
+static struct genl_family slick_nat_genl_family;
+
+static const struct nla_policy slick_nat_map_policy[SLICK_NAT_MAP_ATTR_MAX + 1] = {
+    [SLICK_NAT_MAP_ATTR_IFNAME] = { .type = NLA_NUL_STRING, .len = IFNAMSIZ - 1 },
+    [SLICK_NAT_MAP_ATTR_INTERNAL] = NLA_POLICY_EXACT_LEN(sizeof(struct in6_addr)),
+    [SLICK_NAT_MAP_ATTR_EXTERNAL] = NLA_POLICY_EXACT_LEN(sizeof(struct in6_addr)),
+    [SLICK_NAT_MAP_ATTR_PREFIX_LEN] = NLA_POLICY_MAX(NLA_U8, 128),
+    [SLICK_NAT_MAP_ATTR_FLAGS] = NLA_POLICY_MASK(NLA_U32, SLICK_NAT_MAP_F_NPTV6),
+};
 
-    cmd = nat_next_token(&line);
-    if (!cmd || cmd[0] == '#')
-        return -EAGAIN;
+static const struct nla_policy slick_nat_genl_policy[SLICK_NAT_ATTR_MAX + 1] = {
+    [SLICK_NAT_ATTR_MAPPING] = NLA_POLICY_NESTED(slick_nat_map_policy),
+    [SLICK_NAT_ATTR_IFNAME] = { .type = NLA_NUL_STRING, .len = IFNAMSIZ - 1 },
+};
 
-    interface = nat_next_token(&line);
-    if (!interface || interface[0] == '\0')
-        return -EINVAL;
+static int nat_genl_parse_mapping(const struct nlattr *nla, enum nat_cmd_op op,
+                                  struct nat_cmd *cmd, struct netlink_ext_ack *extack) {
+    struct nlattr *tb[SLICK_NAT_MAP_ATTR_MAX + 1];
+    struct in6_addr addr;
+    int len;
+    int ret;
 
-    if (strcmp(cmd, "add") == 0) {
-        arg1 = nat_next_token(&line);
-        arg2 = nat_next_token(&line);
-        if (!arg1 || !arg2)
-            return -EINVAL;
+    ret = nla_parse_nested(tb, SLICK_NAT_MAP_ATTR_MAX, nla, slick_nat_map_policy, extack);
+    if (ret < 0)
+        return ret;
 
-        if (strlen(interface) >= IFNAMSIZ)
-            return -EINVAL;
+    if (!tb[SLICK_NAT_MAP_ATTR_IFNAME] || !tb[SLICK_NAT_MAP_ATTR_INTERNAL] ||
+        !tb[SLICK_NAT_MAP_ATTR_PREFIX_LEN])
+        return -EINVAL;
+    if (op == NAT_CMD_ADD && !tb[SLICK_NAT_MAP_ATTR_EXTERNAL])
+        return -EINVAL;
 
-        if (parse_ipv6_prefix(arg1, &internal_prefix, &internal_prefix_len) < 0 ||
-            parse_ipv6_prefix(arg2, &external_prefix, &external_prefix_len) < 0)
-            return -EINVAL;
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->op = op;
+    nla_strscpy(cmd->interface, tb[SLICK_NAT_MAP_ATTR_IFNAME], IFNAMSIZ);
 
-        return add_mapping_internal_unlocked(net, interface, &internal_prefix, internal_prefix_len,
-                                             &external_prefix, external_prefix_len);
+    len = nla_get_u8(tb[SLICK_NAT_MAP_ATTR_PREFIX_LEN]);
+    cmd->internal_prefix_len = len;
+    cmd->external_prefix_len = len;
+
+    /* Mask like parse_ipv6_prefix() does, so both interfaces agree. */
+    addr = nla_get_in6_addr(tb[SLICK_NAT_MAP_ATTR_INTERNAL]);
+    ipv6_addr_prefix(&cmd->internal_prefix, &addr, len);
+    if (tb[SLICK_NAT_MAP_ATTR_EXTERNAL]) {
+        addr = nla_get_in6_addr(tb[SLICK_NAT_MAP_ATTR_EXTERNAL]);
+        ipv6_addr_prefix(&cmd->external_prefix, &addr, len);
     }
 
-    if (strcmp(cmd, "del") == 0) {
-        arg1 = nat_next_token(&line);
-        if (!arg1)
-            return -EINVAL;
+    if (tb[SLICK_NAT_MAP_ATTR_FLAGS])
+        cmd->nptv6 = nla_get_u32(tb[SLICK_NAT_MAP_ATTR_FLAGS]) & SLICK_NAT_MAP_F_NPTV6;
 
-        if (parse_ipv6_prefix(arg1, &internal_prefix, &internal_prefix_len) < 0)
-            return -EINVAL;
+    return 0;
+}
 
-        return del_mapping_internal_unlocked(net, interface, &internal_prefix, internal_prefix_len);
-    }
+static int nat_genl_put_mapping(struct sk_buff *skb, const struct nat_mapping *mapping) {
+    struct nlattr *nest;
 
-    if (strcmp(cmd, "drop") == 0) {
-        if (strcmp(interface, "--all") == 0)
-            return drop_mappings_internal_unlocked(net, NULL);
-        return drop_mappings_internal_unlocked(net, interface);
+    nest = nla_nest_start(skb, SLICK_NAT_ATTR_MAPPING);
+    if (!nest)
+        return -EMSGSIZE;
+
+    if (nla_put_string(skb, SLICK_NAT_MAP_ATTR_IFNAME, mapping->interface) ||
+        nla_put_in6_addr(skb, SLICK_NAT_MAP_ATTR_INTERNAL, &mapping->internal_prefix) ||
+        nla_put_in6_addr(skb, SLICK_NAT_MAP_ATTR_EXTERNAL, &mapping->external_prefix) ||
+        nla_put_u8(skb, SLICK_NAT_MAP_ATTR_PREFIX_LEN, mapping->prefix_len) ||
+        nla_put_u32(skb, SLICK_NAT_MAP_ATTR_FLAGS, mapping->nptv6 ? SLICK_NAT_MAP_F_NPTV6 : 0)) {
+        nla_nest_cancel(skb, nest);
+        return -EMSGSIZE;
     }
 
-    return -EINVAL;
+    nla_nest_end(skb, nest);
+    return 0;
 }
 
-static int nat_exec_line(struct net *net, char *line) {
+/* ADD and DEL: any number of mappings, one result per entry. */
+static int nat_genl_bulk(struct sk_buff *skb, struct genl_info *info, enum nat_cmd_op op) {
+    struct net *net = genl_info_net(info);
     struct slick_nat_net *sn_net = slick_nat_pernet(net);
-    unsigned long flags;
+    struct nat_table *old;
+    struct nat_cmd *cmds;
+    struct sk_buff *reply;
+    struct nlattr *nla, *nest;
+    unsigned int n = 0, i, applied = 0;
+    int *errs;
+    void *hdr;
+    int rem;
     int ret;
 
-    spin_lock_irqsave(&sn_net->mapping_lock, flags);
-    ret = nat_exec_line_unlocked(net, line);
-    spin_unlock_irqrestore(&sn_net->mapping_lock, flags);
+    nla_for_each_attr(nla, genlmsg_data(info->genlhdr), genlmsg_len(info->genlhdr), rem) {
+        if (nla_type(nla) == SLICK_NAT_ATTR_MAPPING)
+            n++;
+    }
+    if (!n) {
+        NL_SET_ERR_MSG(info->extack, "No mappings in request");
+        return -EINVAL;
+    }
+
+    cmds = kvmalloc_array(n, sizeof(*cmds), GFP_KERNEL);
+    errs = kvmalloc_array(n, sizeof(*errs), GFP_KERNEL);
+    if (!cmds || !errs) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    i = 0;
+    nla_for_each_attr(nla, genlmsg_data(info->genlhdr), genlmsg_len(info->genlhdr), rem) {
+        if (nla_type(nla) != SLICK_NAT_ATTR_MAPPING)
+            continue;
+        errs[i] = nat_genl_parse_mapping(nla, op, &cmds[i], NULL);
+        i++;
+    }
+
+    /* Room for every entry to fail, taken before anything is applied: once
+     * the changes are in, the reply must not be the thing that fails. */
+    reply = genlmsg_new(nla_total_size(sizeof(u32)) +
+                        n * nla_total_size(2 * nla_total_size(sizeof(u32))), GFP_KERNEL);
+    if (!reply) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    mutex_lock(&sn_net->mapping_mutex);
+    for (i = 0; i < n; i++) {
+        if (errs[i] == 0)
+            errs[i] = nat_apply_cmd_live(net, sn_net, &cmds[i]);
+        if (errs[i] >= 0)
+            applied++;
+        cond_resched();
+    }
+    ret = nat_net_sync(net, sn_net, &old);
+    mutex_unlock(&sn_net->mapping_mutex);
+    nat_table_retire(old);
+    /* The entries are applied, but nothing translates them. */
+    if (ret) {
+        NL_SET_ERR_MSG(info->extack, "Failed to register the netfilter hook");
+        nlmsg_free(reply);
+        goto out;
+    }
+
+    hdr = genlmsg_put_reply(reply, info, &slick_nat_genl_family, 0, SLICK_NAT_CMD_RESULT);
+    if (!hdr)
+        goto nla_fail;
+    if (nla_put_u32(reply, SLICK_NAT_ATTR_APPLIED, applied))
+        goto nla_fail;
+
+    for (i = 0; i < n; i++) {
+        if (errs[i] >= 0)
+            continue;
+        nest = nla_nest_start(reply, SLICK_NAT_ATTR_ENTRY_ERROR);
+        if (!nest ||
+            nla_put_u32(reply, SLICK_NAT_ERR_ATTR_INDEX, i) ||
+            nla_put_s32(reply, SLICK_NAT_ERR_ATTR_ERRNO, errs[i]))
+            goto nla_fail;
+        nla_nest_end(reply, nest);
+    }
+
+    genlmsg_end(reply, hdr);
+    ret = genlmsg_reply(reply, info);
+    goto out;
 
+nla_fail:
+    nlmsg_free(reply);
+    ret = -EMSGSIZE;
+out:
+    kvfree(errs);
+    kvfree(cmds);
     return ret;
 }
 
-static ssize_t batch_write(struct file *file, const char __user *buffer, size_t count, loff_t *pos) {
-    struct net *net = pde_data(file_inode(file));
+static int nat_genl_add(struct sk_buff *skb, struct genl_info *info) {
+    return nat_genl_bulk(skb, info, NAT_CMD_ADD);
+}
+
+static int nat_genl_del(struct sk_buff *skb, struct genl_info *info) {
+    return nat_genl_bulk(skb, info, NAT_CMD_DEL);
+}
+
+static int nat_genl_drop(struct sk_buff *skb, struct genl_info *info) {
+    struct net *net = genl_info_net(info);
     struct slick_nat_net *sn_net = slick_nat_pernet(net);
-    char *buf, *line, *next_line;
-    unsigned long flags;
-    int ret, processed = 0, errors = 0;
+    struct nat_cmd cmd = { .op = NAT_CMD_DROP, .all = true };
+    struct nat_table *old;
+    struct sk_buff *reply;
+    void *hdr;
+    int ret, err;
+
+    if (info->attrs[SLICK_NAT_ATTR_IFNAME]) {
+        nla_strscpy(cmd.interface, info->attrs[SLICK_NAT_ATTR_IFNAME], IFNAMSIZ);
+        cmd.all = false;
+    }
 
-    if (count == 0 || count > SLICK_NAT_BATCH_MAX)
-        return -EINVAL;
+    mutex_lock(&sn_net->mapping_mutex);
+    ret = nat_apply_cmd_live(net, sn_net, &cmd);
+    err = nat_net_sync(net, sn_net, &old);
+    mutex_unlock(&sn_net->mapping_mutex);
+    nat_table_retire(old);
+    if (ret < 0)
+        return ret;
+    if (err)
+        return err;
 
-    buf = kvmalloc(count + 1, GFP_KERNEL);
-    if (!buf)
+    reply = genlmsg_new(nla_total_size(sizeof(u32)), GFP_KERNEL);
+    if (!reply)
         return -ENOMEM;
 
-    if (copy_from_user(buf, buffer, count)) {
-        kvfree(buf);
-        return -EFAULT;
+    hdr = genlmsg_put_reply(reply, info, &slick_nat_genl_family, 0, SLICK_NAT_CMD_RESULT);
+    if (!hdr || nla_put_u32(reply, SLICK_NAT_ATTR_DROPPED, ret)) {
+        nlmsg_free(reply);
+        return -EMSGSIZE;
     }
 
-    buf[count] = '\0';
+    genlmsg_end(reply, hdr);
+    return genlmsg_reply(reply, info);
+}
 
-    line = buf;
-    while (line && *line) {
-        next_line = strchr(line, '\n');
-        if (next_line) {
-            *next_line = '\0';
-            next_line++;
-        }
+static int nat_genl_get(struct sk_buff *skb, struct genl_info *info) {
+    struct net *net = genl_info_net(info);
+    struct slick_nat_net *sn_net = slick_nat_pernet(net);
+    struct nat_mapping *mapping;
+    struct sk_buff *reply;
+    struct nat_cmd cmd;
+    void *hdr;
+    int ret;
 
-        spin_lock_irqsave(&sn_net->mapping_lock, flags);
-        ret = nat_exec_line_unlocked(net, line);
-        spin_unlock_irqrestore(&sn_net->mapping_lock, flags);
+    if (!info->attrs[SLICK_NAT_ATTR_MAPPING])
+        return -EINVAL;
 
-        if (ret == -EAGAIN)
-            ;                       /* blank line or comment */
-        else if (ret < 0)
-            errors++;
-        else
-            processed += (ret > 0) ? ret : 1;
+    ret = nat_genl_parse_mapping(info->attrs[SLICK_NAT_ATTR_MAPPING], NAT_CMD_DEL, &cmd,
+                                 info->extack);
+    if (ret < 0)
+        return ret;
 
-        line = next_line;
-    }
+    reply = genlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+    if (!reply)
+        return -ENOMEM;
 
-    kvfree(buf);
+    hdr = genlmsg_put_reply(reply, info, &slick_nat_genl_family, 0, SLICK_NAT_CMD_GET);
+    if (!hdr) {
+        nlmsg_free(reply);
+        return -EMSGSIZE;
+    }
 
-    pr_info("Slick NAT: Batch operation completed - processed: %d, errors: %d\n",
-            processed, errors);
+    mutex_lock(&sn_net->mapping_mutex);
+    mapping = nat_find_mapping_exact(nat_table_locked(sn_net), cmd.interface,
+                                     &cmd.internal_prefix, cmd.internal_prefix_len);
+    ret = mapping ? nat_genl_put_mapping(reply, mapping) : -ENOENT;
+    mutex_unlock(&sn_net->mapping_mutex);
 
-    if (processed == 0 && errors > 0)
-        return -EINVAL;
+    if (ret < 0) {
+        nlmsg_free(reply);
+        return ret;
+    }
 
-    return count;
+    genlmsg_end(reply, hdr);
+    return genlmsg_reply(reply, info);
 }
 
-static int batch_show(struct seq_file *m, void *v) {
-    seq_printf(m, "# Slick NAT Batch Interface\n");
-    seq_printf(m, "# Write batch operations to this file\n");
-    seq_printf(m, "# Format (one per line):\n");
-    seq_printf(m, "#   add <interface> <internal_prefix/len> <external_prefix/len>\n");
-    seq_printf(m, "#   del <interface> <internal_prefix/len>\n");
-    seq_printf(m, "#   drop <interface>    - Drop all mappings for interface\n");
-    seq_printf(m, "#   drop --all         - Drop all mappings\n");
-    seq_printf(m, "# Lines starting with # are ignored\n");
-    return 0;
-}
+/* cb->args[0] is the number of mappings already emitted. */
+static int nat_genl_dump(struct sk_buff *skb, struct netlink_callback *cb) {
+    struct net *net = sock_net(skb->sk);
+    struct slick_nat_net *sn_net = slick_nat_pernet(net);
+    struct nat_mapping *mapping;
+    long idx = 0, start = cb->args[0];
+    void *hdr;
 
-static int batch_open(struct inode *inode, struct file *file) {
-    return single_open(file, batch_show, pde_data(inode));
+    rcu_read_lock();
+    list_for_each_entry_rcu(mapping, &rcu_dereference(sn_net->table)->mapping_list, list) {
+        if (idx < start) {
+            idx++;
+            continue;
+        }
+
+        hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).portid, cb->nlh->nlmsg_seq,
+                          &slick_nat_genl_family, NLM_F_MULTI, SLICK_NAT_CMD_GET);
+        if (!hdr)
+            break;
+        if (nat_genl_put_mapping(skb, mapping)) {
+            genlmsg_cancel(skb, hdr);
+            break;
+        }
+        genlmsg_end(skb, hdr);
+        idx++;
+    }
+    rcu_read_unlock();
+
+    cb->args[0] = idx;
+    return skb->len;
 }
 
-static const struct proc_ops batch_proc_ops = {
-    .proc_open = batch_open,
-    .proc_read = seq_read,
-    .proc_write = batch_write,
-    .proc_lseek = seq_lseek,
-    .proc_release = single_release,
+/* Changing the table needs CAP_NET_ADMIN in the namespace's user namespace,
+ * the netlink equivalent of root inside a container writing the proc file. */
+static const struct genl_ops slick_nat_genl_ops[] = {
+    {
+        .cmd = SLICK_NAT_CMD_ADD,
+        .doit = nat_genl_add,
+        .flags = GENL_UNS_ADMIN_PERM,
+    },
+    {
+        .cmd = SLICK_NAT_CMD_DEL,
+        .doit = nat_genl_del,
+        .flags = GENL_UNS_ADMIN_PERM,
+    },
+    {
+        .cmd = SLICK_NAT_CMD_DROP,
+        .doit = nat_genl_drop,
+        .flags = GENL_UNS_ADMIN_PERM,
+    },
+    {
+        .cmd = SLICK_NAT_CMD_GET,
+        .doit = nat_genl_get,
+        .dumpit = nat_genl_dump,
+    },
 };
 
-static ssize_t mapping_write(struct file *file, const char __user *buffer, size_t count, loff_t *pos) {
-    struct net *net = pde_data(file_inode(file));
-    char buf[SLICK_NAT_LINE_MAX];
-    char *newline;
-    int ret;
-
-    if (count == 0 || count >= sizeof(buf))
-        return -EINVAL;
+static struct genl_family slick_nat_genl_family __ro_after_init = {
+    .name = SLICK_NAT_GENL_NAME,
+    .version = SLICK_NAT_GENL_VERSION,
+    .maxattr = SLICK_NAT_ATTR_MAX,
+    .policy = slick_nat_genl_policy,
+    .netnsok = true,
+    .module = THIS_MODULE,
+    .ops = slick_nat_genl_ops,
+    .n_ops = ARRAY_SIZE(slick_nat_genl_ops),
+};
 
-    if (copy_from_user(buf, buffer, count))
-        return -EFAULT;
+static unsigned int nat_max_mappings_limit = SLICK_NAT_MAX_MAPPINGS_LIMIT;
+static unsigned int nat_ndp_limit = SLICK_NAT_NDP_LIMIT;
+static unsigned int nat_ndp_suppress_limit = 10000;
+
+/* net.slick_nat.*, one copy per namespace.  Lowering max_mappings below
+ * the current count only stops further adds.  The .data pointers are
+ * filled in by nat_sysctl_register(), in this order; the first three bound
+ * what a namespace may cost the host and are read-only outside the initial
+ * user namespace. */
+static struct ctl_table slick_nat_sysctl_table[] = {
+    {
+        .procname = "max_mappings",
+        .maxlen = sizeof(unsigned int),
+        .mode = 0644,
+        .proc_handler = proc_douintvec_minmax,
+        .extra1 = SYSCTL_ONE,
+        .extra2 = &nat_max_mappings_limit,
+    },
+    {
+        .procname = "ndp_rate",
+        .maxlen = sizeof(unsigned int),
+        .mode = 0644,
+        .proc_handler = proc_douintvec_minmax,
+        .extra1 = SYSCTL_ZERO,
+        .extra2 = &nat_ndp_limit,
+    },
+    {
+        .procname = "ndp_burst",
+        .maxlen = sizeof(unsigned int),
+        .mode = 0644,
+        .proc_handler = proc_douintvec_minmax,
+        .extra1 = SYSCTL_ONE,
+        .extra2 = &nat_ndp_limit,
+    },
+    {
+        .procname = "ndp_suppress_ms",
+        .maxlen = sizeof(unsigned int),
+        .mode = 0644,
+        .proc_handler = proc_douintvec_minmax,
+        .extra1 = SYSCTL_ZERO,
+        .extra2 = &nat_ndp_suppress_limit,
+    },
+};
 
-    buf[count] = '\0';
+static int nat_sysctl_register(struct net *net, struct slick_nat_net *sn_net) {
+    struct ctl_table *table = slick_nat_sysctl_table;
 
-    newline = strchr(buf, '\n');
-    if (newline)
-        *newline = '\0';
+    if (!net_eq(net, &init_net)) {
+        table = kmemdup(table, sizeof(slick_nat_sysctl_table), GFP_KERNEL);
+        if (!table)
+            return -ENOMEM;
+    }
+    table[0].data = &sn_net->max_mappings;
+    table[1].data = &sn_net->ndp_rate;
+    table[2].data = &sn_net->ndp_burst;
+    table[3].data = &sn_net->ndp_suppress_ms;
+
+    /* Root in a container must not raise its own limits. */
+    if (net->user_ns != &init_user_ns) {
+        table[0].mode = 0444;
+        table[1].mode = 0444;
+        table[2].mode = 0444;
+    }
 
-    ret = nat_exec_line(net, buf);
-    if (ret == -EAGAIN)
-        return count;
-    if (ret < 0)
-        return ret;
+    sn_net->sysctl_hdr = register_net_sysctl_sz(net, "net/slick_nat", table,
+                                                ARRAY_SIZE(slick_nat_sysctl_table));
+    if (!sn_net->sysctl_hdr) {
+        if (table != slick_nat_sysctl_table)
+            kfree(table);
+        return -ENOMEM;
+    }
 
-    return count;
+    return 0;
 }
 
-static const struct proc_ops mapping_proc_ops = {
-    .proc_open = mapping_open,
-    .proc_read = seq_read,
-    .proc_write = mapping_write,
-    .proc_lseek = seq_lseek,
-    .proc_release = single_release,
-};
+static void nat_sysctl_unregister(struct slick_nat_net *sn_net) {
+    const struct ctl_table *table = sn_net->sysctl_hdr->ctl_table_arg;
 
-static struct nf_hook_ops nat_nf_hook_ops = {
-    .hook     = nat_hook_func,
-    .pf       = PF_INET6,
-    .hooknum  = NF_INET_PRE_ROUTING,
-    .priority = NF_IP6_PRI_NAT_DST,
-};
+    unregister_net_sysctl_table(sn_net->sysctl_hdr);
+    sn_net->sysctl_hdr = NULL;
+    if (table != slick_nat_sysctl_table)
+        kfree(table);
+}
 
 static int __net_init slick_nat_net_init(struct net *net)
 {
     struct slick_nat_net *sn_net = slick_nat_pernet(net);
-    unsigned int i;
     int ret;
 
-    INIT_LIST_HEAD(&sn_net->mapping_list);
-    spin_lock_init(&sn_net->mapping_lock);
+    mutex_init(&sn_net->mapping_mutex);
+    INIT_LIST_HEAD(&sn_net->dev_hooks);
+    sn_net->xlate_gen = atomic64_inc_return(&nat_xlate_gen_seq);
+    sn_net->max_mappings = SLICK_NAT_MAX_MAPPINGS;
+    sn_net->ndp_rate = SLICK_NAT_NDP_RATE;
+    sn_net->ndp_burst = SLICK_NAT_NDP_BURST;
+    sn_net->ndp_suppress_ms = SLICK_NAT_NDP_SUPPRESS_MS;
+    /* The limits are read-only there (nat_sysctl_register()), so the host
+     * sets them for unprivileged containers through its own values. */
+    if (net->user_ns != &init_user_ns) {
+        struct slick_nat_net *host = slick_nat_pernet(&init_net);
+
+        sn_net->max_mappings = READ_ONCE(host->max_mappings);
+        sn_net->ndp_rate = READ_ONCE(host->ndp_rate);
+        sn_net->ndp_burst = READ_ONCE(host->ndp_burst);
+    }
+    /* Nothing else until the first mapping: no table of its own, no
+     * counters and no hook, so containers that never use the module pay
+     * neither memory nor a hook call per packet.  See nat_net_sync(). */
+    RCU_INIT_POINTER(sn_net->table, nat_empty_table);
 
-    for (i = 0; i < SLICK_NAT_HASH_SIZE; i++) {
-        INIT_HLIST_HEAD(&sn_net->internal_hash[i]);
-        INIT_HLIST_HEAD(&sn_net->external_hash[i]);
+    ret = nat_sysctl_register(net, sn_net);
+    if (ret < 0) {
+        pr_err("Slick NAT: Failed to register sysctls\n");
+        return ret;
     }
-    memset(sn_net->prefix_len_use, 0, sizeof(sn_net->prefix_len_use));
-    sn_net->mapping_count = 0;
 
     /* Mode 0644: the mapping table controls packet forwarding, so only root
      * may write it. */
+    ret = -ENOMEM;
     sn_net->proc_entry = proc_create_data(PROC_FILENAME, 0644, net->proc_net,
                                           &mapping_proc_ops, net);
     if (!sn_net->proc_entry) {
         pr_err("Slick NAT: Failed to create proc entry\n");
-        return -ENOMEM;
+        goto err_unregister_sysctl;
     }
 
     sn_net->proc_batch_entry = proc_create_data(PROC_BATCH_FILENAME, 0644, net->proc_net,
                                                 &batch_proc_ops, net);
     if (!sn_net->proc_batch_entry) {
         pr_err("Slick NAT: Failed to create batch proc entry\n");
-        proc_remove(sn_net->proc_entry);
-        sn_net->proc_entry = NULL;
-        return -ENOMEM;
+        goto err_remove_proc;
     }
 
-    ret = nf_register_net_hook(net, &nat_nf_hook_ops);
-    if (ret < 0) {
-        pr_err("Slick NAT: Failed to register PRE_ROUTING hook\n");
-        proc_remove(sn_net->proc_batch_entry);
-        proc_remove(sn_net->proc_entry);
-        sn_net->proc_batch_entry = NULL;
-        sn_net->proc_entry = NULL;
-        return ret;
+    sn_net->proc_stats_entry = proc_create_data(PROC_STATS_FILENAME, 0444, net->proc_net,
+                                                &stats_proc_ops, net);
+    if (!sn_net->proc_stats_entry) {
+        pr_err("Slick NAT: Failed to create stats proc entry\n");
+        goto err_remove_batch;
+    }
+
+    sn_net->proc_mapping_stats_entry = proc_create_data(PROC_MAPPING_STATS_FILENAME, 0644,
+                                                        net->proc_net, &mapping_stats_proc_ops,
+                                                        net);
+    if (!sn_net->proc_mapping_stats_entry) {
+        pr_err("Slick NAT: Failed to create mapping stats proc entry\n");
+        goto err_remove_stats;
+    }
+
+    sn_net->proc_xdp_entry = proc_create_data(PROC_XDP_FILENAME, 0644, net->proc_net,
+                                              &xdp_proc_ops, net);
+    if (!sn_net->proc_xdp_entry) {
+        pr_err("Slick NAT: Failed to create XDP proc entry\n");
+        goto err_remove_mapping_stats;
+    }
+
+    sn_net->proc_hist_entry = proc_create_data(PROC_HIST_FILENAME, 0644, net->proc_net,
+                                               &hist_proc_ops, net);
+    if (!sn_net->proc_hist_entry) {
+        pr_err("Slick NAT: Failed to create histogram proc entry\n");
+        goto err_remove_xdp;
     }
 
     return 0;
+
+err_remove_xdp:
+    proc_remove(sn_net->proc_xdp_entry);
+    sn_net->proc_xdp_entry = NULL;
+err_remove_mapping_stats:
+    proc_remove(sn_net->proc_mapping_stats_entry);
+    sn_net->proc_mapping_stats_entry = NULL;
+err_remove_stats:
+    proc_remove(sn_net->proc_stats_entry);
+    sn_net->proc_stats_entry = NULL;
+err_remove_batch:
+    proc_remove(sn_net->proc_batch_entry);
+    sn_net->proc_batch_entry = NULL;
+err_remove_proc:
+    proc_remove(sn_net->proc_entry);
+    sn_net->proc_entry = NULL;
+err_unregister_sysctl:
+    nat_sysctl_unregister(sn_net);
+    return ret;
 }
 
 static void __net_exit slick_nat_net_exit(struct net *net)
 {
     struct slick_nat_net *sn_net = slick_nat_pernet(net);
-    unsigned long flags;
-
-    /* Unregister first: this waits for in-flight hook invocations, so no
-     * packet can still be looking at a mapping when we free it. */
-    nf_unregister_net_hook(net, &nat_nf_hook_ops);
+    LIST_HEAD(dead);
+
+    /* Unregister first so no new packet gets in.  This does not wait for
+     * the ones already in the hook; the grace period below does, before
+     * anything they can touch is freed.  Ingress hooks go below, under
+     * mapping_mutex. */
+    if (sn_net->hook_registered) {
+        nf_unregister_net_hook(net, &nat_nf_hook_ops);
+        sn_net->hook_registered = false;
+    }
 
     if (sn_net->proc_entry) {
         proc_remove(sn_net->proc_entry);
@@ -1001,11 +3804,101 @@ static void __net_exit slick_nat_net_exit(struct net *net)
         sn_net->proc_batch_entry = NULL;
     }
 
-    spin_lock_irqsave(&sn_net->mapping_lock, flags);
-    drop_mappings_internal_unlocked(net, NULL);
-    spin_unlock_irqrestore(&sn_net->mapping_lock, flags);
+    if (sn_net->proc_stats_entry) {
+        proc_remove(sn_net->proc_stats_entry);
+        sn_net->proc_stats_entry = NULL;
+    }
+
+    if (sn_net->proc_mapping_stats_entry) {
+        proc_remove(sn_net->proc_mapping_stats_entry);
+        sn_net->proc_mapping_stats_entry = NULL;
+    }
+
+    if (sn_net->proc_xdp_entry) {
+        proc_remove(sn_net->proc_xdp_entry);
+        sn_net->proc_xdp_entry = NULL;
+    }
+
+    if (sn_net->proc_hist_entry) {
+        proc_remove(sn_net->proc_hist_entry);
+        sn_net->proc_hist_entry = NULL;
+    }
+
+    if (sn_net->sysctl_hdr)
+        nat_sysctl_unregister(sn_net);
+
+    /* With the hook and the proc files gone nobody can reach the table, but
+     * the netdevice notifier may still be walking it. */
+    mutex_lock(&sn_net->mapping_mutex);
+    nat_xdp_unbind(sn_net);
+    /* Together with the table, so that the notifier cannot put a hook
+     * back in between. */
+    while (!list_empty(&sn_net->dev_hooks))
+        nat_dev_hook_unlink(net, list_first_entry(&sn_net->dev_hooks, struct nat_dev_hook, list),
+                            &dead);
+    /* One grace period for every hook unregistered above, before the hooks,
+     * the table, the counters and the NDP buckets go; nat_dev_hooks_free()
+     * waits for it itself when it has anything to free. */
+    if (list_empty(&dead))
+        synchronize_net();
+    nat_dev_hooks_free(&dead);
+    if (nat_table_locked(sn_net) != nat_empty_table)
+        nat_table_free(nat_table_locked(sn_net));
+    RCU_INIT_POINTER(sn_net->table, NULL);
+    mutex_unlock(&sn_net->mapping_mutex);
+
+    free_percpu(sn_net->stats);
+    sn_net->stats = NULL;
+    nat_ndp_buckets_free(sn_net->ndp_buckets);
+    sn_net->ndp_buckets = NULL;
+}
+
+/* Keep interface entries bound to the right ifindex.  Runs under RTNL; the
+ * lock order is RTNL -> mapping_mutex, and nothing takes RTNL while holding
+ * mapping_mutex. */
+static int slick_nat_netdev_event(struct notifier_block *nb, unsigned long event, void *ptr) {
+    struct net_device *dev = netdev_notifier_info_to_dev(ptr);
+    struct slick_nat_net *sn_net = slick_nat_pernet(dev_net(dev));
+    struct nat_iface *iface;
+    struct nat_table *t;
+    bool same_name;
+
+    if (event != NETDEV_REGISTER && event != NETDEV_CHANGENAME &&
+        event != NETDEV_UNREGISTER)
+        return NOTIFY_DONE;
+
+    mutex_lock(&sn_net->mapping_mutex);
+    t = nat_table_locked(sn_net);
+    /* NULL only while the namespace is being set up or torn down. */
+    if (!t)
+        goto out;
+
+    if (event == NETDEV_UNREGISTER)
+        nat_ndp_bucket_forget(sn_net, dev->ifindex);
+
+    list_for_each_entry(iface, &t->iface_list, list) {
+        same_name = strncmp(iface->name, dev->name, IFNAMSIZ) == 0;
+
+        if (iface->ifindex == dev->ifindex) {
+            /* Device went away, or was renamed away from this entry. */
+            if (event == NETDEV_UNREGISTER || !same_name)
+                nat_iface_set_ifindex(sn_net, t, iface, 0);
+        } else if (event != NETDEV_UNREGISTER && same_name) {
+            nat_iface_set_ifindex(sn_net, t, iface, dev->ifindex);
+        }
+    }
+    /* Also picks up, and lets go of, devices declared internal. */
+    nat_dev_hooks_sync(dev_net(dev), sn_net);
+out:
+    mutex_unlock(&sn_net->mapping_mutex);
+
+    return NOTIFY_DONE;
 }
 
+static struct notifier_block slick_nat_netdev_notifier = {
+    .notifier_call = slick_nat_netdev_event,
+};
+
 static struct pernet_operations slick_nat_net_ops = {
     .init = slick_nat_net_init,
     .exit = slick_nat_net_exit,
@@ -1013,21 +3906,159 @@ static struct pernet_operations slick_nat_net_ops = {
     .size = sizeof(struct slick_nat_net),
 };
 
+static void nat_xcache_free(void) {
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        kvfree(per_cpu(nat_xcache, cpu));
+        per_cpu(nat_xcache, cpu) = NULL;
+    }
+}
+
+static int nat_xcache_alloc(void) {
+    struct nat_xcache_entry *entries;
+    int cpu;
+
+    if (!xlate_cache_bits)
+        return 0;
+
+    for_each_possible_cpu(cpu) {
+        /* gen 0 is never handed out, so zeroed entries never match. */
+        entries = kvzalloc_node(array_size(1u << xlate_cache_bits, sizeof(*entries)),
+                                GFP_KERNEL, cpu_to_node(cpu));
+        if (!entries) {
+            nat_xcache_free();
+            return -ENOMEM;
+        }
+        per_cpu(nat_xcache, cpu) = entries;
+    }
+
+    return 0;
+}
+
 static int __init slick_nat_init(void) {
     int ret;
 
+    if (strcmp(lookup_engine, "trie") == 0) {
+        nat_use_trie = true;
+    } else if (strcmp(lookup_engine, "hash") == 0) {
+        nat_use_trie = false;
+    } else {
+        pr_err("Slick NAT: Unknown lookup_engine \"%s\"\n", lookup_engine);
+        return -EINVAL;
+    }
+
+    if (strcmp(hook_mode, "ingress") == 0) {
+        if (!IS_ENABLED(CONFIG_NETFILTER_INGRESS)) {
+            pr_err("Slick NAT: hook_mode=ingress needs CONFIG_NETFILTER_INGRESS\n");
+            return -EINVAL;
+        }
+        nat_hook_ingress = true;
+    } else if (strcmp(hook_mode, "prerouting") == 0) {
+        nat_hook_ingress = false;
+    } else {
+        pr_err("Slick NAT: Unknown hook_mode \"%s\"\n", hook_mode);
+        return -EINVAL;
+    }
+
+    if (xlate_cache_bits > 16) {
+        pr_err("Slick NAT: xlate_cache_bits must be at most 16\n");
+        return -EINVAL;
+    }
+
+    nat_xlate_init();
+
+    ret = nat_xcache_alloc();
+    if (ret < 0) {
+        pr_err("Slick NAT: Failed to allocate translation cache\n");
+        return ret;
+    }
+
+    /* gen 0 is never handed out, so zeroed entries never match. */
+    nat_ndp_seen = __alloc_percpu(sizeof(struct nat_ndp_seen) << NAT_NDP_SEEN_BITS,
+                                  __alignof__(struct nat_ndp_seen));
+    if (!nat_ndp_seen) {
+        pr_err("Slick NAT: Failed to allocate NDP suppression cache\n");
+        nat_xcache_free();
+        return -ENOMEM;
+    }
+
+    /* What a trie hit reads has to stay within one 64-byte line. */
+    BUILD_BUG_ON(offsetofend(struct nat_mapping, nptv6) > 64);
+    nat_mapping_cache = KMEM_CACHE(nat_mapping, SLAB_HWCACHE_ALIGN);
+    if (!nat_mapping_cache) {
+        free_percpu(nat_ndp_seen);
+        nat_xcache_free();
+        return -ENOMEM;
+    }
+
+    nat_empty_table = nat_table_alloc(NULL);
+    if (!nat_empty_table) {
+        kmem_cache_destroy(nat_mapping_cache);
+        free_percpu(nat_ndp_seen);
+        nat_xcache_free();
+        return -ENOMEM;
+    }
+
+    nat_ndp_init();
+
     ret = register_pernet_subsys(&slick_nat_net_ops);
     if (ret < 0) {
         pr_err("Slick NAT: Failed to register pernet operations\n");
+        nat_ndp_exit();
+        nat_table_free(nat_empty_table);
+        rcu_barrier();
+        kmem_cache_destroy(nat_mapping_cache);
+        free_percpu(nat_ndp_seen);
+        nat_xcache_free();
+        return ret;
+    }
+
+    ret = register_netdevice_notifier(&slick_nat_netdev_notifier);
+    if (ret < 0) {
+        pr_err("Slick NAT: Failed to register netdevice notifier\n");
+        unregister_pernet_subsys(&slick_nat_net_ops);
+        nat_ndp_exit();
+        nat_table_free(nat_empty_table);
+        rcu_barrier();
+        kmem_cache_destroy(nat_mapping_cache);
+        free_percpu(nat_ndp_seen);
+        nat_xcache_free();
+        return ret;
+    }
+
+    ret = genl_register_family(&slick_nat_genl_family);
+    if (ret < 0) {
+        pr_err("Slick NAT: Failed to register generic netlink family\n");
+        unregister_netdevice_notifier(&slick_nat_netdev_notifier);
+        unregister_pernet_subsys(&slick_nat_net_ops);
+        nat_ndp_exit();
+        nat_table_free(nat_empty_table);
+        rcu_barrier();
+        kmem_cache_destroy(nat_mapping_cache);
+        free_percpu(nat_ndp_seen);
+        nat_xcache_free();
         return ret;
     }
 
-    pr_info("Slick NAT: Module loaded with per-netns support\n");
+    pr_info("Slick NAT: Module loaded with per-netns support, %s lookup, %s hooks\n",
+            lookup_engine, hook_mode);
     return 0;
 }
 
 static void __exit slick_nat_exit(void) {
+    genl_unregister_family(&slick_nat_genl_family);
+    unregister_netdevice_notifier(&slick_nat_netdev_notifier);
     unregister_pernet_subsys(&slick_nat_net_ops);
+    /* The hooks are gone; send nothing more and drop what is queued. */
+    nat_ndp_exit();
+    nat_table_free(nat_empty_table);
+    free_percpu(nat_ndp_seen);
+    /* Wait for nat_mapping_free_rcu() callbacks before the module text
+     * and the mapping cache go away. */
+    rcu_barrier();
+    kmem_cache_destroy(nat_mapping_cache);
+    nat_xcache_free();
 
     pr_info("Slick NAT: Module unloaded\n");
 }
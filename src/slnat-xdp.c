@@ -0,0 +1,258 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * slnat-xdp - attach the Slick NAT XDP fast path and hand its prefix map to
+ * the module.
+ *
+ *   slnat-xdp attach [-o obj] [-p pin] [-m skb|drv] <iface>...
+ *   slnat-xdp detach <iface>...
+ *   slnat-xdp unbind [-p pin]
+ *
+ * The map is pinned so that every interface and every later attach share
+ * one copy.  The module takes its own reference on the map when it is
+ * bound, through a descriptor written to /proc/net/slick_nat_xdp.  A new
+ * map is sized from net.slick_nat.max_mappings; raise that first, since a
+ * pinned map keeps its size until it is unbound.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/if_link.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include "slick-nat-xdp.h"
+
+#define PROC_XDP_FILE "/proc/net/slick_nat_xdp"
+#define MAX_MAPPINGS_FILE "/proc/sys/net/slick_nat/max_mappings"
+#define DEFAULT_OBJ "/usr/lib/slnat/slick-nat-xdp.bpf.o"
+#define DEFAULT_PIN "/sys/fs/bpf/slick_nat_prefixes"
+#define PROG_NAME "slick_nat_xdp"
+
+static int proc_write(const char *cmd) {
+    int fd, ret = 0;
+
+    fd = open(PROC_XDP_FILE, O_WRONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: cannot open %s: %s (is the module loaded?)\n",
+                PROC_XDP_FILE, strerror(errno));
+        return -1;
+    }
+
+    if (write(fd, cmd, strlen(cmd)) < 0) {
+        fprintf(stderr, "Error: '%s' rejected by the module: %s\n", cmd, strerror(errno));
+        ret = -1;
+    }
+
+    close(fd);
+    return ret;
+}
+
+/* Entries the map needs for this namespace's mapping cap, or 0 if the
+ * cap cannot be read (the object's own size is kept then). */
+static __u32 wanted_entries(void) {
+    unsigned long long n;
+    unsigned int max;
+    FILE *f;
+
+    f = fopen(MAX_MAPPINGS_FILE, "r");
+    if (!f)
+        return 0;
+    if (fscanf(f, "%u", &max) != 1)
+        max = 0;
+    fclose(f);
+
+    n = SLICK_NAT_XDP_ENTRIES(max);
+    return n > 0xffffffffULL ? 0xffffffffU : (__u32)n;
+}
+
+static int attach(const char *obj_path, const char *pin, __u32 flags, char **ifaces, int n) {
+    struct bpf_map_info info = {};
+    __u32 info_len = sizeof(info);
+    struct bpf_object *obj;
+    struct bpf_program *prog;
+    struct bpf_map *map;
+    char cmd[32];
+    int pinned_fd, prog_fd, map_fd;
+    int i, ifindex, err;
+    __u32 wanted;
+
+    obj = bpf_object__open_file(obj_path, NULL);
+    if (!obj) {
+        fprintf(stderr, "Error: cannot open %s\n", obj_path);
+        return 1;
+    }
+
+    map = bpf_object__find_map_by_name(obj, SLICK_NAT_XDP_MAP_NAME);
+    prog = bpf_object__find_program_by_name(obj, PROG_NAME);
+    if (!map || !prog) {
+        fprintf(stderr, "Error: %s is not a Slick NAT XDP object\n", obj_path);
+        goto fail;
+    }
+
+    /* Reuse the map already bound to the module, if any; otherwise make
+     * the new one big enough for every mapping the namespace may hold. */
+    wanted = wanted_entries();
+    pinned_fd = bpf_obj_get(pin);
+    if (pinned_fd >= 0) {
+        if (wanted && !bpf_map_get_info_by_fd(pinned_fd, &info, &info_len) &&
+            info.max_entries < wanted)
+            fprintf(stderr,
+                    "Warning: %s holds %u entries, max_mappings needs %u; "
+                    "run 'unbind' and attach again to resize it\n",
+                    pin, info.max_entries, wanted);
+        err = bpf_map__reuse_fd(map, pinned_fd);
+        close(pinned_fd);
+        if (err) {
+            fprintf(stderr, "Error: cannot reuse %s: %s\n", pin, strerror(-err));
+            goto fail;
+        }
+    } else if (wanted > bpf_map__max_entries(map)) {
+        err = bpf_map__set_max_entries(map, wanted);
+        if (err) {
+            fprintf(stderr, "Error: cannot size the map for %u entries: %s\n", wanted,
+                    strerror(-err));
+            goto fail;
+        }
+    }
+
+    err = bpf_object__load(obj);
+    if (err) {
+        fprintf(stderr, "Error: cannot load %s: %s\n", obj_path, strerror(-err));
+        goto fail;
+    }
+
+    map_fd = bpf_map__fd(map);
+    if (pinned_fd < 0) {
+        err = bpf_obj_pin(map_fd, pin);
+        if (err) {
+            fprintf(stderr, "Error: cannot pin map at %s: %s\n", pin, strerror(errno));
+            goto fail;
+        }
+
+        snprintf(cmd, sizeof(cmd), "bind %d\n", map_fd);
+        if (proc_write(cmd)) {
+            unlink(pin);
+            goto fail;
+        }
+    }
+
+    prog_fd = bpf_program__fd(prog);
+    for (i = 0; i < n; i++) {
+        ifindex = if_nametoindex(ifaces[i]);
+        if (!ifindex) {
+            fprintf(stderr, "Error: no interface %s\n", ifaces[i]);
+            goto fail;
+        }
+
+        err = bpf_xdp_attach(ifindex, prog_fd, flags, NULL);
+        if (err) {
+            fprintf(stderr, "Error: cannot attach to %s: %s\n", ifaces[i], strerror(-err));
+            goto fail;
+        }
+        printf("Attached XDP fast path to %s\n", ifaces[i]);
+    }
+
+    bpf_object__close(obj);
+    return 0;
+
+fail:
+    bpf_object__close(obj);
+    return 1;
+}
+
+static int detach(char **ifaces, int n) {
+    int i, ifindex, err, ret = 0;
+
+    for (i = 0; i < n; i++) {
+        ifindex = if_nametoindex(ifaces[i]);
+        if (!ifindex) {
+            fprintf(stderr, "Error: no interface %s\n", ifaces[i]);
+            ret = 1;
+            continue;
+        }
+
+        err = bpf_xdp_detach(ifindex, 0, NULL);
+        if (err) {
+            fprintf(stderr, "Error: cannot detach from %s: %s\n", ifaces[i], strerror(-err));
+            ret = 1;
+            continue;
+        }
+        printf("Detached XDP fast path from %s\n", ifaces[i]);
+    }
+
+    return ret;
+}
+
+static int unbind(const char *pin) {
+    if (proc_write("unbind\n"))
+        return 1;
+
+    if (unlink(pin) && errno != ENOENT) {
+        fprintf(stderr, "Error: cannot unpin %s: %s\n", pin, strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s attach [-o obj] [-p pin] [-m skb|drv] <iface>...\n"
+            "       %s detach <iface>...\n"
+            "       %s unbind [-p pin]\n",
+            prog, prog, prog);
+}
+
+int main(int argc, char **argv) {
+    const char *obj_path = DEFAULT_OBJ;
+    const char *pin = DEFAULT_PIN;
+    const char *cmd;
+    __u32 flags = 0;
+    int opt;
+
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    cmd = argv[1];
+    optind = 2;
+    while ((opt = getopt(argc, argv, "o:p:m:")) != -1) {
+        switch (opt) {
+        case 'o':
+            obj_path = optarg;
+            break;
+        case 'p':
+            pin = optarg;
+            break;
+        case 'm':
+            if (strcmp(optarg, "skb") == 0) {
+                flags = XDP_FLAGS_SKB_MODE;
+            } else if (strcmp(optarg, "drv") == 0) {
+                flags = XDP_FLAGS_DRV_MODE;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (strcmp(cmd, "attach") == 0 && optind < argc)
+        return attach(obj_path, pin, flags, argv + optind, argc - optind);
+    if (strcmp(cmd, "detach") == 0 && optind < argc)
+        return detach(argv + optind, argc - optind);
+    if (strcmp(cmd, "unbind") == 0 && optind == argc)
+        return unbind(pin);
+
+    usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,657 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * KUnit suite for the lookup and rewrite core of slick-nat.c, and a lookup
+ * benchmark.
+ *
+ * Built as slick_nat_test.ko by "make -C src kunit" against a kernel with
+ * CONFIG_KUNIT.  The suite includes slick-nat.c to reach its static
+ * functions, so the test module is the whole of slick_nat.ko plus the suite
+ * and cannot be loaded next to it:
+ *
+ *   rmmod slick_nat
+ *   insmod src/slick_nat_test.ko
+ *   insmod src/slick_nat_test.ko bench_mappings=100000 bench_lengths=48,56,64
+ *
+ * Results go to the kernel log (and debugfs kunit/<suite>/results).  The
+ * tables the tests build are private and never published, so nothing here
+ * touches the configuration of any namespace.
+ */
+
+#include <kunit/test.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+#include "../slick-nat.c"
+
+static unsigned int bench_mappings;
+module_param(bench_mappings, uint, 0444);
+MODULE_PARM_DESC(bench_mappings, "Mappings to fill the benchmark table with (0 skips it)");
+
+static char *bench_lengths = "48,56,64";
+module_param(bench_lengths, charp, 0444);
+MODULE_PARM_DESC(bench_lengths, "Comma-separated prefix lengths, used round-robin");
+
+static unsigned int bench_lookups = 1000000;
+module_param(bench_lookups, uint, 0444);
+MODULE_PARM_DESC(bench_lookups, "Timed lookups per measurement");
+
+#define NAT_TEST_IFNAME "sntest0"
+#define NAT_TEST_IFINDEX 1000
+
+struct nat_test_engine {
+    bool trie;
+    const char *name;
+};
+
+static const struct nat_test_engine nat_test_engines[] = {
+    { .trie = false, .name = "hash" },
+    { .trie = true, .name = "trie" },
+};
+
+static void nat_test_engine_desc(const struct nat_test_engine *e, char *desc) {
+    strscpy(desc, e->name, KUNIT_PARAM_DESC_SIZE);
+}
+
+KUNIT_ARRAY_PARAM(nat_test_engine, nat_test_engines, nat_test_engine_desc);
+
+/* A stand-in namespace: enough of struct slick_nat_net for the writer
+ * paths, with no XDP map bound and no table published. */
+struct nat_test_ctx {
+    struct slick_nat_net sn_net;
+    struct nat_table *t;
+};
+
+static struct nat_test_ctx *nat_test_setup(struct kunit *test) {
+    const struct nat_test_engine *e = test->param_value;
+    struct nat_test_ctx *ctx;
+
+    ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, ctx);
+
+    /* Fixed for the module's life in production; the tests own the module. */
+    nat_use_trie = e ? e->trie : true;
+
+    mutex_init(&ctx->sn_net.mapping_mutex);
+    INIT_LIST_HEAD(&ctx->sn_net.dev_hooks);
+    ctx->sn_net.max_mappings = SLICK_NAT_MAX_MAPPINGS_LIMIT;
+    ctx->t = nat_table_alloc(&ctx->sn_net.mapping_mutex);
+    KUNIT_ASSERT_NOT_NULL(test, ctx->t);
+
+    test->priv = ctx;
+    return ctx;
+}
+
+static void nat_test_exit(struct kunit *test) {
+    struct nat_test_ctx *ctx = test->priv;
+
+    if (!ctx)
+        return;
+
+    /* Never published, so no reader can see it; the ifaces and failed
+     * mappings are on their way out through RCU. */
+    nat_table_free(ctx->t);
+    rcu_barrier();
+}
+
+static void nat_test_prefix(struct kunit *test, const char *str, struct in6_addr *addr, int *len) {
+    KUNIT_ASSERT_EQ_MSG(test, parse_ipv6_prefix(str, addr, len), 0, "prefix %s", str);
+}
+
+static void nat_test_addr(struct kunit *test, const char *str, struct in6_addr *addr) {
+    KUNIT_ASSERT_EQ_MSG(test, in6_pton(str, -1, addr->s6_addr, -1, NULL), 1, "address %s", str);
+}
+
+/* Link a mapping without the duplicate check of the proc path, as a batch
+ * replaying a table would. */
+static struct nat_mapping *nat_test_link(struct kunit *test, struct nat_test_ctx *ctx,
+                                         const char *ifname, const struct in6_addr *internal,
+                                         const struct in6_addr *external, int len, bool nptv6) {
+    struct nat_mapping *mapping;
+    int ret;
+
+    mapping = nat_mapping_alloc(ifname, internal, external, len, nptv6);
+    KUNIT_ASSERT_NOT_NULL(test, mapping);
+
+    mutex_lock(&ctx->sn_net.mapping_mutex);
+    ret = nat_mapping_link(&init_net, &ctx->sn_net, ctx->t, mapping);
+    mutex_unlock(&ctx->sn_net.mapping_mutex);
+    if (ret) {
+        synchronize_rcu();
+        nat_mapping_free(mapping);
+    }
+    KUNIT_ASSERT_EQ(test, ret, 0);
+
+    return mapping;
+}
+
+static struct nat_mapping *nat_test_add(struct kunit *test, struct nat_test_ctx *ctx,
+                                        const char *ifname, const char *internal,
+                                        const char *external) {
+    struct in6_addr int_prefix, ext_prefix;
+    int int_len, ext_len;
+
+    nat_test_prefix(test, internal, &int_prefix, &int_len);
+    nat_test_prefix(test, external, &ext_prefix, &ext_len);
+    KUNIT_ASSERT_EQ(test, int_len, ext_len);
+
+    return nat_test_link(test, ctx, ifname, &int_prefix, &ext_prefix, int_len, false);
+}
+
+static void nat_test_del(struct nat_test_ctx *ctx, struct nat_mapping *mapping) {
+    mutex_lock(&ctx->sn_net.mapping_mutex);
+    nat_mapping_unlink(&ctx->sn_net, ctx->t, mapping);
+    mutex_unlock(&ctx->sn_net.mapping_mutex);
+}
+
+/* The interface names used here do not exist, so their entries start out
+ * unbound; give them an ifindex the way the netdevice notifier would. */
+static void nat_test_bind(struct kunit *test, struct nat_test_ctx *ctx, const char *ifname,
+                          int ifindex) {
+    struct nat_iface *iface;
+
+    mutex_lock(&ctx->sn_net.mapping_mutex);
+    list_for_each_entry(iface, &ctx->t->iface_list, list) {
+        if (strncmp(iface->name, ifname, IFNAMSIZ) == 0) {
+            nat_iface_set_ifindex(&ctx->sn_net, ctx->t, iface, ifindex);
+            mutex_unlock(&ctx->sn_net.mapping_mutex);
+            return;
+        }
+    }
+    mutex_unlock(&ctx->sn_net.mapping_mutex);
+
+    KUNIT_FAIL(test, "no interface entry %s", ifname);
+}
+
+static struct nat_mapping *nat_test_find_int(struct nat_test_ctx *ctx, const struct in6_addr *a) {
+    struct nat_mapping *mapping;
+
+    /* Only compared, never dereferenced, after the unlock. */
+    rcu_read_lock();
+    mapping = __find_mapping_by_internal(ctx->t, a, NULL);
+    rcu_read_unlock();
+    return mapping;
+}
+
+static struct nat_mapping *nat_test_find_ext(struct nat_test_ctx *ctx, const struct in6_addr *a,
+                                             int ifindex) {
+    struct nat_mapping *mapping;
+
+    rcu_read_lock();
+    mapping = __find_mapping_by_external(ctx->t, a, ifindex, NULL);
+    rcu_read_unlock();
+    return mapping;
+}
+
+/* --- parse_ipv6_prefix() ------------------------------------------------- */
+
+static void nat_test_parse_prefix(struct kunit *test) {
+    static const char * const bad[] = {
+        "2001:db8::",           /* no length */
+        "2001:db8::/",
+        "2001:db8::/129",
+        "2001:db8::/-1",
+        "2001:db8::/6x",
+        "2001:db8::g/64",
+        "/64",
+        "2001:db8::/64/64",
+        "2001:0db8:0000:0000:0000:0000:0000:0000:0000:0000:0000:0000:0000/64",
+    };
+    struct in6_addr addr, expect;
+    unsigned int i;
+    int len;
+
+    nat_test_prefix(test, "2001:db8::/32", &addr, &len);
+    nat_test_addr(test, "2001:db8::", &expect);
+    KUNIT_EXPECT_EQ(test, len, 32);
+    KUNIT_EXPECT_TRUE(test, ipv6_addr_equal(&addr, &expect));
+
+    /* Host bits are cleared, so equal prefixes hash and compare equal. */
+    nat_test_prefix(test, "2001:db8:1:2:3:4:5:6/61", &addr, &len);
+    nat_test_addr(test, "2001:db8:1::", &expect);
+    KUNIT_EXPECT_EQ(test, len, 61);
+    KUNIT_EXPECT_TRUE(test, ipv6_addr_equal(&addr, &expect));
+
+    nat_test_prefix(test, "::/0", &addr, &len);
+    KUNIT_EXPECT_EQ(test, len, 0);
+    KUNIT_EXPECT_TRUE(test, ipv6_addr_any(&addr));
+
+    nat_test_prefix(test, "2001:db8::1/128", &addr, &len);
+    nat_test_addr(test, "2001:db8::1", &expect);
+    KUNIT_EXPECT_EQ(test, len, 128);
+    KUNIT_EXPECT_TRUE(test, ipv6_addr_equal(&addr, &expect));
+
+    for (i = 0; i < ARRAY_SIZE(bad); i++)
+        KUNIT_EXPECT_EQ_MSG(test, parse_ipv6_prefix(bad[i], &addr, &len), -EINVAL,
+                            "accepted %s", bad[i]);
+}
+
+/* --- address kernels ----------------------------------------------------- */
+
+/* The byte-wise versions the word kernels replaced, as the reference. */
+static bool nat_test_ref_compare(const struct in6_addr *a, const struct in6_addr *p, int len) {
+    int bytes = len / 8, bits = len % 8;
+    u8 mask = 0xff << (8 - bits);
+
+    if (memcmp(a->s6_addr, p->s6_addr, bytes))
+        return false;
+    return !bits || !((a->s6_addr[bytes] ^ p->s6_addr[bytes]) & mask);
+}
+
+static void nat_test_ref_remap(struct in6_addr *a, const struct in6_addr *p, int len) {
+    int bytes = len / 8, bits = len % 8;
+    u8 mask = 0xff << (8 - bits);
+
+    memcpy(a->s6_addr, p->s6_addr, bytes);
+    if (bits)
+        a->s6_addr[bytes] = (p->s6_addr[bytes] & mask) | (a->s6_addr[bytes] & ~mask);
+}
+
+static void nat_test_address_kernels(struct kunit *test) {
+    struct in6_addr addr, prefix, got, want;
+    int len, round;
+
+    for (len = 0; len <= 128; len++) {
+        for (round = 0; round < 64; round++) {
+            get_random_bytes(&addr, sizeof(addr));
+            get_random_bytes(&prefix, sizeof(prefix));
+            /* Every other round, a hit that only the last prefix bit can
+             * turn into a miss. */
+            if (round & 1) {
+                nat_test_ref_remap(&prefix, &addr, len);
+                if (len && (round & 2))
+                    prefix.s6_addr[(len - 1) / 8] ^= 0x80 >> ((len - 1) % 8);
+            }
+
+            KUNIT_EXPECT_EQ_MSG(test,
+                                compare_prefix_with_len(&addr, &prefix, nat_len_masks[len], len),
+                                nat_test_ref_compare(&addr, &prefix, len), "/%d", len);
+
+            got = want = addr;
+            remap_address_with_len(&got, &prefix, nat_len_masks[len], len);
+            nat_test_ref_remap(&want, &prefix, len);
+            KUNIT_EXPECT_TRUE_MSG(test, ipv6_addr_equal(&got, &want), "remap /%d", len);
+
+            nat_addr_mask(&got, &addr, len);
+            ipv6_addr_prefix(&want, &addr, len);
+            KUNIT_EXPECT_TRUE_MSG(test, ipv6_addr_equal(&got, &want), "mask /%d", len);
+        }
+    }
+}
+
+/* --- lookups ------------------------------------------------------------- */
+
+static void nat_test_find_internal(struct kunit *test) {
+    struct nat_test_ctx *ctx = nat_test_setup(test);
+    struct nat_mapping *a, *b;
+    struct in6_addr addr;
+
+    a = nat_test_add(test, ctx, "sntest0", "fd00:1::/64", "2001:db8:1::/64");
+    b = nat_test_add(test, ctx, "sntest1", "fd00:2::/48", "2001:db8:2::/48");
+
+    nat_test_addr(test, "fd00:1::1234", &addr);
+    KUNIT_EXPECT_PTR_EQ(test, nat_test_find_int(ctx, &addr), a);
+    nat_test_addr(test, "fd00:2:ffff:1::1", &addr);
+    KUNIT_EXPECT_PTR_EQ(test, nat_test_find_int(ctx, &addr), b);
+
+    /* Just outside each prefix. */
+    nat_test_addr(test, "fd00:1:0:1::1", &addr);
+    KUNIT_EXPECT_NULL(test, nat_test_find_int(ctx, &addr));
+    nat_test_addr(test, "fd00:3::1", &addr);
+    KUNIT_EXPECT_NULL(test, nat_test_find_int(ctx, &addr));
+    /* External addresses are not internal ones. */
+    nat_test_addr(test, "2001:db8:1::1", &addr);
+    KUNIT_EXPECT_NULL(test, nat_test_find_int(ctx, &addr));
+
+    nat_test_del(ctx, a);
+    nat_test_addr(test, "fd00:1::1234", &addr);
+    KUNIT_EXPECT_NULL(test, nat_test_find_int(ctx, &addr));
+}
+
+static void nat_test_find_external(struct kunit *test) {
+    struct nat_test_ctx *ctx = nat_test_setup(test);
+    struct nat_mapping *a, *b, *c;
+    struct in6_addr addr;
+
+    a = nat_test_add(test, ctx, "sntest0", "fd00:1::/64", "2001:db8:1::/64");
+    b = nat_test_add(test, ctx, "sntest1", "fd00:2::/64", "2001:db8:1::/64");
+    c = nat_test_add(test, ctx, "sntest2", "fd00:3::/64", "2001:db8:3::/64");
+
+    /* Unbound interfaces match nothing. */
+    nat_test_addr(test, "2001:db8:1::1", &addr);
+    KUNIT_EXPECT_NULL(test, nat_test_find_ext(ctx, &addr, 10));
+
+    nat_test_bind(test, ctx, "sntest0", 10);
+    nat_test_bind(test, ctx, "sntest1", 11);
+
+    /* The same external prefix resolves per ingress interface. */
+    KUNIT_EXPECT_PTR_EQ(test, nat_test_find_ext(ctx, &addr, 10), a);
+    KUNIT_EXPECT_PTR_EQ(test, nat_test_find_ext(ctx, &addr, 11), b);
+    KUNIT_EXPECT_NULL(test, nat_test_find_ext(ctx, &addr, 12));
+
+    nat_test_addr(test, "2001:db8:3::1", &addr);
+    KUNIT_EXPECT_NULL(test, nat_test_find_ext(ctx, &addr, 10));
+    nat_test_bind(test, ctx, "sntest2", 12);
+    KUNIT_EXPECT_PTR_EQ(test, nat_test_find_ext(ctx, &addr, 12), c);
+
+    /* Unbinding (device gone) takes the interface's prefixes with it. */
+    nat_test_bind(test, ctx, "sntest2", 0);
+    KUNIT_EXPECT_NULL(test, nat_test_find_ext(ctx, &addr, 12));
+
+    /* The any-interface lookup behind the NDP proxy sees bound and unbound
+     * interfaces alike. */
+    rcu_read_lock();
+    KUNIT_EXPECT_PTR_EQ(test, __find_mapping_by_external_any(ctx->t, &addr), c);
+    rcu_read_unlock();
+}
+
+static void nat_test_longest_match(struct kunit *test) {
+    struct nat_test_ctx *ctx = nat_test_setup(test);
+    struct nat_mapping *m48, *m56, *m64, *m128, *dup;
+    struct in6_addr addr;
+
+    /* Added shortest last, so insertion order cannot fake the result. */
+    m128 = nat_test_add(test, ctx, "sntest0", "fd00:1:2:3::9/128", "2001:db8:f::9/128");
+    m64 = nat_test_add(test, ctx, "sntest0", "fd00:1:2:3::/64", "2001:db8:c:3::/64");
+    m56 = nat_test_add(test, ctx, "sntest0", "fd00:1:2::/56", "2001:db8:b::/56");
+    m48 = nat_test_add(test, ctx, "sntest0", "fd00:1::/48", "2001:db8:a::/48");
+    nat_test_bind(test, ctx, "sntest0", 10);
+
+    nat_test_addr(test, "fd00:1:2:3::9", &addr);
+    KUNIT_EXPECT_PTR_EQ(test, nat_test_find_int(ctx, &addr), m128);
+    nat_test_addr(test, "fd00:1:2:3::8", &addr);
+    KUNIT_EXPECT_PTR_EQ(test, nat_test_find_int(ctx, &addr), m64);
+    nat_test_addr(test, "fd00:1:2:ff::1", &addr);
+    KUNIT_EXPECT_PTR_EQ(test, nat_test_find_int(ctx, &addr), m56);
+    nat_test_addr(test, "fd00:1:3::1", &addr);
+    KUNIT_EXPECT_PTR_EQ(test, nat_test_find_int(ctx, &addr), m48);
+
+    nat_test_addr(test, "2001:db8:c:3::1", &addr);
+    KUNIT_EXPECT_PTR_EQ(test, nat_test_find_ext(ctx, &addr, 10), m64);
+
+    /* Removing the most specific match falls back to the next one. */
+    nat_test_del(ctx, m64);
+    nat_test_addr(test, "fd00:1:2:3::8", &addr);
+    KUNIT_EXPECT_PTR_EQ(test, nat_test_find_int(ctx, &addr), m56);
+
+    /* The same internal prefix on two interfaces: the most recently added
+     * wins, and the older one takes over when it goes. */
+    dup = nat_test_add(test, ctx, "sntest1", "fd00:1::/48", "2001:db8:d::/48");
+    nat_test_addr(test, "fd00:1:3::1", &addr);
+    KUNIT_EXPECT_PTR_EQ(test, nat_test_find_int(ctx, &addr), dup);
+    nat_test_del(ctx, dup);
+    KUNIT_EXPECT_PTR_EQ(test, nat_test_find_int(ctx, &addr), m48);
+}
+
+static void nat_test_remap_roundtrip(struct kunit *test) {
+    struct nat_test_ctx *ctx = nat_test_setup(test);
+    struct nat_xlate out, in;
+    struct in6_addr addr, orig;
+    int len;
+
+    for (len = 8; len <= 64; len += 8) {
+        struct in6_addr int_prefix, ext_prefix;
+        struct nat_mapping *mapping;
+        bool nptv6 = len & 8;
+
+        get_random_bytes(&int_prefix, sizeof(int_prefix));
+        get_random_bytes(&ext_prefix, sizeof(ext_prefix));
+        ipv6_addr_prefix(&int_prefix, &int_prefix, len);
+        ipv6_addr_prefix(&ext_prefix, &ext_prefix, len);
+        mapping = nat_test_link(test, ctx, "sntest0", &int_prefix, &ext_prefix, len, nptv6);
+
+        nat_xlate_set(&out, mapping, false);
+        nat_xlate_set(&in, mapping, true);
+
+        get_random_bytes(&orig, sizeof(orig));
+        remap_address_with_len(&orig, &int_prefix, nat_len_masks[len], len);
+        /* NPTv6 adjusts the first word after the prefix that is not 0xffff,
+         * and refuses the address if there is none (nat_test_nptv6_reject).
+         * Only the first candidate is left to chance here. */
+        if (nptv6 && orig.s6_addr16[len <= 48 ? 3 : 4] == htons(0xffff))
+            orig.s6_addr16[len <= 48 ? 3 : 4] = 0;
+        addr = orig;
+
+        KUNIT_ASSERT_TRUE(test, nat_remap(&addr, &out));
+        KUNIT_EXPECT_TRUE(test, compare_prefix_with_len(&addr, &ext_prefix,
+                                                        nat_len_masks[len], len));
+        /* Checksum-neutral: the one's complement sum is unchanged. */
+        if (nptv6)
+            KUNIT_EXPECT_EQ_MSG(test, csum_fold(csum_partial(&addr, sizeof(addr), 0)),
+                                csum_fold(csum_partial(&orig, sizeof(orig), 0)),
+                                "NPTv6 /%d changed the address sum", len);
+
+        KUNIT_ASSERT_TRUE(test, nat_remap(&addr, &in));
+        KUNIT_EXPECT_TRUE_MSG(test, ipv6_addr_equal(&addr, &orig), "round trip /%d%s", len,
+                              nptv6 ? " nptv6" : "");
+
+        nat_test_del(ctx, mapping);
+    }
+}
+
+static void nat_test_nptv6_reject(struct kunit *test) {
+    struct nat_test_ctx *ctx = nat_test_setup(test);
+    struct nat_mapping *m48, *m56;
+    struct in6_addr int_prefix, ext_prefix, addr, orig;
+    struct nat_xlate out;
+
+    /* Up to /48 only the subnet word is adjusted. */
+    nat_test_addr(test, "fd00:1:2::", &int_prefix);
+    nat_test_addr(test, "2001:db8:a::", &ext_prefix);
+    m48 = nat_test_link(test, ctx, "sntest0", &int_prefix, &ext_prefix, 48, true);
+    nat_xlate_set(&out, m48, false);
+
+    nat_test_addr(test, "fd00:1:2:ffff::1", &orig);
+    addr = orig;
+    KUNIT_EXPECT_FALSE(test, nat_remap(&addr, &out));
+    KUNIT_EXPECT_TRUE(test, ipv6_addr_equal(&addr, &orig));
+
+    nat_test_addr(test, "fd00:1:2:fffe::1", &addr);
+    KUNIT_EXPECT_TRUE(test, nat_remap(&addr, &out));
+    nat_test_del(ctx, m48);
+
+    /* Longer prefixes fall through the interface identifier, and only an
+     * all-ones one is refused. */
+    nat_test_addr(test, "fd00:1:2:300::", &int_prefix);
+    nat_test_addr(test, "2001:db8:a:b00::", &ext_prefix);
+    m56 = nat_test_link(test, ctx, "sntest0", &int_prefix, &ext_prefix, 56, true);
+    nat_xlate_set(&out, m56, false);
+
+    nat_test_addr(test, "fd00:1:2:3ff:ffff:ffff:ffff:ffff", &orig);
+    addr = orig;
+    KUNIT_EXPECT_FALSE(test, nat_remap(&addr, &out));
+    KUNIT_EXPECT_TRUE(test, ipv6_addr_equal(&addr, &orig));
+
+    nat_test_addr(test, "fd00:1:2:3ff:ffff:ffff:ffff:1", &orig);
+    addr = orig;
+    KUNIT_EXPECT_TRUE(test, nat_remap(&addr, &out));
+    KUNIT_EXPECT_EQ(test, addr.s6_addr16[4], htons(0xffff));
+    KUNIT_EXPECT_EQ(test, addr.s6_addr16[6], htons(0xffff));
+    KUNIT_EXPECT_EQ(test, csum_fold(csum_partial(&addr, sizeof(addr), 0)),
+                    csum_fold(csum_partial(&orig, sizeof(orig), 0)));
+    nat_test_del(ctx, m56);
+}
+
+/* --- benchmark ----------------------------------------------------------- */
+
+static int nat_test_bench_lengths(struct kunit *test, int *lens, int max) {
+    char *buf, *p, *tok;
+    int n = 0, len;
+
+    buf = kunit_kstrdup(test, bench_lengths, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, buf);
+
+    p = buf;
+    while ((tok = strsep(&p, ",")) && n < max) {
+        if (kstrtoint(tok, 10, &len) || len < 8 || len > 128) {
+            KUNIT_FAIL(test, "bad length \"%s\" in bench_lengths", tok);
+            return 0;
+        }
+        lens[n++] = len;
+    }
+
+    return n;
+}
+
+/* A random address under a mapping's prefix, or, for a miss, under a /8
+ * the benchmark never maps. */
+static void nat_test_bench_addr(struct in6_addr *addr, const struct in6_addr *prefix, int len) {
+    get_random_bytes(addr, sizeof(*addr));
+    if (prefix)
+        remap_address_with_len(addr, prefix, nat_len_masks[len], len);
+    else
+        addr->s6_addr[0] = 0x3f;
+}
+
+#define NAT_TEST_BENCH_ADDRS 4096
+
+static u64 nat_test_bench_run(struct nat_test_ctx *ctx, const struct in6_addr *addrs,
+                              bool external) {
+    struct nat_mapping *hit;
+    unsigned int i, found = 0;
+    u64 start, elapsed;
+
+    rcu_read_lock();
+    start = ktime_get_ns();
+    for (i = 0; i < bench_lookups; i++) {
+        const struct in6_addr *a = &addrs[i & (NAT_TEST_BENCH_ADDRS - 1)];
+
+        hit = external ? __find_mapping_by_external(ctx->t, a, NAT_TEST_IFINDEX, NULL) :
+                         __find_mapping_by_internal(ctx->t, a, NULL);
+        found += hit != NULL;
+    }
+    elapsed = ktime_get_ns() - start;
+    rcu_read_unlock();
+
+    /* Keep the loop from being optimised away. */
+    WRITE_ONCE(ctx->sn_net.xdp_err, found);
+    return div_u64(elapsed, bench_lookups ?: 1);
+}
+
+/* Bucket count and chain lengths of one hash index, once a pending resize
+ * has run.  Keys are (prefix, length) pairs, so a chain holds distinct
+ * prefixes; duplicates hang off their rhlist entry and are not counted. */
+static void nat_test_bench_chains(struct kunit *test, const char *engine, const char *name,
+                                  struct rhltable *hlt) {
+    const struct bucket_table *tbl;
+    struct rhash_head *pos;
+    unsigned int i, n, used = 0, longest = 0;
+    u64 total = 0;
+
+    flush_work(&hlt->ht.run_work);
+
+    rcu_read_lock();
+    tbl = rht_dereference_rcu(hlt->ht.tbl, &hlt->ht);
+    for (i = 0; i < tbl->size; i++) {
+        n = 0;
+        rht_for_each_rcu(pos, tbl, i)
+            n++;
+        total += n;
+        used += n != 0;
+        longest = max(longest, n);
+    }
+    kunit_info(test, "%s: %s chains: %u buckets, %u used, mean %llu.%02llu, longest %u\n",
+               engine, name, tbl->size, used, div_u64(total, used ?: 1),
+               div_u64(total * 100, used ?: 1) % 100, longest);
+    rcu_read_unlock();
+}
+
+static void nat_test_bench(struct kunit *test) {
+    const struct nat_test_engine *e = test->param_value;
+    struct nat_mapping **mappings;
+    struct in6_addr *addrs, int_prefix, ext_prefix;
+    struct nat_test_ctx *ctx;
+    u64 int_hit, int_miss, ext_hit, ext_miss;
+    int lens[16], nlens, len;
+    unsigned int i;
+    u64 start;
+
+    if (!bench_mappings)
+        kunit_skip(test, "load with bench_mappings=N to run");
+
+    nlens = nat_test_bench_lengths(test, lens, ARRAY_SIZE(lens));
+    KUNIT_ASSERT_GT(test, nlens, 0);
+
+    ctx = nat_test_setup(test);
+    mappings = kvmalloc_array(bench_mappings, sizeof(*mappings), GFP_KERNEL);
+    addrs = kvmalloc_array(NAT_TEST_BENCH_ADDRS, sizeof(*addrs), GFP_KERNEL);
+    if (!mappings || !addrs) {
+        kvfree(mappings);
+        kvfree(addrs);
+        KUNIT_FAIL(test, "out of memory");
+        return;
+    }
+
+    /* Internal prefixes under fd00::/8 and external ones under 2a00::/8,
+     * so that misses from 3f00::/8 stay misses. */
+    start = ktime_get_ns();
+    for (i = 0; i < bench_mappings; i++) {
+        len = lens[i % nlens];
+        get_random_bytes(&int_prefix, sizeof(int_prefix));
+        get_random_bytes(&ext_prefix, sizeof(ext_prefix));
+        int_prefix.s6_addr[0] = 0xfd;
+        ext_prefix.s6_addr[0] = 0x2a;
+        ipv6_addr_prefix(&int_prefix, &int_prefix, len);
+        ipv6_addr_prefix(&ext_prefix, &ext_prefix, len);
+        mappings[i] = nat_test_link(test, ctx, NAT_TEST_IFNAME, &int_prefix, &ext_prefix,
+                                    len, false);
+        cond_resched();
+    }
+    nat_test_bind(test, ctx, NAT_TEST_IFNAME, NAT_TEST_IFINDEX);
+    kunit_info(test, "%s: %u mappings, lengths %s, filled in %llu ms\n", e->name,
+               bench_mappings, bench_lengths, div_u64(ktime_get_ns() - start, NSEC_PER_MSEC));
+    if (!e->trie) {
+        nat_test_bench_chains(test, e->name, "internal", &ctx->t->internal_index);
+        nat_test_bench_chains(test, e->name, "external", &ctx->t->external_index);
+    }
+
+    for (i = 0; i < NAT_TEST_BENCH_ADDRS; i++) {
+        struct nat_mapping *m = mappings[get_random_u32_below(bench_mappings)];
+
+        nat_test_bench_addr(&addrs[i], &m->internal_prefix, m->prefix_len);
+    }
+    int_hit = nat_test_bench_run(ctx, addrs, false);
+
+    for (i = 0; i < NAT_TEST_BENCH_ADDRS; i++) {
+        struct nat_mapping *m = mappings[get_random_u32_below(bench_mappings)];
+
+        nat_test_bench_addr(&addrs[i], &m->external_prefix, m->prefix_len);
+    }
+    ext_hit = nat_test_bench_run(ctx, addrs, true);
+
+    for (i = 0; i < NAT_TEST_BENCH_ADDRS; i++)
+        nat_test_bench_addr(&addrs[i], NULL, 0);
+    int_miss = nat_test_bench_run(ctx, addrs, false);
+    ext_miss = nat_test_bench_run(ctx, addrs, true);
+
+    kunit_info(test, "%s: ns/lookup internal hit %llu miss %llu, external hit %llu miss %llu\n",
+               e->name, int_hit, int_miss, ext_hit, ext_miss);
+
+    kvfree(addrs);
+    kvfree(mappings);
+}
+
+static int nat_test_suite_init(struct kunit_suite *suite) {
+    /* slick_nat_init() does this for the module proper. */
+    nat_xlate_init();
+    return 0;
+}
+
+static struct kunit_case slick_nat_test_cases[] = {
+    KUNIT_CASE(nat_test_parse_prefix),
+    KUNIT_CASE(nat_test_address_kernels),
+    KUNIT_CASE_PARAM(nat_test_find_internal, nat_test_engine_gen_params),
+    KUNIT_CASE_PARAM(nat_test_find_external, nat_test_engine_gen_params),
+    KUNIT_CASE_PARAM(nat_test_longest_match, nat_test_engine_gen_params),
+    KUNIT_CASE_PARAM(nat_test_remap_roundtrip, nat_test_engine_gen_params),
+    KUNIT_CASE(nat_test_nptv6_reject),
+    KUNIT_CASE_PARAM_ATTR(nat_test_bench, nat_test_engine_gen_params, { .speed = KUNIT_SPEED_SLOW }),
+    {}
+};
+
+static struct kunit_suite slick_nat_test_suite = {
+    .name = "slick_nat",
+    .suite_init = nat_test_suite_init,
+    .exit = nat_test_exit,
+    .test_cases = slick_nat_test_cases,
+};
+
+kunit_test_suite(slick_nat_test_suite);
@@ -0,0 +1,249 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Just enough of the kernel for xlate.c to build in user space: the types,
+ * in6_addr helpers, jhash2() and the generic checksum helpers, plus a
+ * struct sk_buff that is nothing but a linear buffer.  Semantics follow
+ * the kernel's generic (non-arch) implementations so results compare
+ * bit for bit; speed is not the point here.
+ */
+#ifndef SLICK_NAT_USER_SHIM_H
+#define SLICK_NAT_USER_SHIM_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>     /* before the uapi headers, for libc-compat */
+#include <linux/types.h>
+#include <linux/ipv6.h>
+#include <linux/icmpv6.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define __force
+#define __percpu
+#define __read_mostly
+#ifndef __always_inline
+#define __always_inline inline __attribute__((__always_inline__))
+#endif
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define fallthrough __attribute__((__fallthrough__))
+
+#define cpu_to_be64(x) ((__force __be64)htobe64(x))
+
+/* "+ 0" drops the const of a const pointer's target type. */
+#define get_unaligned(ptr) ({                                   \
+    __typeof__(*(ptr) + 0) __v;                                 \
+    memcpy(&__v, (ptr), sizeof(__v));                           \
+    __v;                                                        \
+})
+#define put_unaligned(val, ptr) do {                            \
+    __typeof__(*(ptr) + 0) __v = (val);                         \
+    memcpy((ptr), &__v, sizeof(__v));                           \
+} while (0)
+
+/* --- in6_addr ------------------------------------------------------------ */
+
+static inline void ipv6_addr_prefix(struct in6_addr *pfx, const struct in6_addr *addr, int plen) {
+    int o = plen >> 3, b = plen & 0x7;
+
+    memset(pfx->s6_addr, 0, sizeof(pfx->s6_addr));
+    memcpy(pfx->s6_addr, addr, o);
+    if (b != 0)
+        pfx->s6_addr[o] = addr->s6_addr[o] & (0xff00 >> b);
+}
+
+/* --- jhash2(), as in include/linux/jhash.h ------------------------------- */
+
+#define JHASH_INITVAL 0xdeadbeef
+
+static inline u32 rol32(u32 word, unsigned int shift) {
+    return (word << (shift & 31)) | (word >> ((-shift) & 31));
+}
+
+#define __jhash_mix(a, b, c) {                                  \
+    a -= c;  a ^= rol32(c, 4);  c += b;                         \
+    b -= a;  b ^= rol32(a, 6);  a += c;                         \
+    c -= b;  c ^= rol32(b, 8);  b += a;                         \
+    a -= c;  a ^= rol32(c, 16); c += b;                         \
+    b -= a;  b ^= rol32(a, 19); a += c;                         \
+    c -= b;  c ^= rol32(b, 4);  b += a;                         \
+}
+
+#define __jhash_final(a, b, c) {                                \
+    c ^= b; c -= rol32(b, 14);                                  \
+    a ^= c; a -= rol32(c, 11);                                  \
+    b ^= a; b -= rol32(a, 25);                                  \
+    c ^= b; c -= rol32(b, 16);                                  \
+    a ^= c; a -= rol32(c, 4);                                   \
+    b ^= a; b -= rol32(a, 14);                                  \
+    c ^= b; c -= rol32(b, 24);                                  \
+}
+
+static inline u32 jhash2(const u32 *k, u32 length, u32 initval) {
+    u32 a, b, c;
+
+    a = b = c = JHASH_INITVAL + (length << 2) + initval;
+
+    while (length > 3) {
+        a += k[0];
+        b += k[1];
+        c += k[2];
+        __jhash_mix(a, b, c);
+        length -= 3;
+        k += 3;
+    }
+
+    switch (length) {
+    case 3:
+        c += k[2];
+        fallthrough;
+    case 2:
+        b += k[1];
+        fallthrough;
+    case 1:
+        a += k[0];
+        __jhash_final(a, b, c);
+        break;
+    case 0:
+        break;
+    }
+
+    return c;
+}
+
+/* --- checksums, as in lib/checksum.c and include/net/checksum.h ---------- */
+
+#define CSUM_MANGLED_0 ((__force __sum16)0xffff)
+
+static inline __wsum csum_partial(const void *buff, int len, __wsum wsum) {
+    const u8 *p = buff;
+    u64 sum = (__force u32)wsum;
+    u16 w;
+
+    for (; len > 1; len -= 2, p += 2) {
+        memcpy(&w, p, 2);
+        sum += w;
+    }
+    if (len) {
+        w = 0;
+        memcpy(&w, p, 1);
+        sum += w;
+    }
+    while (sum >> 32)
+        sum = (sum & 0xffffffff) + (sum >> 32);
+
+    return (__force __wsum)sum;
+}
+
+static inline __wsum csum_add(__wsum csum, __wsum addend) {
+    u32 res = (__force u32)csum;
+
+    res += (__force u32)addend;
+    return (__force __wsum)(res + (res < (__force u32)addend));
+}
+
+static inline __sum16 csum_fold(__wsum csum) {
+    u32 sum = (__force u32)csum;
+
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (__force __sum16)~sum;
+}
+
+static inline __wsum csum_unfold(__sum16 n) {
+    return (__force __wsum)n;
+}
+
+static inline __sum16 csum_ipv6_magic(const struct in6_addr *saddr, const struct in6_addr *daddr,
+                                      u32 len, u8 proto, __wsum csum) {
+    csum = csum_partial(saddr, sizeof(*saddr), csum);
+    csum = csum_partial(daddr, sizeof(*daddr), csum);
+    csum = csum_add(csum, (__force __wsum)htonl(len));
+    csum = csum_add(csum, (__force __wsum)htonl(proto));
+    return csum_fold(csum);
+}
+
+/* --- sk_buff: one linear buffer, data at the IPv6 header ------------------ */
+
+#define CHECKSUM_NONE 0
+#define CHECKSUM_UNNECESSARY 1
+#define CHECKSUM_COMPLETE 2
+#define CHECKSUM_PARTIAL 3
+
+struct sk_buff {
+    unsigned char *data;
+    unsigned int len;
+    u8 ip_summed;
+    __wsum csum;
+};
+
+static inline struct ipv6hdr *ipv6_hdr(const struct sk_buff *skb) {
+    return (struct ipv6hdr *)skb->data;
+}
+
+static inline __wsum skb_checksum(const struct sk_buff *skb, int offset, int len, __wsum csum) {
+    return csum_partial(skb->data + offset, len, csum);
+}
+
+#define IP6_OFFSET 0xFFF8
+
+static inline bool ipv6_ext_hdr(u8 nexthdr) {
+    return nexthdr == 0 ||      /* hop-by-hop */
+           nexthdr == 43 ||     /* routing */
+           nexthdr == 44 ||     /* fragment */
+           nexthdr == 51 ||     /* authentication */
+           nexthdr == 59 ||     /* no next header */
+           nexthdr == 60;       /* destination options */
+}
+
+/* net/ipv6/exthdrs_core.c, reading the linear buffer directly. */
+static inline int ipv6_skip_exthdr(const struct sk_buff *skb, int start, u8 *nexthdrp,
+                                   __be16 *frag_offp) {
+    u8 nexthdr = *nexthdrp;
+
+    *frag_offp = 0;
+
+    while (ipv6_ext_hdr(nexthdr)) {
+        const u8 *hp;
+        int hdrlen;
+
+        if (nexthdr == 59)
+            return -1;
+        if (start + 2 > (int)skb->len)
+            return -1;
+        hp = skb->data + start;
+
+        if (nexthdr == 44) {
+            if (start + 4 > (int)skb->len)
+                return -1;
+            memcpy(frag_offp, hp + 2, sizeof(*frag_offp));
+            if (ntohs(*frag_offp) & ~0x7)
+                break;
+            hdrlen = 8;
+        } else if (nexthdr == 51) {
+            hdrlen = (hp[1] + 2) << 2;
+        } else {
+            hdrlen = (hp[1] + 1) << 3;
+        }
+
+        nexthdr = hp[0];
+        start += hdrlen;
+    }
+
+    *nexthdrp = nexthdr;
+    return start;
+}
+
+#endif
@@ -0,0 +1,180 @@
+#include <linux/kernel.h>
+#include <linux/bpf.h>
+#include <linux/err.h>
+#include <linux/file.h>
+#include <linux/rcupdate.h>
+#include <linux/preempt.h>
+#include <linux/sched.h>
+#include <net/ipv6.h>
+#include "xdp-sync.h"
+#include "slick-nat-xdp.h"
+
+#ifdef CONFIG_BPF_SYSCALL
+
+static void nat_xdp_key(struct slick_nat_xdp_key *key, int ifindex,
+                        const struct in6_addr *prefix, int prefix_len) {
+    struct in6_addr masked;
+
+    memset(key, 0, sizeof(*key));
+    key->prefixlen = SLICK_NAT_XDP_IFINDEX_BITS + prefix_len;
+    key->ifindex = ifindex;
+    ipv6_addr_prefix(&masked, prefix, prefix_len);
+    memcpy(key->addr, masked.s6_addr, sizeof(key->addr));
+}
+
+/* Take a reference on the map behind a file descriptor of the calling
+ * process and check that it has the layout the XDP program expects.  The
+ * module writes the map on the caller's behalf, so the descriptor must
+ * allow writing, as BPF_MAP_UPDATE_ELEM would require. */
+struct bpf_map *nat_xdp_map_get(int fd) {
+    struct bpf_map *map;
+    struct file *file;
+    bool writable;
+
+    file = fget(fd);
+    if (!file)
+        return ERR_PTR(-EBADF);
+    writable = file->f_mode & FMODE_CAN_WRITE;
+
+    map = bpf_map_get(fd);
+    if (IS_ERR(map)) {
+        fput(file);
+        return map;
+    }
+
+    /* The descriptor may have been replaced in between; the file checked
+     * must be the one the map came from. */
+    if (file->private_data != map) {
+        fput(file);
+        bpf_map_put(map);
+        return ERR_PTR(-EBADF);
+    }
+    fput(file);
+
+    if (!writable || READ_ONCE(map->frozen)) {
+        bpf_map_put(map);
+        return ERR_PTR(-EPERM);
+    }
+
+    if (map->map_type != BPF_MAP_TYPE_LPM_TRIE ||
+        map->key_size != sizeof(struct slick_nat_xdp_key) ||
+        map->value_size != sizeof(struct slick_nat_xdp_value)) {
+        bpf_map_put(map);
+        return ERR_PTR(-EINVAL);
+    }
+
+    return map;
+}
+
+void nat_xdp_map_put(struct bpf_map *map) {
+    bpf_map_put(map);
+}
+
+u32 nat_xdp_map_id(const struct bpf_map *map) {
+    return map->id;
+}
+
+u32 nat_xdp_map_max_entries(const struct bpf_map *map) {
+    return map->max_entries;
+}
+
+/* The map operations expect what the bpf() syscall provides around them:
+ * an RCU read-side section on a CPU we cannot migrate away from. */
+int nat_xdp_update(struct bpf_map *map, int ifindex, const struct in6_addr *prefix,
+                   int prefix_len, const struct in6_addr *to, u32 flags, u16 adjust) {
+    static const struct in6_addr all_ones = {
+        .s6_addr32 = { ~0U, ~0U, ~0U, ~0U },
+    };
+    struct slick_nat_xdp_value val;
+    struct slick_nat_xdp_key key;
+    struct in6_addr mask;
+    int ret;
+
+    nat_xdp_key(&key, ifindex, prefix, prefix_len);
+
+    memset(&val, 0, sizeof(val));
+    ipv6_addr_prefix(&mask, &all_ones, prefix_len);
+    memcpy(val.to, to, sizeof(val.to));
+    memcpy(val.mask, &mask, sizeof(val.mask));
+    val.flags = flags;
+    if (flags & SLICK_NAT_XDP_F_NPTV6) {
+        val.adjust = adjust;
+        val.adjust_first = prefix_len <= 48 ? 3 : 4;
+        val.adjust_last = prefix_len <= 48 ? 3 : 7;
+    }
+
+    migrate_disable();
+    rcu_read_lock();
+    ret = map->ops->map_update_elem(map, &key, &val, BPF_ANY);
+    rcu_read_unlock();
+    migrate_enable();
+
+    return ret;
+}
+
+void nat_xdp_delete(struct bpf_map *map, int ifindex, const struct in6_addr *prefix,
+                    int prefix_len) {
+    struct slick_nat_xdp_key key;
+
+    nat_xdp_key(&key, ifindex, prefix, prefix_len);
+
+    migrate_disable();
+    rcu_read_lock();
+    map->ops->map_delete_elem(map, &key);
+    rcu_read_unlock();
+    migrate_enable();
+}
+
+/* Remove every entry, whoever put it there, in no particular order.  Taking
+ * a longer prefix out before a shorter one that covers it briefly exposes
+ * the shorter one, so this is only used on maps that hold nothing of ours:
+ * freshly bound ones, and after our own entries were removed in order. */
+void nat_xdp_flush(struct bpf_map *map) {
+    struct slick_nat_xdp_key key;
+    int ret;
+
+    for (;;) {
+        migrate_disable();
+        rcu_read_lock();
+        ret = map->ops->map_get_next_key(map, NULL, &key);
+        if (ret == 0)
+            map->ops->map_delete_elem(map, &key);
+        rcu_read_unlock();
+        migrate_enable();
+
+        if (ret)
+            break;
+        cond_resched();
+    }
+}
+
+#else /* !CONFIG_BPF_SYSCALL */
+
+struct bpf_map *nat_xdp_map_get(int fd) {
+    return ERR_PTR(-EOPNOTSUPP);
+}
+
+void nat_xdp_map_put(struct bpf_map *map) {
+}
+
+u32 nat_xdp_map_id(const struct bpf_map *map) {
+    return 0;
+}
+
+u32 nat_xdp_map_max_entries(const struct bpf_map *map) {
+    return 0;
+}
+
+int nat_xdp_update(struct bpf_map *map, int ifindex, const struct in6_addr *prefix,
+                   int prefix_len, const struct in6_addr *to, u32 flags, u16 adjust) {
+    return -EOPNOTSUPP;
+}
+
+void nat_xdp_delete(struct bpf_map *map, int ifindex, const struct in6_addr *prefix,
+                    int prefix_len) {
+}
+
+void nat_xdp_flush(struct bpf_map *map) {
+}
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef XDP_SYNC_H
+#define XDP_SYNC_H
+
+#include <linux/types.h>
+#include <linux/in6.h>
+
+struct bpf_map;
+
+/*
+ * Writer side of the XDP prefix map (see slick-nat-xdp.h).  Only the module
+ * writes the map; the XDP program just reads it.  Callers serialize
+ * updates themselves (mapping_mutex).
+ */
+struct bpf_map *nat_xdp_map_get(int fd);
+void nat_xdp_map_put(struct bpf_map *map);
+u32 nat_xdp_map_id(const struct bpf_map *map);
+u32 nat_xdp_map_max_entries(const struct bpf_map *map);
+int nat_xdp_update(struct bpf_map *map, int ifindex, const struct in6_addr *prefix,
+                   int prefix_len, const struct in6_addr *to, u32 flags, u16 adjust);
+void nat_xdp_delete(struct bpf_map *map, int ifindex, const struct in6_addr *prefix,
+                    int prefix_len);
+void nat_xdp_flush(struct bpf_map *map);
+
+#endif
@@ -0,0 +1,242 @@
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/ipv6.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <linux/icmpv6.h>
+#include <linux/jhash.h>
+#include <net/ipv6.h>
+#include <net/checksum.h>
+#include <net/ip6_checksum.h>
+#endif
+#include "xlate.h"
+
+__be64 nat_len_masks[129][2] __read_mostly;
+
+void nat_prefix_mask(__be64 mask[2], int prefix_len) {
+    mask[0] = cpu_to_be64(prefix_len >= 64 ? ~0ULL :
+                          prefix_len ? ~0ULL << (64 - prefix_len) : 0);
+    mask[1] = cpu_to_be64(prefix_len >= 128 ? ~0ULL :
+                          prefix_len > 64 ? ~0ULL << (128 - prefix_len) : 0);
+}
+
+void nat_xlate_init(void) {
+    int len;
+
+    for (len = 0; len <= 128; len++)
+        nat_prefix_mask(nat_len_masks[len], len);
+}
+
+/* One's complement 16-bit addition, the arithmetic of the Internet
+ * checksum. */
+static u16 nat_csum16_add(u16 a, u16 b) {
+    u32 sum = (u32)a + b;
+
+    return (sum & 0xffff) + (sum >> 16);
+}
+
+static u16 nat_prefix_csum16(const struct in6_addr *prefix, int prefix_len) {
+    struct in6_addr masked;
+    u16 sum = 0;
+    int i;
+
+    ipv6_addr_prefix(&masked, prefix, prefix_len);
+    for (i = 0; i < 8; i++)
+        sum = nat_csum16_add(sum, ntohs(masked.s6_addr16[i]));
+
+    return sum;
+}
+
+/* How the sum of an address changes when prefix from is replaced by to;
+ * the bits outside the prefix cancel out.  RFC 6296 section 3.3 uses the
+ * same quantity for its adjustment. */
+u16 nat_csum_delta(const struct in6_addr *from, const struct in6_addr *to, int prefix_len) {
+    return nat_csum16_add(nat_prefix_csum16(to, prefix_len),
+                          ~nat_prefix_csum16(from, prefix_len));
+}
+
+/*
+ * Checksum-neutral remap (RFC 6296 sections 3.4 and 3.5).  Up to /48 the
+ * subnet word (bits 48-63) takes the adjustment, up to /64 the first
+ * interface identifier word that is not 0xffff.  Returns false, with the
+ * address untouched, when no word qualifies.
+ */
+bool nat_nptv6_remap(struct in6_addr *addr, const struct in6_addr *new_prefix,
+                     const __be64 mask[2], int prefix_len, u16 adjust) {
+    int i = prefix_len <= 48 ? 3 : 4;
+    int last = prefix_len <= 48 ? 3 : 7;
+    u16 word;
+
+    while (i <= last && addr->s6_addr16[i] == htons(0xffff))
+        i++;
+    if (i > last)
+        return false;
+
+    remap_address_with_len(addr, new_prefix, mask, prefix_len);
+    word = nat_csum16_add(ntohs(addr->s6_addr16[i]), adjust);
+    /* 0xffff and 0 are both zero in one's complement; keep 0xffff out so
+     * the reverse translation picks the same word. */
+    if (word == 0xffff)
+        word = 0;
+    addr->s6_addr16[i] = htons(word);
+
+    return true;
+}
+
+/* Hash of an index key.  Lookups mask the packet address down to the
+ * length being probed, so it hashes like the stored prefix that covers
+ * it. */
+u32 nat_hkey_hash(const struct in6_addr *prefix, u32 len, u32 seed) {
+    return jhash2((const u32 *)prefix->s6_addr32, 4, seed ^ len);
+}
+
+/* Locate the transport header, skipping any extension headers.  Returns a
+ * negative value if the chain could not be parsed. */
+int nat_transport_offset(struct sk_buff *skb, u8 *proto, bool *first_frag) {
+    __be16 frag_off = 0;
+    u8 nexthdr = ipv6_hdr(skb)->nexthdr;
+    int off;
+
+    /* The common case: no extension headers to walk. */
+    if (likely(nexthdr == IPPROTO_TCP || nexthdr == IPPROTO_UDP ||
+               nexthdr == IPPROTO_ICMPV6)) {
+        *proto = nexthdr;
+        *first_frag = true;
+        return sizeof(struct ipv6hdr);
+    }
+
+    off = ipv6_skip_exthdr(skb, sizeof(struct ipv6hdr), &nexthdr, &frag_off);
+    if (off < 0)
+        return off;
+
+    *proto = nexthdr;
+    /* Only the first fragment carries the transport checksum field. */
+    *first_frag = (frag_off & htons(IP6_OFFSET)) == 0;
+    return off;
+}
+
+/* Add a pseudo-header change to a transport checksum, as
+ * inet_proto_csum_replace4(..., true) does, but for the whole address in
+ * one step. */
+static void nat_csum_apply(__sum16 *check, struct sk_buff *skb, __wsum diff) {
+    if (skb->ip_summed != CHECKSUM_PARTIAL) {
+        *check = csum_fold(csum_add(diff, ~csum_unfold(*check)));
+        if (skb->ip_summed == CHECKSUM_COMPLETE)
+            skb->csum = ~csum_add(diff, ~skb->csum);
+    } else {
+        *check = ~csum_fold(csum_add(diff, csum_unfold(*check)));
+    }
+}
+
+/* Incremental transport checksum fixup for an outer address change.  The
+ * addresses are part of the transport pseudo-header, so the change is the
+ * mapping's precomputed delta, whatever the rest of the address is. */
+static void update_csum(struct sk_buff *skb, int thoff, u8 proto, bool first_frag, u16 delta) {
+    __sum16 *check = NULL;
+    bool udp = false;
+
+    /* Non-initial fragments carry no transport header to fix up; the
+     * checksum lives in the first fragment and is corrected there. */
+    if (!first_frag || thoff < (int)sizeof(struct ipv6hdr))
+        return;
+
+    switch (proto) {
+    case IPPROTO_TCP:
+        if (skb->len < thoff + sizeof(struct tcphdr))
+            return;
+        check = &((struct tcphdr *)(skb->data + thoff))->check;
+        break;
+    case IPPROTO_UDP:
+    case IPPROTO_UDPLITE: {
+        struct udphdr *udph;
+
+        if (skb->len < thoff + sizeof(struct udphdr))
+            return;
+        udph = (struct udphdr *)(skb->data + thoff);
+        /* A zero UDP checksum is illegal in IPv6, but leave it alone if
+         * present rather than turning garbage into a "valid" checksum. */
+        if (udph->check == 0)
+            return;
+        check = &udph->check;
+        udp = true;
+        break;
+    }
+    case IPPROTO_ICMPV6:
+        if (skb->len < thoff + sizeof(struct icmp6hdr))
+            return;
+        check = &((struct icmp6hdr *)(skb->data + thoff))->icmp6_cksum;
+        break;
+    default:
+        return;
+    }
+
+    /* The delta is a sum of host-order words; in network order it is
+     * what csum_partial() would have produced over the address bytes. */
+    nat_csum_apply(check, skb, (__force __wsum)(u32)htons(delta));
+
+    /* 0 means "no checksum" for UDP; send the equivalent 0xffff. */
+    if (udp && !*check && skb->ip_summed != CHECKSUM_PARTIAL)
+        *check = CSUM_MANGLED_0;
+}
+
+/* Rewrite one outer address, fixing up the transport checksum unless the
+ * mapping is checksum-neutral. */
+bool nat_rewrite_addr(struct sk_buff *skb, int thoff, u8 proto, bool first_frag,
+                      struct in6_addr *addr, const struct nat_xlate *x) {
+    if (!nat_remap(addr, x))
+        return false;
+    if (!x->nptv6)
+        update_csum(skb, thoff, proto, first_frag, x->csum_delta);
+
+    return true;
+}
+
+/* Translate the IPv6 header embedded in an ICMPv6 error message, given the
+ * lookups for its source and destination.  The outer ICMPv6 checksum is
+ * left to nat_icmp6_csum_recalc(). */
+bool nat_xlate_embedded(struct sk_buff *skb, int thoff, const struct nat_xlate *xs,
+                        const struct nat_xlate *xd) {
+    struct ipv6hdr *embedded_iph;
+    bool translated = false;
+    int emb_off = thoff + sizeof(struct icmp6hdr);
+
+    if (skb->len < emb_off + sizeof(struct ipv6hdr))
+        return false;
+
+    embedded_iph = (struct ipv6hdr *)(skb->data + emb_off);
+
+    if (xs->valid && compare_prefix_with_len(&embedded_iph->saddr, &xs->from_prefix,
+                                             xs->prefix_mask, xs->prefix_len) &&
+        nat_remap(&embedded_iph->saddr, xs))
+        translated = true;
+
+    if (xd->valid && compare_prefix_with_len(&embedded_iph->daddr, &xd->from_prefix,
+                                             xd->prefix_mask, xd->prefix_len) &&
+        nat_remap(&embedded_iph->daddr, xd))
+        translated = true;
+
+    return translated;
+}
+
+/* Recompute the ICMPv6 checksum from scratch.  Used after the embedded
+ * packet of an ICMPv6 error has been rewritten, mirroring what
+ * nf_nat_icmpv6_reply_translation() does. */
+void nat_icmp6_csum_recalc(struct sk_buff *skb, int thoff) {
+    struct ipv6hdr *iph = ipv6_hdr(skb);
+    struct icmp6hdr *icmp6h;
+    unsigned int len;
+
+    if (skb->ip_summed == CHECKSUM_PARTIAL)
+        return;
+    if (skb->len < thoff + sizeof(struct icmp6hdr))
+        return;
+
+    icmp6h = (struct icmp6hdr *)(skb->data + thoff);
+    len = skb->len - thoff;
+
+    icmp6h->icmp6_cksum = 0;
+    icmp6h->icmp6_cksum = csum_ipv6_magic(&iph->saddr, &iph->daddr, len, IPPROTO_ICMPV6,
+                                          skb_checksum(skb, thoff, len, 0));
+    if (skb->ip_summed == CHECKSUM_COMPLETE)
+        skb->ip_summed = CHECKSUM_NONE;
+}
@@ -0,0 +1,145 @@
+#ifndef XLATE_H
+#define XLATE_H
+
+/*
+ * Translation core: prefix compare/remap, the index hash, NPTv6 and the
+ * checksum fixups.  Plain data manipulation on addresses and linear packet
+ * bytes, so it also builds in user space against user/shim.h (see
+ * bench/pcap-replay.c); keep kernel-only facilities out of it.
+ */
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/in6.h>
+#include <linux/skbuff.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)
+#include <linux/unaligned.h>
+#else
+#include <asm/unaligned.h>
+#endif
+#else
+#include "user/shim.h"
+#endif
+
+struct nat_mapping_stats;
+
+/* Snapshot of a mapping, taken inside the RCU read-side section, so that the
+ * packet path never dereferences a mapping after rcu_read_unlock().  The
+ * stats pointer is the one exception: it is freed by the same RCU callback
+ * as the mapping, and netfilter runs every hook under rcu_read_lock(). */
+struct nat_xlate {
+    struct in6_addr from_prefix;
+    struct in6_addr to_prefix;
+    __be64 prefix_mask[2];
+    int prefix_len;
+    bool valid;
+    bool nptv6;
+    u16 csum_delta;         /* mapping->csum_delta in this direction */
+    struct nat_mapping_stats __percpu *stats;
+};
+
+/*
+ * Addresses are compared and rewritten as two 64-bit halves under a
+ * precomputed mask.  The lengths real deployments use get their own
+ * paths with no mask or a constant one.  Header addresses are only
+ * 4-byte aligned, hence the unaligned accessors (plain loads on x86 and
+ * arm64).
+ */
+#define NAT_MASK48 cpu_to_be64(0xffffffffffff0000ULL)
+#define NAT_MASK56 cpu_to_be64(0xffffffffffffff00ULL)
+
+/* Masks of every prefix length, for the hash engine's probes.  Filled by
+ * nat_xlate_init(). */
+extern __be64 nat_len_masks[129][2];
+
+void nat_xlate_init(void);
+void nat_prefix_mask(__be64 mask[2], int prefix_len);
+u16 nat_csum_delta(const struct in6_addr *from, const struct in6_addr *to, int prefix_len);
+bool nat_nptv6_remap(struct in6_addr *addr, const struct in6_addr *new_prefix,
+                     const __be64 mask[2], int prefix_len, u16 adjust);
+u32 nat_hkey_hash(const struct in6_addr *prefix, u32 len, u32 seed);
+
+int nat_transport_offset(struct sk_buff *skb, u8 *proto, bool *first_frag);
+bool nat_rewrite_addr(struct sk_buff *skb, int thoff, u8 proto, bool first_frag,
+                      struct in6_addr *addr, const struct nat_xlate *x);
+bool nat_xlate_embedded(struct sk_buff *skb, int thoff, const struct nat_xlate *xs,
+                        const struct nat_xlate *xd);
+void nat_icmp6_csum_recalc(struct sk_buff *skb, int thoff);
+
+static __always_inline __be64 nat_addr_half(const struct in6_addr *addr, int i) {
+    return get_unaligned((const __be64 *)addr->s6_addr + i);
+}
+
+static __always_inline void nat_addr_set_half(struct in6_addr *addr, int i, __be64 v) {
+    put_unaligned(v, (__be64 *)addr->s6_addr + i);
+}
+
+/* ipv6_addr_prefix() for the hash probes: two ANDs, no memset. */
+static inline void nat_addr_mask(struct in6_addr *out, const struct in6_addr *addr,
+                                 int prefix_len) {
+    nat_addr_set_half(out, 0, nat_addr_half(addr, 0) & nat_len_masks[prefix_len][0]);
+    nat_addr_set_half(out, 1, nat_addr_half(addr, 1) & nat_len_masks[prefix_len][1]);
+}
+
+/* prefix must be masked to prefix_len, as every stored prefix is. */
+static inline bool compare_prefix_with_len(const struct in6_addr *addr,
+                                           const struct in6_addr *prefix,
+                                           const __be64 mask[2], int prefix_len) {
+    __be64 diff = nat_addr_half(addr, 0) ^ nat_addr_half(prefix, 0);
+
+    switch (prefix_len) {
+    case 48:
+        return !(diff & NAT_MASK48);
+    case 56:
+        return !(diff & NAT_MASK56);
+    case 64:
+        return !diff;
+    case 128:
+        return !diff && nat_addr_half(addr, 1) == nat_addr_half(prefix, 1);
+    }
+
+    return !((diff & mask[0]) |
+             ((nat_addr_half(addr, 1) ^ nat_addr_half(prefix, 1)) & mask[1]));
+}
+
+static inline void remap_address_with_len(struct in6_addr *addr,
+                                          const struct in6_addr *new_prefix,
+                                          const __be64 mask[2], int prefix_len) {
+    __be64 hi = nat_addr_half(addr, 0);
+    __be64 p = nat_addr_half(new_prefix, 0);
+
+    switch (prefix_len) {
+    case 48:
+        nat_addr_set_half(addr, 0, (p & NAT_MASK48) | (hi & ~NAT_MASK48));
+        return;
+    case 56:
+        nat_addr_set_half(addr, 0, (p & NAT_MASK56) | (hi & ~NAT_MASK56));
+        return;
+    case 64:
+        nat_addr_set_half(addr, 0, p);
+        return;
+    case 128:
+        nat_addr_set_half(addr, 0, p);
+        nat_addr_set_half(addr, 1, nat_addr_half(new_prefix, 1));
+        return;
+    }
+
+    nat_addr_set_half(addr, 0, (p & mask[0]) | (hi & ~mask[0]));
+    nat_addr_set_half(addr, 1, (nat_addr_half(new_prefix, 1) & mask[1]) |
+                               (nat_addr_half(addr, 1) & ~mask[1]));
+}
+
+/* Apply a lookup result to an address.  Returns false if an NPTv6 mapping
+ * cannot translate it. */
+static inline bool nat_remap(struct in6_addr *addr, const struct nat_xlate *x) {
+    if (x->nptv6)
+        return nat_nptv6_remap(addr, &x->to_prefix, x->prefix_mask, x->prefix_len,
+                               ~x->csum_delta);
+
+    remap_address_with_len(addr, &x->to_prefix, x->prefix_mask, x->prefix_len);
+    return true;
+}
+
+#endif